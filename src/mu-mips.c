@@ -3,6 +3,14 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define DBT_SUPPORTED
+#include <sys/mman.h>
+#endif
 
 #include "mu-mips.h"
 
@@ -13,6 +21,10 @@ void help() {
 	printf("------------------------------------------------------------------\n\n");
 	printf("\t**********MU-MIPS Help MENU**********\n\n");
 	printf("sim\t-- simulate program to completion \n");
+	printf("sim --functional\t-- switch to the fast functional engine and run to completion\n");
+	printf("sim --translate\t-- functional mode with basic blocks translated to host code (x86-64)\n");
+	printf("sim --pipeline\t-- switch back to the cycle-level pipeline and run to completion\n");
+	printf("sim --ooo\t-- switch to the cycle-level out-of-order core and run to completion\n");
 	printf("run <n>\t-- simulate program for <n> instructions\n");
 	printf("rdump\t-- dump register values\n");
 	printf("reset\t-- clears all registers/memory and re-loads the program\n");
@@ -21,46 +33,232 @@ void help() {
 	printf("high <val>\t-- set the HI register to <val>\n");
 	printf("low <val>\t-- set the LO register to <val>\n");
 	printf("print\t-- print the program loaded into memory\n");
+	printf("predictor <static|bimodal|gshare> [n]\t-- pipeline branch predictor, with an <n>-entry BTB (a power of two, default none); clears what it learned\n");
+	printf("branches\t-- per-branch predictions, mispredictions and wasted cycles in the pipeline since reset\n");
 	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("stats\t-- pipeline CPI and cache statistics since reset\n");
+	printf("cache <i|d> <size> <assoc> <line> [lru|fifo|random] [wb|wt] [latency]\t-- model an L1 cache in the pipeline (sizes in bytes, latency in cycles per miss, default lru wb 10)\n");
+	printf("cache <i|d> off\t-- memory accesses from IF or MEM take one cycle again\n");
+	printf("dram <banks> <row bytes> <tCAS> <tRCD> <tRP> [fcfs|frfcfs]\t-- send cache misses to a banked DRAM with open rows instead of a flat latency\n");
+	printf("dram off\t-- cache misses cost the latency given to 'cache' again\n");
+	printf("prefetch <none|nextline|stride|stream> [degree]\t-- fill the D-cache ahead of the load/store address stream, degree lines at a time (default 2)\n");
+	printf("storebuf <n>\t-- buffer up to n (at most %d) stores between MEM and the D-cache, coalescing stores to one word and forwarding to loads; 0 turns it off\n", SB_MAX);
+	printf("muldiv <mult> <div> [pipelined]\t-- MULT/MULTU and DIV/DIVU take this many cycles in their own unit while independent instructions go on (1 1: in EX like the rest)\n");
+	printf("depth <if> <ex> <mem>\t-- cycles (1 to %d) IF, EX and MEM each take in the pipeline, as that many stages; forwarding and hazards follow\n", DEPTH_MAX);
+	printf("width <n>\t-- issue up to n (at most %d) instructions a cycle in order: one load/store, branch/jump, HI/LO op or SYSCALL plus simple integer ops; 1 is scalar\n", ISSUE_MAX);
+	printf("threads <n> [rr|icount|switch]\t-- run n (at most %d) hardware contexts on the pipeline, fetching one instruction a cycle round robin, from the one with fewest in flight (icount) or from one until it waits in ID (switch); resets the simulation\n", THREADS_MAX);
+	printf("cores <n> [parallel|deterministic] [quantum] [bus latency]\t-- run the loaded program on n (at most %d) pipelined cores with $a0 = core id, sharing memory through MESI-coherent write-back D-caches on a snooping bus; parallel runs each core on a host thread with a barrier every quantum (default 100 cycles), deterministic takes them in turn; resets the simulation\n", CORES_MAX);
+	printf("thread <t> <file>\t-- context t (1 and up) runs <file> instead of the loaded program, its addresses offset by t << 24\n");
+	printf("ooo <rob> <width> [alu rs] [mem rs] [muldiv rs] [lsq]\t-- size the out-of-order core: ROB entries, instructions fetched/dispatched/committed a cycle, reservation stations per class and load/store queue entries (default 64 4 16 16 4 32)\n");
+	printf("mshr <n>\t-- let up to n (at most %d) D-cache load misses be outstanding while independent instructions go on; 0 blocks on every miss\n", MSHR_MAX);
+	printf("export-c <file>\t-- write the loaded program out as a C program that prints rdump() when run\n");
+	printf("bench mem <n>\t-- time <n> guest memory reads and writes\n");
+	printf("bench dispatch <n>\t-- run the program <n> times per functional engine (step, threaded, translated) and report host MIPS (memory is reloaded)\n");
+	printf("batch <n> <reg> <first> <step>\t-- run the program on <n> inputs in lockstep, input i having <reg> (0-31, hi or lo) = <first> + i * <step> and the rest as set by input/high/low\n");
 	printf("?\t-- display help menu\n");
 	printf("quit\t-- exit the simulator\n\n");
 	printf("------------------------------------------------------------------\n\n");
 }
 
 /***************************************************************/
-/* Read a 32-bit word from memory                                                                            */
+/* Find the region an address belongs to, -1 if it is unmapped          */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
+int mem_region(uint32_t address)
 {
 	int i;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
 		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
+			return i;
 		}
 	}
-	return 0;
+	return -1;
 }
 
 /***************************************************************/
-/* Write a 32-bit word to memory                                                                                */
+/* Locate the host byte backing a guest address (TLB miss path)      */
+/* Untouched pages read as zero; write asks for the page to be created */
+/* and marked dirty                                                                                                */
 /***************************************************************/
-void mem_write_32(uint32_t address, uint32_t value)
+uint8_t *mem_lookup(uint32_t address, int write)
 {
-	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
+	uint32_t vpn = address >> MEM_PAGE_SHIFT;
+	mem_page_t *page = PAGE_TABLE[vpn];
+	tlb_entry_t *entry;
+	decoded_inst_t *inst;
 
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+	if (page == NULL) {
+		if (!write || mem_region(address) < 0) {
+			return NULL;
+		}
+		page = calloc(1, sizeof(mem_page_t));
+		if (page == NULL) {
+			printf("Error: out of memory backing address 0x%08x\n", address);
+			exit(-1);
+		}
+		page->vpn = vpn;
+		PAGE_TABLE[vpn] = page;
+		if (NUM_TOUCHED_PAGES == MAX_TOUCHED_PAGES) {
+			MAX_TOUCHED_PAGES = MAX_TOUCHED_PAGES ? MAX_TOUCHED_PAGES * 2 : 64;
+			TOUCHED_PAGES = realloc(TOUCHED_PAGES, MAX_TOUCHED_PAGES * sizeof(*TOUCHED_PAGES));
+		}
+		TOUCHED_PAGES[NUM_TOUCHED_PAGES++] = page;
+	}
+	if (write) {
+		if (!page->dirty) {
+			page->dirty = TRUE;
+			if (NUM_DIRTY_PAGES == MAX_DIRTY_PAGES) {
+				MAX_DIRTY_PAGES = MAX_DIRTY_PAGES ? MAX_DIRTY_PAGES * 2 : 64;
+				DIRTY_PAGES = realloc(DIRTY_PAGES, MAX_DIRTY_PAGES * sizeof(*DIRTY_PAGES));
+			}
+			DIRTY_PAGES[NUM_DIRTY_PAGES++] = page;
+		}
+		if (page->decoded != NULL) {
+			/* the word is about to change; decode it again on its next fetch */
+			page->decoded[(address & MEM_PAGE_MASK) >> 2].valid = FALSE;
+			if ((address & MEM_PAGE_MASK) >= 4) {
+				/* a pair ending in this word must not run fused any more */
+				inst = &page->decoded[((address & MEM_PAGE_MASK) >> 2) - 1];
+				inst->handler = inst->op;
+			}
+			if (page->translated) {
+				dbt_flush();
+			}
 		}
+		else {
+			entry = &TLB_WRITE[vpn & (TLB_SIZE - 1)];
+			entry->vpn = vpn;
+			entry->page = page->data;
+		}
+	}
+	entry = &TLB_READ[vpn & (TLB_SIZE - 1)];
+	entry->vpn = vpn;
+	entry->page = page->data;
+	return page->data + (address & MEM_PAGE_MASK);
+}
+
+/***************************************************************/
+/* Forget all cached translations                                                                              */
+/***************************************************************/
+void tlb_flush()
+{
+	int i;
+	for (i = 0; i < TLB_SIZE; i++) {
+		TLB_READ[i].vpn = TLB_INVALID;
+		TLB_READ[i].page = NULL;
+		TLB_WRITE[i].vpn = TLB_INVALID;
+		TLB_WRITE[i].page = NULL;
+	}
+}
+
+/***************************************************************/
+/* Report a misaligned access; the simulation stops like on an address error */
+/***************************************************************/
+void mem_unaligned(const char *access, int width, uint32_t address)
+{
+	printf("Address error: unaligned %d-bit %s at 0x%08x\n", width, access, address);
+	RUN_FLAG = FALSE;
+	DBT_CTX.stop = TRUE;	/* translated code checks these after every access */
+	DBT_CTX.fault = TRUE;
+}
+
+/***************************************************************/
+/* TLB fast path in front of mem_lookup                                                                */
+/***************************************************************/
+static inline uint8_t *mem_translate(uint32_t address, int write)
+{
+	tlb_entry_t *entry = write ? &TLB_WRITE[(address >> MEM_PAGE_SHIFT) & (TLB_SIZE - 1)]
+							   : &TLB_READ[(address >> MEM_PAGE_SHIFT) & (TLB_SIZE - 1)];
+	if (entry->vpn == (address >> MEM_PAGE_SHIFT)) {
+		return entry->page + (address & MEM_PAGE_MASK);
+	}
+	return NUM_CORES > 1 ? mc_lookup(address, write) : mem_lookup(address, write);
+}
+
+/***************************************************************/
+/* Read a byte from memory                                                                                       */
+/***************************************************************/
+uint8_t mem_read_8(uint32_t address)
+{
+	uint8_t *p = mem_translate(address, FALSE);
+	return p ? *p : 0;
+}
+
+/***************************************************************/
+/* Read a halfword from memory (guest memory is little-endian)           */
+/***************************************************************/
+uint16_t mem_read_16(uint32_t address)
+{
+	uint8_t *p;
+	uint16_t value;
+	if (address & 1) {
+		mem_unaligned("read", 16, address);
+		return 0;
+	}
+	if ((p = mem_translate(address, FALSE)) == NULL) {
+		return 0;
+	}
+	memcpy(&value, p, sizeof(value));
+	return GUEST_TO_HOST_16(value);
+}
+
+/***************************************************************/
+/* Read a 32-bit word from memory                                                                            */
+/***************************************************************/
+uint32_t mem_read_32(uint32_t address)
+{
+	uint8_t *p;
+	uint32_t value;
+	if (address & 3) {
+		mem_unaligned("read", 32, address);
+		return 0;
+	}
+	if ((p = mem_translate(address, FALSE)) == NULL) {
+		return 0;
+	}
+	memcpy(&value, p, sizeof(value));
+	return GUEST_TO_HOST_32(value);
+}
+
+/***************************************************************/
+/* Write a byte to memory                                                                                         */
+/***************************************************************/
+void mem_write_8(uint32_t address, uint8_t value)
+{
+	uint8_t *p = mem_translate(address, TRUE);
+	if (p != NULL) {
+		*p = value;
+	}
+}
+
+/***************************************************************/
+/* Write a halfword to memory                                                                                  */
+/***************************************************************/
+void mem_write_16(uint32_t address, uint16_t value)
+{
+	uint8_t *p;
+	if (address & 1) {
+		mem_unaligned("write", 16, address);
+		return;
+	}
+	if ((p = mem_translate(address, TRUE)) != NULL) {
+		value = GUEST_TO_HOST_16(value);
+		memcpy(p, &value, sizeof(value));
+	}
+}
+
+/***************************************************************/
+/* Write a 32-bit word to memory                                                                                */
+/***************************************************************/
+void mem_write_32(uint32_t address, uint32_t value)
+{
+	uint8_t *p;
+	if (address & 3) {
+		mem_unaligned("write", 32, address);
+		return;
+	}
+	if ((p = mem_translate(address, TRUE)) != NULL) {
+		value = GUEST_TO_HOST_32(value);
+		memcpy(p, &value, sizeof(value));
 	}
 }
 
@@ -68,8 +266,17 @@ void mem_write_32(uint32_t address, uint32_t value)
 /* Execute one cycle                                                                                                              */
 /***************************************************************/
 void cycle() {                                                
-	handle_pipeline();
-	CURRENT_STATE = NEXT_STATE;
+	if (!SIM_CYCLE_LEVEL(SIM_MODE)) {
+		functional_run(1);
+	}
+	else if (SIM_MODE == SIM_OOO) {
+		ooo_cycle();
+		NEXT_STATE = CURRENT_STATE;
+	}
+	else {
+		handle_pipeline();
+		CURRENT_STATE = NEXT_STATE;
+	}
 	CYCLE_COUNT++;
 }
 
@@ -78,12 +285,34 @@ void cycle() {
 /***************************************************************/
 void run(int num_cycles) {                                      
 	
+	if (NUM_CORES > 1) {
+		if (!mc_ready()) {
+			return;
+		}
+		if (!mc_running()) {
+			printf("Simulation Stopped\n\n");
+			return;
+		}
+		printf("Running simulator for %d cycles...\n\n", num_cycles);
+		mc_run(num_cycles);
+		if (!mc_running()) {
+			printf("Simulation Stopped.\n\n");
+		}
+		return;
+	}
 	if (RUN_FLAG == FALSE) {
 		printf("Simulation Stopped\n\n");
 		return;
 	}
 
 	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	if (!SIM_CYCLE_LEVEL(SIM_MODE)) {
+		CYCLE_COUNT += SIM_MODE == SIM_TRANSLATED ? dbt_run(num_cycles) : functional_run(num_cycles);
+		if (RUN_FLAG == FALSE) {
+			printf("Simulation Stopped.\n\n");
+		}
+		return;
+	}
 	int i;
 	for (i = 0; i < num_cycles; i++) {
 		if (RUN_FLAG == FALSE) {
@@ -98,12 +327,30 @@ void run(int num_cycles) {
 /* simulate to completion                                                                                               */
 /***************************************************************/
 void runAll() {                                                     
+	if (NUM_CORES > 1) {
+		if (!mc_ready()) {
+			return;
+		}
+		if (!mc_running()) {
+			printf("Simulation Stopped.\n\n");
+			return;
+		}
+		printf("Simulation Started...\n\n");
+		while (mc_running()) {
+			mc_run(0xFFFFFFFF);
+		}
+		printf("Simulation Finished.\n\n");
+		return;
+	}
 	if (RUN_FLAG == FALSE) {
 		printf("Simulation Stopped.\n\n");
 		return;
 	}
 
 	printf("Simulation Started...\n\n");
+	while (RUN_FLAG && !SIM_CYCLE_LEVEL(SIM_MODE)) {
+		CYCLE_COUNT += SIM_MODE == SIM_TRANSLATED ? dbt_run(0xFFFFFFFF) : functional_run(0xFFFFFFFF);
+	}
 	while (RUN_FLAG){
 		cycle();
 	}
@@ -120,12 +367,154 @@ void mdump(uint32_t start, uint32_t stop) {
 	printf("Memory content [0x%08x..0x%08x] :\n", start, stop);
 	printf("-------------------------------------------------------------\n");
 	printf("\t[Address in Hex (Dec) ]\t[Value]\n");
+	start &= ~0x3;
 	for (address = start; address <= stop; address += 4){
 		printf("\t0x%08x (%d) :\t0x%08x\n", address, address, mem_read_32(address));
 	}
 	printf("\n");
 }
 
+/***************************************************************/
+/* Wall clock in seconds, for the benchmarks                                                        */
+/***************************************************************/
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/***************************************************************/
+/* Time guest word accesses through the TLB/page table against the   */
+/* original memory: one flat buffer per region, found by walking       */
+/* every region on each access (the write walk does not stop at its */
+/* region). Uses kernel data pages and leaves them as it found them */
+/***************************************************************/
+void bench_memory(uint32_t accesses) {
+	struct {
+		uint32_t begin, end;
+		uint8_t *mem;
+	} regions[NUM_MEM_REGION];
+	uint32_t i, address, offset, value, span = 4 * MEM_PAGE_SIZE;
+	uint32_t touched = NUM_TOUCHED_PAGES, dirty = NUM_DIRTY_PAGES;
+	volatile uint32_t sink = 0;
+	double t0, t_walk_rd, t_walk_wr, t_rd, t_wr;
+	uint8_t *saved;
+	mem_page_t *page;
+	int r;
+
+	if (accesses == 0) {
+		return;
+	}
+	/* what the program has in the span, to put back afterwards */
+	saved = calloc(span, 1);
+	if (saved == NULL) {
+		printf("Error: out of memory for the benchmark\n");
+		return;
+	}
+	for (address = MEM_KDATA_BEGIN; address < MEM_KDATA_BEGIN + span; address += MEM_PAGE_SIZE) {
+		if ((page = PAGE_TABLE[address >> MEM_PAGE_SHIFT]) != NULL) {
+			memcpy(saved + (address - MEM_KDATA_BEGIN), page->data, MEM_PAGE_SIZE);
+		}
+	}
+	for (r = 0; r < NUM_MEM_REGION; r++) {
+		regions[r].begin = MEM_REGIONS[r].begin;
+		regions[r].end = MEM_REGIONS[r].end;
+		/* only the kernel data span is touched, so only it needs a buffer */
+		regions[r].mem = regions[r].begin == MEM_KDATA_BEGIN ? calloc(span, 1) : NULL;
+		if (regions[r].begin == MEM_KDATA_BEGIN && regions[r].mem == NULL) {
+			printf("Error: out of memory for the benchmark\n");
+			exit(-1);
+		}
+	}
+	for (address = MEM_KDATA_BEGIN; address < MEM_KDATA_BEGIN + span; address += 4) {
+		mem_write_32(address, 0);
+	}
+
+	t0 = now_seconds();
+	for (i = 0; i < accesses; i++) {
+		address = MEM_KDATA_BEGIN + ((i << 2) & (span - 1));
+		value = 0;
+		for (r = 0; r < NUM_MEM_REGION; r++) {
+			if ( (address >= regions[r].begin) &&  ( address <= regions[r].end) ) {
+				offset = address - regions[r].begin;
+				value = (regions[r].mem[offset+3] << 24) |
+						(regions[r].mem[offset+2] << 16) |
+						(regions[r].mem[offset+1] <<  8) |
+						(regions[r].mem[offset+0] <<  0);
+				break;
+			}
+		}
+		sink += value;
+	}
+	t_walk_rd = now_seconds() - t0;
+
+	t0 = now_seconds();
+	for (i = 0; i < accesses; i++) {
+		address = MEM_KDATA_BEGIN + ((i << 2) & (span - 1));
+		for (r = 0; r < NUM_MEM_REGION; r++) {
+			if ( (address >= regions[r].begin) && (address <= regions[r].end) ) {
+				offset = address - regions[r].begin;
+
+				regions[r].mem[offset+3] = (i >> 24) & 0xFF;
+				regions[r].mem[offset+2] = (i >> 16) & 0xFF;
+				regions[r].mem[offset+1] = (i >>  8) & 0xFF;
+				regions[r].mem[offset+0] = (i >>  0) & 0xFF;
+			}
+		}
+	}
+	t_walk_wr = now_seconds() - t0;
+	sink += regions[2].mem[0];
+
+	t0 = now_seconds();
+	for (i = 0; i < accesses; i++) {
+		sink += mem_read_32(MEM_KDATA_BEGIN + ((i << 2) & (span - 1)));
+	}
+	t_rd = now_seconds() - t0;
+
+	t0 = now_seconds();
+	for (i = 0; i < accesses; i++) {
+		mem_write_32(MEM_KDATA_BEGIN + ((i << 2) & (span - 1)), i);
+	}
+	t_wr = now_seconds() - t0;
+
+	/* the pages are as the program left them, and no more are dirty or allocated than before */
+	for (address = MEM_KDATA_BEGIN; address < MEM_KDATA_BEGIN + span; address += MEM_PAGE_SIZE) {
+		page = PAGE_TABLE[address >> MEM_PAGE_SHIFT];
+		memcpy(page->data, saved + (address - MEM_KDATA_BEGIN), MEM_PAGE_SIZE);
+		if (page->decoded != NULL) {
+			predecode_page(page);
+		}
+		if (page->translated) {
+			dbt_flush();
+		}
+	}
+	for (i = dirty; i < NUM_DIRTY_PAGES; i++) {
+		DIRTY_PAGES[i]->dirty = FALSE;
+	}
+	NUM_DIRTY_PAGES = dirty;
+	while (NUM_TOUCHED_PAGES > touched) {
+		page = TOUCHED_PAGES[--NUM_TOUCHED_PAGES];
+		PAGE_TABLE[page->vpn] = NULL;
+		free(page->snapshot);
+		free(page->decoded);
+		free(page);
+	}
+	tlb_flush();
+	free(saved);
+	for (r = 0; r < NUM_MEM_REGION; r++) {
+		free(regions[r].mem);
+	}
+
+	printf("-------------------------------------\n");
+	printf("Memory benchmark (%u accesses)\n", accesses);
+	printf("-------------------------------------\n");
+	printf("original read\t\t: %8.2f M accesses/sec\n", accesses / t_walk_rd / 1e6);
+	printf("original write\t\t: %8.2f M accesses/sec\n", accesses / t_walk_wr / 1e6);
+	printf("mem_read_32\t\t: %8.2f M accesses/sec\n", accesses / t_rd / 1e6);
+	printf("mem_write_32\t\t: %8.2f M accesses/sec\n", accesses / t_wr / 1e6);
+	printf("-------------------------------------\n");
+}
+
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */   
 /***************************************************************/
@@ -134,8 +523,18 @@ void rdump() {
 	printf("-------------------------------------\n");
 	printf("Dumping Register Content\n");
 	printf("-------------------------------------\n");
-	printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
-	printf("# Cycles Executed\t: %u\n", CYCLE_COUNT);
+	if (NUM_THREADS > 1) {
+		/* INSTRUCTION_COUNT covers every context; each has its own count below */
+		printf("# Instructions Executed (all contexts)\t: %u\n", INSTRUCTION_COUNT);
+		printf("# Cycles Executed\t: %u\n", CYCLE_COUNT);
+		printf("-------------------------------------\n");
+		printf("Context 0%s\n", (THREAD_RUNNING & 1u) ? "" : " (done)");
+		printf("# Instructions Executed\t: %llu\n", (unsigned long long)THREAD_RETIRED[0]);
+	}
+	else {
+		printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
+		printf("# Cycles Executed\t: %u\n", CYCLE_COUNT);
+	}
 	printf("PC\t: 0x%08x\n", CURRENT_STATE.PC);
 	printf("-------------------------------------\n");
 	printf("[Register]\t[Value]\n");
@@ -147,6 +546,12 @@ void rdump() {
 	printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
 	printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
 	printf("-------------------------------------\n");
+	if (NUM_THREADS > 1) {
+		threads_rdump();
+	}
+	if (NUM_CORES > 1) {
+		mc_rdump();
+	}
 }
 
 /***************************************************************/
@@ -154,10 +559,15 @@ void rdump() {
 /***************************************************************/
 void handle_command() {                         
 	char buffer[20];
+	char what[20];
+	char line[80];
 	uint32_t start, stop, cycles;
 	uint32_t register_no;
 	int register_value;
 	int hi_reg_value, lo_reg_value;
+	int batch_step;
+	FILE *fp;
+	uint32_t alu_rs, mem_rs, md_rs, lsq;
 
 	printf("MU-MIPS SIM:> ");
 
@@ -170,12 +580,71 @@ void handle_command() {
 		case 's':
 			if (buffer[1] == 'h' || buffer[1] == 'H'){
 				show_pipeline();
+			}else if ((buffer[1] == 't' || buffer[1] == 'T') && (buffer[2] == 'o' || buffer[2] == 'O')){
+				/* storebuf <n> */
+				if (scanf("%u", &start) != 1 || start > SB_MAX) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				SB_DEPTH = start;
+				dram_detach(&SB_READY);
+				SB_HEAD = SB_COUNT = 0;
+				SB_DRAINING = FALSE;
+				printf("%u-entry store buffer%s\n", SB_DEPTH, SB_DEPTH ? "" : " (off: stores go straight to the D-cache)");
+			}else if (buffer[1] == 't' || buffer[1] == 'T'){
+				print_stats();
 			}else {
+				/* sim [--functional | --translate | --pipeline] */
+				if (fgets(line, sizeof(line), stdin) != NULL) {
+					if (strstr(line, "--functional") != NULL) {
+						set_sim_mode(SIM_FUNCTIONAL);
+					}
+					else if (strstr(line, "--translate") != NULL) {
+						set_sim_mode(SIM_TRANSLATED);
+					}
+					else if (strstr(line, "--pipeline") != NULL) {
+						set_sim_mode(SIM_PIPELINE);
+					}
+					else if (strstr(line, "--ooo") != NULL) {
+						set_sim_mode(SIM_OOO);
+					}
+				}
 				runAll(); 
 			}
 			break;
 		case 'M':
 		case 'm':
+			if (buffer[1] == 'u' || buffer[1] == 'U') {
+				/* muldiv <mult latency> <div latency> [pipelined] */
+				if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%u %u", &start, &stop) != 2 ||
+					start == 0 || stop == 0 || start > 64 || stop > 64) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				if (NUM_THREADS > 1 && (start > 1 || stop > 1)) {
+					printf("Error: the multiply/divide unit is single-cycle with hardware contexts\n");
+					break;
+				}
+				MD_MULT_LATENCY = start;
+				MD_DIV_LATENCY = stop;
+				MD_PIPELINED = strstr(line, "pipelined") != NULL;
+				printf("MULT %u cycles%s, DIV %u cycles\n", MD_MULT_LATENCY, MD_PIPELINED ? " (pipelined)" : "", MD_DIV_LATENCY);
+				break;
+			}
+			if (buffer[1] == 's' || buffer[1] == 'S') {
+				/* mshr <n> */
+				if (scanf("%u", &start) != 1 || start > MSHR_MAX) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				if (NUM_THREADS > 1 && start > 0) {
+					printf("Error: D-cache misses block MEM with hardware contexts\n");
+					break;
+				}
+				NUM_MSHRS = start;
+				printf("%u MSHRs%s\n", NUM_MSHRS, NUM_MSHRS ? "" : ": D-cache misses block MEM");
+				break;
+			}
 			if (scanf("%x %x", &start, &stop) != 2){
 				break;
 			}
@@ -228,14 +697,182 @@ void handle_command() {
 			CURRENT_STATE.LO = lo_reg_value;
 			NEXT_STATE.LO = lo_reg_value;
 			break;
+		case 'C':
+		case 'c':
+			if (buffer[1] == 'o' || buffer[1] == 'O') {
+				/* cores <n> [parallel|deterministic] [quantum] [bus latency] */
+				strcpy(what, MC_DETERMINISTIC ? "deterministic" : "parallel");
+				stop = MC_QUANTUM;
+				cycles = MC_BUS_LATENCY;
+				if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%u %19s %u %u", &start, what, &stop, &cycles) < 1) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				if (mc_configure(start, what, stop, cycles)) {
+					printf("%u core%s, %s, %u-cycle quantum, %u-cycle bus\n", NUM_CORES, NUM_CORES > 1 ? "s" : "",
+						   MC_DETERMINISTIC ? "deterministic" : "parallel", MC_QUANTUM, MC_BUS_LATENCY);
+				}
+				break;
+			}
+			cache_command();
+			break;
+		case 'D':
+		case 'd':
+			if (buffer[1] == 'e' || buffer[1] == 'E') {
+				/* depth <if> <ex> <mem> */
+				if (scanf("%u %u %u", &start, &stop, &cycles) != 3) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				if (depth_configure(start, stop, cycles)) {
+					printf("Pipeline: IF %u, ID 1, EX %u, MEM %u, WB 1 (%u stages)\n", IF_DEPTH, EX_DEPTH, MEM_DEPTH,
+						   IF_DEPTH + EX_DEPTH + MEM_DEPTH + 2);
+				}
+				break;
+			}
+			dram_command();
+			break;
+		case 'E':
+		case 'e':
+			/* export-c <file> */
+			if (scanf("%79s", line) != 1) {
+				break;
+			}
+			export_c(line);
+			break;
 		case 'P':
 		case 'p':
+			if (buffer[1] == 'r' && buffer[2] == 'e' && buffer[3] == 'f') {
+				/* prefetch <none|nextline|stride|stream> [degree] */
+				cycles = 0;
+				if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%19s %u", what, &cycles) < 1 ||
+					!pf_configure(what, cycles)) {
+					printf("Invalid Command.\n");
+				}
+				break;
+			}
+			if (buffer[1] == 'r' && buffer[2] == 'e') {
+				/* predictor <static|bimodal|gshare> [btb entries] */
+				cycles = 0;
+				if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%19s %u", what, &cycles) < 1 ||
+					!bp_configure(what, cycles)) {
+					printf("Invalid Command.\n");
+				}
+				break;
+			}
 			print_program(); 
 			break;
+		case 'B':
+		case 'b':
+			if (buffer[1] == 'r' || buffer[1] == 'R') {
+				branch_report();
+				break;
+			}
+			if (buffer[1] == 'a' || buffer[1] == 'A') {
+				/* batch <lanes> <reg> <first> <step> */
+				if (scanf("%u %19s %i %i", &cycles, what, &register_value, &batch_step) != 4) {
+					break;
+				}
+				if (what[0] == 'h' || what[0] == 'H') {
+					register_no = REG_HI;
+				}
+				else if (what[0] == 'l' || what[0] == 'L') {
+					register_no = REG_LO;
+				}
+				else if (sscanf(what, "%u", &register_no) != 1 || register_no >= MIPS_REGS) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				batch_run(cycles, register_no, register_value, batch_step);
+				break;
+			}
+			if (scanf("%19s %u", what, &cycles) != 2) {
+				break;
+			}
+			if (strcmp(what, "mem") == 0) {
+				bench_memory(cycles);
+			}
+			else if (strcmp(what, "dispatch") == 0) {
+				bench_dispatch(cycles);
+			}
+			else {
+				printf("Invalid Command.\n");
+			}
+			break;
+		case 'O':
+		case 'o':
+			/* ooo <rob> <width> [alu rs] [mem rs] [muldiv rs] [lsq] */
+			alu_rs = OOO_RS_SIZE[RS_ALU];
+			mem_rs = OOO_RS_SIZE[RS_MEM];
+			md_rs = OOO_RS_SIZE[RS_MULDIV];
+			lsq = OOO_LSQ_SIZE;
+			if (fgets(line, sizeof(line), stdin) == NULL ||
+				sscanf(line, "%u %u %u %u %u %u", &start, &stop, &alu_rs, &mem_rs, &md_rs, &lsq) < 2) {
+				printf("Invalid Command.\n");
+				break;
+			}
+			if (ooo_configure(start, stop, alu_rs, mem_rs, md_rs, lsq)) {
+				printf("Out-of-order core: ROB %u, width %u, RS %u/%u/%u, LSQ %u\n", OOO_ROB_SIZE, OOO_WIDTH,
+					   OOO_RS_SIZE[RS_ALU], OOO_RS_SIZE[RS_MEM], OOO_RS_SIZE[RS_MULDIV], OOO_LSQ_SIZE);
+			}
+			break;
+		case 'W':
+		case 'w':
+			/* width <n> */
+			if (scanf("%u", &start) != 1 || start == 0 || start > ISSUE_MAX) {
+				printf("Invalid Command.\n");
+				break;
+			}
+			if (NUM_THREADS > 1 && start > 1) {
+				printf("Error: hardware contexts share a scalar pipeline\n");
+				break;
+			}
+			if (SIM_MODE == SIM_PIPELINE) {
+				pipeline_flush();	/* nothing in flight in a lane that goes away */
+			}
+			ISSUE_WIDTH = start;
+			printf("Issue width %u\n", ISSUE_WIDTH);
+			break;
+		case 'T':
+		case 't':
+			if (buffer[6] == 's' || buffer[6] == 'S') {
+				/* threads <n> [rr|icount|switch] */
+				what[0] = '\0';
+				if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%u %19s", &start, what) < 1) {
+					printf("Invalid Command.\n");
+					break;
+				}
+				if (threads_configure(start, what[0] != '\0' ? what : NULL)) {
+					printf("%u hardware context%s, %s fetch\n", NUM_THREADS, NUM_THREADS > 1 ? "s" : "",
+						   FETCH_POLICY == FETCH_RR ? "round robin" : FETCH_POLICY == FETCH_ICOUNT ? "ICOUNT" : "switch on stall");
+				}
+				break;
+			}
+			/* thread <context> <program file> */
+			if (scanf("%u %79s", &start, line) != 2 || start == 0 || start >= THREADS_MAX) {
+				printf("Invalid Command.\n");
+				break;
+			}
+			if ((fp = fopen(line, "r")) == NULL) {
+				printf("Error: Can't open program file %s\n", line);
+				break;
+			}
+			fclose(fp);
+			strncpy(THREAD_PROGRAM[start], line, sizeof(THREAD_PROGRAM[start]) - 1);
+			printf("Context %u runs %s\n", start, THREAD_PROGRAM[start]);
+			if (THREADS_LOADED & (1u << start)) {
+				/* the old program is in the memory image: the next reset builds it again */
+				THREADS_STALE = TRUE;
+			}
+			if (start < NUM_THREADS) {
+				reset();
+			}
+			break;
         case 'f':
             if (scanf("%d", &ENABLE_FORWARDING) != 1) {
                 break;
             }
+            pipeline_select();
             ENABLE_FORWARDING == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n"); break;
 		default:
 			printf("Invalid Command.\n");
@@ -247,6 +884,30 @@ void handle_command() {
 /* reset registers/memory and reload program                                                    */
 /***************************************************************/
 void reset() {   
+	if (SNAPSHOT_TAKEN && !THREADS_STALE) {
+		printf("Memory restored from snapshot (%u dirty pages).\n\n", NUM_DIRTY_PAGES);
+		mem_restore_snapshot();
+	}
+	else {
+		free_touched_pages();
+		load_program();
+		THREADS_LOADED = 0;
+		THREADS_STALE = FALSE;
+		mem_snapshot();
+	}
+	threads_load();
+	core_reset();
+	if (NUM_CORES > 1) {
+		/* the other cores start over too, configured like core 0 */
+		mc_config_capture(&MC_CONFIG);
+		mc_dispatch(MC_RESET);
+	}
+}
+
+/***************************************************************/
+/* reset this core's registers, pipeline, caches and counters              */
+/***************************************************************/
+void core_reset() {
 	int i;
 	/*reset registers*/
 	for (i = 0; i < MIPS_REGS; i++){
@@ -254,50 +915,123 @@ void reset() {
 	}
 	CURRENT_STATE.HI = 0;
 	CURRENT_STATE.LO = 0;
+	CURRENT_STATE.REGS[4] = CORE_ID;	/* $a0: which core this is */
 	
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
-	}
-	
-	/*load program*/
-	load_program();
-	
-	/*reset PC*/
+	/*reset PC and empty the pipeline*/
 	INSTRUCTION_COUNT = 0;
+	CYCLE_COUNT = 0;
+	mshr_reset();	/* before the flush, so no load lands in the fresh registers */
+	sb_reset();
+	pipeline_flush();
+	bp_reset();
+	cache_reset(&ICACHE);
+	cache_reset(&DCACHE);
+	dram_reset();
+	pf_reset();
+	md_reset();
+	memset(ISSUE_GROUPS, 0, sizeof(ISSUE_GROUPS));
+	memset(ISSUE_LIMITS, 0, sizeof(ISSUE_LIMITS));
 	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
+	threads_reset();
+	ooo_reset();
+	memset(&MC_CORES[CORE_ID].stats, 0, sizeof(MC_CORES[CORE_ID].stats));
+	MC_CORES[CORE_ID].link = MC_NO_LINK;
 	NEXT_STATE = CURRENT_STATE;
 	RUN_FLAG = TRUE;
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Start with an empty page table; pages come in on first write           */
 /***************************************************************/
 void init_memory() {                                           
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
-	}
+	memset(PAGE_TABLE, 0, sizeof(PAGE_TABLE));
+	NUM_TOUCHED_PAGES = 0;
+	tlb_flush();
 }
 
-/**************************************************************/
-/* load program into memory                                                                                      */
-/**************************************************************/
-void load_program() {                   
-	FILE * fp;
-	int i, word;
-	uint32_t address;
-
-	/* Open program file. */
-	fp = fopen(prog_file, "r");
-	if (fp == NULL) {
-		printf("Error: Can't open program file %s\n", prog_file);
-		exit(-1);
+/***************************************************************/
+/* Release every page the program touched; memory reads as zero again */
+/***************************************************************/
+void free_touched_pages() {
+	uint32_t i;
+	dbt_flush();
+	for (i = 0; i < NUM_TOUCHED_PAGES; i++) {
+		PAGE_TABLE[TOUCHED_PAGES[i]->vpn] = NULL;
+		free(TOUCHED_PAGES[i]->snapshot);
+		free(TOUCHED_PAGES[i]->decoded);
+		free(TOUCHED_PAGES[i]);
 	}
+	NUM_TOUCHED_PAGES = 0;
+	NUM_DIRTY_PAGES = 0;
+	SNAPSHOT_TAKEN = FALSE;
+	tlb_flush();
+}
 
-	/* Read in the program. */
+/***************************************************************/
+/* Remember the freshly loaded image so reset can go back to it           */
+/***************************************************************/
+void mem_snapshot() {
+	uint32_t i;
+	mem_page_t *page;
+	for (i = 0; i < NUM_TOUCHED_PAGES; i++) {
+		page = TOUCHED_PAGES[i];
+		if (page->snapshot == NULL) {
+			page->snapshot = malloc(MEM_PAGE_SIZE);
+			if (page->snapshot == NULL) {
+				printf("Error: out of memory taking memory snapshot\n");
+				exit(-1);
+			}
+		}
+		memcpy(page->snapshot, page->data, MEM_PAGE_SIZE);
+		page->dirty = FALSE;
+	}
+	NUM_DIRTY_PAGES = 0;
+	SNAPSHOT_TAKEN = TRUE;
+	tlb_flush();
+}
+
+/***************************************************************/
+/* Undo every write made since the snapshot, one dirty page at a time */
+/***************************************************************/
+void mem_restore_snapshot() {
+	uint32_t i;
+	mem_page_t *page;
+	for (i = 0; i < NUM_DIRTY_PAGES; i++) {
+		page = DIRTY_PAGES[i];
+		if (page->snapshot != NULL) {
+			memcpy(page->data, page->snapshot, MEM_PAGE_SIZE);
+		}
+		else {
+			memset(page->data, 0, MEM_PAGE_SIZE);
+		}
+		if (page->decoded != NULL) {
+			predecode_page(page);
+		}
+		if (page->translated) {
+			dbt_flush();
+		}
+		page->dirty = FALSE;
+	}
+	NUM_DIRTY_PAGES = 0;
+	tlb_flush();
+}
+
+/**************************************************************/
+/* load program into memory                                                                                      */
+/**************************************************************/
+void load_program() {                   
+	FILE * fp;
+	int i, word;
+	uint32_t address;
+
+	/* Open program file. */
+	fp = fopen(prog_file, "r");
+	if (fp == NULL) {
+		printf("Error: Can't open program file %s\n", prog_file);
+		exit(-1);
+	}
+
+	/* Read in the program. */
 
 	i = 0;
 	while( fscanf(fp, "%x\n", &word) != EOF ) {
@@ -309,1616 +1043,5703 @@ void load_program() {
 	PROGRAM_SIZE = i/4;
 	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
 	fclose(fp);
+	predecode_program();
 }
 
 /************************************************************/
-/* maintain the pipeline                                                                                           */ 
+/* Read a register as the ISA sees it; HI and LO are numbered REG_HI/REG_LO */ 
 /************************************************************/
-void handle_pipeline()
+uint32_t read_reg(const CPU_State *state, uint32_t reg)
 {
-	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
-	/*Since we do not have branch/jump instructions, INSTRUCTION_COUNT should be incremented in WB stage */
-    
-	WB();
-	MEM();
-	EX();
-	ID();
-	IF();
+	if (reg == REG_HI) {
+		return state->HI;
+	}
+	if (reg == REG_LO) {
+		return state->LO;
+	}
+	return state->REGS[reg];
 }
 
 /************************************************************/
-/* writeback (WB) pipeline stage:                                                                          */ 
+/* Commit an instruction's result to its destination register        */ 
 /************************************************************/
-void WB()
+void write_result(CPU_State *state, const decoded_inst_t *inst, uint32_t value, uint64_t hilo)
 {
-	/*IMPLEMENT THIS*/
-    uint32_t opcode, function, rd, rt;
-    
-    opcode = (MEM_WB.IR & 0xFC000000) >> 26;
-	function = MEM_WB.IR & 0x0000003F;
-    rt = (MEM_WB.IR & 0x001F0000) >> 16;
-    rd = (MEM_WB.IR & 0x0000F800) >> 11;
-    
-    //printf("%u\n", MEM_WB.IR);
-    
-        if(opcode == 0x00 && MEM_WB.IR != 0){
-		switch(function){
-			case 0x00: //SLL
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-            case 0x01:
-                IF_EX.FLAG = TRUE;
-                INSTRUCTION_COUNT--;
-                printf("Set IF_EX.FLAG = TRUE.\n");
-                break;
-			case 0x02: //SRL
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x03: //SRA 
-                NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //SYSCALL
-                if(MEM_WB.ALUOutput == 0xa){
-					RUN_FLAG = FALSE;
-                }
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x10: //MFHI
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x11: //MTHI
-				NEXT_STATE.HI = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x12: //MFLO
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x13: //MTLO
-				NEXT_STATE.LO = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x18: //MULT
-                NEXT_STATE.LO = (MEM_WB.AA & 0x00000000FFFFFFFF);
-                NEXT_STATE.HI = (MEM_WB.AA & 0XFFFFFFFF00000000) >> 32;
-                MEM_WB.RegisterRd = rd;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x19: //MULTU
-                NEXT_STATE.LO = (MEM_WB.AA & 0x00000000FFFFFFFF);
-                NEXT_STATE.HI = (MEM_WB.AA & 0XFFFFFFFF00000000) >> 32;
-                MEM_WB.RegisterRd = rd;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1A: //DIV 
-                NEXT_STATE.LO = MEM_WB.ALUOutput;
-                NEXT_STATE.HI = MEM_WB.A;
-                MEM_WB.RegisterRd = rd;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1B: //DIVU
-				NEXT_STATE.LO = MEM_WB.ALUOutput;
-                NEXT_STATE.HI = MEM_WB.A;
-                MEM_WB.RegisterRd = rd;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //ADD
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //ADDU 
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x22: //SUB
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //SUBU
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x24: //AND
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x25: //OR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x26: //XOR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x27: //NOR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x2A: //SLT
-                NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-                print_instruction(CURRENT_STATE.PC);
-				break;
-			default:
-				printf("WB at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-                INSTRUCTION_COUNT--;
-				break;
-		}
+	switch (inst->dst) {
+		case 0:
+			break;
+		case REG_HI:
+			state->HI = hilo >> 32;
+			break;
+		case REG_LO:
+			state->LO = (uint32_t)hilo;
+			break;
+		case REG_HILO:
+			state->HI = hilo >> 32;
+			state->LO = (uint32_t)hilo;
+			break;
+		default:
+			state->REGS[inst->dst] = value;
+			break;
 	}
-    else{
-		switch(opcode){
-			case 0x08: //ADDI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x09: //ADDIU
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0A: //SLTI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //ANDI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0D: //ORI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0E: //XORI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0F: //LUI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //LB
-				NEXT_STATE.REGS[rt] = ((MEM_WB.LMD & 0x000000FF) & 0x80) > 0 ? (MEM_WB.LMD | 0xFFFFFF00) : (MEM_WB.LMD & 0x000000FF);
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //LH
-				NEXT_STATE.REGS[rt] = ((MEM_WB.LMD & 0x0000FFFF) & 0x8000) > 0 ? (MEM_WB.LMD | 0xFFFF0000) : (MEM_WB.LMD & 0x0000FFFF);
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //LW
-				NEXT_STATE.REGS[rt] = MEM_WB.LMD;
-                MEM_WB.RegisterRd = rd;
-                //IF_EX.FLAG = TRUE;
-				print_instruction(CURRENT_STATE.PC);
-				break;
-            case 0x28: //SB
-                printf("WB at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-                MEM_WB.RegisterRd = rd;
-				//for count the instruction
-				print_instruction(CURRENT_STATE.PC);				
-				break;
-			case 0x29: //SH
-                printf("WB at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-                MEM_WB.RegisterRd = rd;
-				//for count the instruction
-				print_instruction(CURRENT_STATE.PC);
+}
+
+/************************************************************/
+/* DIV/DIVU as HI:LO. The result of a divide by zero is                    */
+/* unpredictable; we leave quotient 0, remainder a                               */
+/************************************************************/
+uint64_t div_signed(uint32_t a, uint32_t b)
+{
+	if (b == 0) {
+		return (uint64_t)a << 32;
+	}
+	if (a == 0x80000000 && b == 0xFFFFFFFF) {
+		return 0x80000000;
+	}
+	return ((uint64_t)(uint32_t)((int32_t)a % (int32_t)b) << 32) | (uint32_t)((int32_t)a / (int32_t)b);
+}
+
+uint64_t div_unsigned(uint32_t a, uint32_t b)
+{
+	if (b == 0) {
+		return (uint64_t)a << 32;
+	}
+	return ((uint64_t)(a % b) << 32) | (a / b);
+}
+
+/************************************************************/
+/* Execute step shared by the pipeline EX stage and the functional */
+/* engine, generated from the ISA table's exec column. a and b are  */
+/* the values of inst->srcA and inst->srcB, pc the instruction's     */
+/* address. Returns the GPR result (the effective address for              */
+/* loads/stores, the condition for branches); HI:LO results go to    */
+/* *hilo_out                                                                                                     */ 
+/************************************************************/
+uint32_t alu_execute(const decoded_inst_t *inst, uint32_t pc, uint32_t a, uint32_t b, uint64_t *hilo_out)
+{
+	uint32_t r = 0, sa = inst->sa, imm = inst->imm;
+	uint32_t simm = (uint32_t)(int32_t)(int16_t)imm;
+	uint64_t hilo = 0;
+	
+	switch (inst->op) {
+#define ISA_EXEC(name, code, fmt, srcA, srcB, dst, exec, mem) \
+		case OP_##name: \
+			exec; \
+			break;
+		MIPS_ISA(ISA_EXEC)
+#undef ISA_EXEC
+		default:
+			break;
+	}
+	*hilo_out = hilo;
+	return r;
+}
+
+/************************************************************/
+/* Control step of the ISA table's mem column: the address that        */
+/* follows inst at pc, given its srcA value a and execute result r      */ 
+/************************************************************/
+uint32_t next_pc(const decoded_inst_t *inst, uint32_t pc, uint32_t a, uint32_t r)
+{
+	switch (ISA_INFO[inst->op].mem) {
+		case MEM_BRANCH:
+			return r ? BRANCH_TARGET(pc, inst->imm) : pc + 4;
+		case MEM_JUMP:
+			return JUMP_TARGET(pc, inst->target);
+		case MEM_JUMPR:
+			return a;
+		default:
+			return pc + 4;
+	}
+}
+
+/************************************************************/
+/* Load step of the ISA table's mem column, sign-extended to 32 bits */ 
+/************************************************************/
+uint32_t mem_load(const decoded_inst_t *inst, uint32_t address)
+{
+	switch (ISA_INFO[inst->op].mem) {
+		case MEM_LB:
+			return (uint32_t)(int32_t)(int8_t)mem_read_8(address);
+		case MEM_LH:
+			return (uint32_t)(int32_t)(int16_t)mem_read_16(address);
+		case MEM_LL:
+			return NUM_CORES > 1 ? mc_load_linked(address) : mem_read_32(address);
+		default:
+			return mem_read_32(address);
+	}
+}
+
+/************************************************************/
+/* Store step of the ISA table's mem column; returns what SC leaves in */
+/* rt: TRUE if the store was made. On one core nothing can break the  */
+/* link, so it always is. A misaligned store is not made, SC included  */ 
+/************************************************************/
+uint32_t mem_store(const decoded_inst_t *inst, uint32_t address, uint32_t value)
+{
+	pthread_mutex_t *lock = NULL;
+	int stored = TRUE;
+	
+	if (address & (MEM_BYTES(inst->op) - 1)) {
+		mem_unaligned("write", 8 * MEM_BYTES(inst->op), address);
+		return FALSE;
+	}
+	if (NUM_CORES > 1) {
+		/* the other cores see the write and the links it breaks as one step */
+		lock = mc_lock(address);
+		stored = mc_link_store(address, ISA_INFO[inst->op].mem == MEM_SC);
+	}
+	if (stored) {
+		switch (ISA_INFO[inst->op].mem) {
+			case MEM_SB:
+				mem_write_8(address, value & 0x000000FF);
 				break;
-			case 0x2B: //SW
-                printf("WB at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-                MEM_WB.RegisterRd = rd;
-				//for count the instruction
-				print_instruction(CURRENT_STATE.PC);
+			case MEM_SH:
+				mem_write_16(address, value & 0x0000FFFF);
 				break;
 			default:
-				// put more things here
-				printf("WB at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-                INSTRUCTION_COUNT--;
+				mem_write_32(address, value);
 				break;
 		}
 	}
-    INSTRUCTION_COUNT++;
+	if (lock != NULL) {
+		pthread_mutex_unlock(lock);
+	}
+	return stored;
 }
 
 /************************************************************/
-/* memory access (MEM) pipeline stage:                                                          */ 
+/* Empty a pipeline register                                                                                  */ 
 /************************************************************/
-void MEM()
+void pipeline_bubble(CPU_Pipeline_Reg *latch)
 {
-	/*IMPLEMENT THIS*/
-            if (MEM_WB.FLAG == FALSE){
-                if (MEM_WB.RegWrite == 1 && (MEM_WB.RegisterRd != 0) && (MEM_WB.RegisterRd == ID_IF.RegisterRs)){
-            if(ENABLE_FORWARDING == 0){
-                //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRs:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRs);
-                IF_EX.FLAG = FALSE;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag3\n");
-                MEM_WB.IR = 0x00000001;
-            }
-            else{
-                if ((EX_MEM.RegWrite == 1 && (EX_MEM.RegisterRd == ID_IF.RegisterRs)) != 1){
-                    //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRs:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRs);
-                    //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRs:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRs);
-                ForwardA = 01;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag7\n");
-                }
-            }
-    }
-        if (MEM_WB.RegWrite == 1 && (MEM_WB.RegisterRd != 0) && (MEM_WB.RegisterRd == ID_IF.RegisterRt)){
-            if(ENABLE_FORWARDING == 0){
-                //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRt:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRt);
-                IF_EX.FLAG = FALSE;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag4\n");
-                MEM_WB.IR = 0x00000001;
-            }
-            else{
-                if ((EX_MEM.RegWrite == 1 && (EX_MEM.RegisterRd == ID_IF.RegisterRt)) != 1){
-                    //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRt:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRt);
-                    //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRt:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRt);
-                ForwardB = 01;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag8\n");
-                }
-            }
-    }
-                MEM_WB.FLAG = TRUE;
-                MEM_WB.RegisterRd = 0;
-    }
-    else{
-            if (MEM_WB.RegWrite == 1 && (MEM_WB.RegisterRd != 0) && (MEM_WB.RegisterRd == IF_EX.RegisterRs)){
-            if(ENABLE_FORWARDING == 0){
-                //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRs:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRs);
-                IF_EX.FLAG = FALSE;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag3\n");
-                MEM_WB.IR = 0x00000001;
-            }
-            else{
-                if ((EX_MEM.RegWrite == 1 && (EX_MEM.RegisterRd == IF_EX.RegisterRs)) != 1){
-                    //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRs:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRs);
-                    //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRs:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRs);
-                ForwardA = 01;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag7\n");
-                }
-            }
-    }
-        if (MEM_WB.RegWrite == 1 && (MEM_WB.RegisterRd != 0) && (MEM_WB.RegisterRd == IF_EX.RegisterRt)){
-            if(ENABLE_FORWARDING == 0){
-                //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRt:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRt);
-                IF_EX.FLAG = FALSE;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag4\n");
-                MEM_WB.IR = 0x00000001;
-            }
-            else{
-                if ((EX_MEM.RegWrite == 1 && (EX_MEM.RegisterRd == IF_EX.RegisterRt)) != 1){
-                    //printf("MEM_WB.RegWrite: %d MEM_WB.RegisterRd: %d IF_EX.RegisterRt:%d\n", MEM_WB.RegWrite, MEM_WB.RegisterRd, IF_EX.RegisterRt);
-                    //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRt:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRt);
-                ForwardB = 01;
-                //MEM_WB.RegisterRd = 0;
-                //printf("flag8\n");
-                }
-            }
-    }
-        MEM_WB.RegisterRd = 0;
-    }
-    
-    MEM_WB.IR = EX_MEM.IR;
-    
-    uint32_t opcode, function, data, rt, rd;
-    
-    opcode = (MEM_WB.IR & 0xFC000000) >> 26;
-	function = MEM_WB.IR & 0x0000003F;
-    rt = (IF_EX.IR & 0x001F0000) >> 16;
-	rd = (IF_EX.IR & 0x0000F800) >> 11;
-    
-    if(opcode == 0x00 && MEM_WB.IR != 0){
-		switch(function){
-			case 0x00: //SLL
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-               // print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x02: //SRL
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x03: //SRA 
-                MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //SYSCALL
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-               //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x10: //MFHI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x11: //MTHI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x12: //MFLO
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x13: //MTLO
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x18: //MULT
-                MEM_WB.AA = EX_MEM.AA;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x19: //MULTU
-                MEM_WB.AA = EX_MEM.AA;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1A: //DIV 
-                MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                MEM_WB.A = EX_MEM.A;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1B: //DIVU
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                MEM_WB.A = EX_MEM.A;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //ADD
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //ADDU 
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x22: //SUB
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //SUBU
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x24: //AND
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x25: //OR
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x26: //XOR
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x27: //NOR
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x2A: //SLT
-                MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rd;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			default:
-				printf("MEM at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-				break;
+	memset(latch, 0, sizeof(*latch));
+	latch->inst = &BUBBLE_INST;
+}
+
+/************************************************************/
+/* Lowest PC in a latch and its lanes: the oldest instruction of the  */
+/* group, as a group never spans a taken branch. Only context          */
+/* ACTIVE_THREAD counts. FALSE if it has nothing there                      */
+/************************************************************/
+int group_oldest(const CPU_Pipeline_Reg *latch, const CPU_Pipeline_Reg *lanes, uint32_t *pc)
+{
+	const CPU_Pipeline_Reg *lane;
+	int i, found = FALSE;
+	
+	for (i = 0; i < ISSUE_MAX; i++) {
+		lane = i == 0 ? latch : &lanes[i - 1];
+		if (lane->inst != NULL && lane->inst->op != OP_BUBBLE && lane->thread == ACTIVE_THREAD &&
+			(!found || lane->PC < *pc)) {
+			*pc = lane->PC;
+			found = TRUE;
 		}
 	}
-    else{
-		switch(opcode){
-			case 0x08: //ADDI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x09: //ADDIU
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0A: //SLTI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //ANDI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0D: //ORI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0E: //XORI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0F: //LUI
-				MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //LB
-				MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //LH
-				MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //LW
-				MEM_WB.LMD = mem_read_32(EX_MEM.ALUOutput);
-                //MEM_WB.RegisterRd = rt;
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x28: //SB
-				data = mem_read_32( EX_MEM.ALUOutput);
-				data = (data & 0xFFFFFF00) | (EX_MEM.B & 0x000000FF);
-				mem_write_32(EX_MEM.ALUOutput, data);
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //MEM_WB.RegisterRd = 0;
-				//print_instruction(CURRENT_STATE.PC);				
-				break;
-			case 0x29: //SH
-				data = mem_read_32( EX_MEM.ALUOutput);
-				data = (data & 0xFFFF0000) | (EX_MEM.B & 0x0000FFFF);
-				mem_write_32(EX_MEM.ALUOutput, data);
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //MEM_WB.RegisterRd = 0;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x2B: //SW
-				mem_write_32(EX_MEM.ALUOutput, EX_MEM.B);
-                MEM_WB.RegWrite = EX_MEM.RegWrite;
-                //MEM_WB.RegisterRd = 0;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			default:
-				// put more things here
-				printf("MEM at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-				break;
-        }
-    }
+	return found;
 }
 
 /************************************************************/
-/* execution (EX) pipeline stage:                                                                          */ 
+/* Empty lanes 1 .. ISSUE_WIDTH - 1 of a pipeline register                */
 /************************************************************/
-void EX()
-{
-	/*IMPLEMENT THIS*/
-    while(1){
-    if (EX_MEM.RegWrite == 1 && (EX_MEM.RegisterRd != 0) && (EX_MEM.RegisterRd == IF_EX.RegisterRs)){
-            if(ENABLE_FORWARDING == 0){
-                //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRs:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRs);
-                IF_EX.FLAG = FALSE;
-                EX_MEM.FLAG = FALSE;
-                //printf("flag\n");
-                EX_MEM.IR = 0x00000001;
-                //EX_MEM.RegisterRd = 0;
-                //printf("%u\n", EX_MEM.IR);
-                //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRs:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRs);
-            }
-            else{
-                //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRs:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRs);
-                ForwardA = 10;
-                EX_MEM.FLAG = FALSE;
-                MEM_WB.FLAG = FALSE;
-                //EX_MEM.RegisterRd = 0;
-                //printf("flag5\n");
-                INSTRUCTION_COUNT--;
-                EX_MEM.forward = 1;
-            }
-    }
-    //else{
-        //printf("nothing\n");
-    //}
-    if (EX_MEM.RegWrite == 1 && (EX_MEM.RegisterRd != 0) && (EX_MEM.RegisterRd == IF_EX.RegisterRt)){
-            if(ENABLE_FORWARDING == 0){
-                //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRt:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRt);
-                IF_EX.FLAG = FALSE;
-                EX_MEM.FLAG = FALSE;
-                //printf("flag2\n");
-                EX_MEM.IR = 0x00000001;
-                //EX_MEM.RegisterRd = 0;
-                //printf("%u\n", EX_MEM.IR);
-            }
-            else{
-                //printf("EX_MEM.RegWrite: %d EX_MEM.RegisterRd: %d IF_EX.RegisterRt:%d\n", EX_MEM.RegWrite, EX_MEM.RegisterRd, IF_EX.RegisterRt);
-                ForwardB = 10;
-                EX_MEM.FLAG = FALSE;
-                MEM_WB.FLAG = FALSE;
-                //EX_MEM.RegisterRd = 0;
-                //printf("flag6\n");
-                if (EX_MEM.forward == 0){
-                    INSTRUCTION_COUNT--;
-                }
-            }
-    }
-    //else{
-        //printf("nothing2\n");
-    //}
-        EX_MEM.forward = 0;
-        EX_MEM.RegisterRd = 0;
-        break;
-    }
-    
-    if (EX_MEM.FLAG == TRUE){
-    EX_MEM.IR = IF_EX.IR;
-    //printf("EX_MEM.IR: %u\n", EX_MEM.IR);
-    }
-        
-    uint32_t opcode, function, rt, rd;
-    uint64_t p1, p2;
-    
-    opcode = (EX_MEM.IR & 0xFC000000) >> 26;
-	function = EX_MEM.IR & 0x0000003F;
-    rt = (IF_EX.IR & 0x001F0000) >> 16;
-	rd = (IF_EX.IR & 0x0000F800) >> 11;
-    
-    if(EX_MEM.FLAG == TRUE){
-    if(opcode == 0x00 && EX_MEM.IR != 0){
-		switch(function){
-			case 0x00: //SLL
-				EX_MEM.ALUOutput = IF_EX.A << IF_EX.imm;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x02: //SRL
-				EX_MEM.ALUOutput = IF_EX.A >> IF_EX.imm;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x03: //SRA 
-                if ((IF_EX.A & 0x80000000) == 1){
-                    EX_MEM.ALUOutput = ~(~IF_EX.A >> IF_EX.imm);
-                }
-                else{
-                    EX_MEM.ALUOutput = IF_EX.A >> IF_EX.imm;
-                }
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //SYSCALL
-				EX_MEM.ALUOutput = IF_EX.A;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x10: //MFHI
-				EX_MEM.ALUOutput = IF_EX.A;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x11: //MTHI
-				EX_MEM.ALUOutput = IF_EX.A;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x12: //MFLO
-				EX_MEM.ALUOutput = IF_EX.A;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x13: //MTLO
-				EX_MEM.ALUOutput = IF_EX.A;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x18: //MULT
-                if ((IF_EX.A & 0x80000000) == 0x80000000){
-					p1 = 0xFFFFFFFF00000000 | IF_EX.A;
-				}else{
-					p1 = 0x00000000FFFFFFFF & IF_EX.A;
-				}
-				if ((IF_EX.B & 0x80000000) == 0x80000000){
-					p2 = 0xFFFFFFFF00000000 | IF_EX.B;
-				}else{
-					p2 = 0x00000000FFFFFFFF & IF_EX.B;
-				}
-				EX_MEM.AA = p1 * p2;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x19: //MULTU
-                EX_MEM.AA = IF_EX.A * IF_EX.B;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1A: //DIV 
-                if (IF_EX.B != 0){
-                    EX_MEM.ALUOutput = IF_EX.A / IF_EX.B;
-                    EX_MEM.A = IF_EX.A % IF_EX.B;
-                }
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1B: //DIVU
-				if (IF_EX.B != 0){
-                    EX_MEM.ALUOutput = IF_EX.A / IF_EX.B;
-                    EX_MEM.A = IF_EX.A % IF_EX.B;
-                }
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //ADD
-				EX_MEM.ALUOutput = IF_EX.A + IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //ADDU 
-				EX_MEM.ALUOutput = IF_EX.A + IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x22: //SUB
-				EX_MEM.ALUOutput = IF_EX.A - IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //SUBU
-				EX_MEM.ALUOutput = IF_EX.A - IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x24: //AND
-				EX_MEM.ALUOutput = IF_EX.A & IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x25: //OR
-				EX_MEM.ALUOutput = IF_EX.A | IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x26: //XOR
-				EX_MEM.ALUOutput = IF_EX.A ^ IF_EX.B;
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x27: //NOR
-				EX_MEM.ALUOutput = ~(IF_EX.A | IF_EX.B);
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x2A: //SLT
-                if(IF_EX.A < IF_EX.B){
-					EX_MEM.ALUOutput = 0x1;
-				}
-				else{
-					EX_MEM.ALUOutput = 0x0;
-				}
-                EX_MEM.RegisterRd = rd;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			default:
-				printf("EX at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-				break;
+void lanes_bubble(CPU_Pipeline_Reg *lanes)
+{
+	uint32_t i;
+	
+	for (i = 0; i + 1 < ISSUE_WIDTH; i++) {
+		pipeline_bubble(&lanes[i]);
+	}
+}
+
+/************************************************************/
+/* Empty every lane of a group in a split stage                                */
+/************************************************************/
+void group_bubble(pipeline_group_t *group)
+{
+	uint32_t i;
+	
+	for (i = 0; i < ISSUE_MAX; i++) {
+		pipeline_bubble(&group->lane[i]);
+	}
+}
+
+/************************************************************/
+/* One cycle of a stage split over depth cycles: the group stage 1    */
+/* just put in latch and its lanes moves in behind the others, and   */
+/* the one finishing the last stage takes its place in latch             */
+/************************************************************/
+void stages_advance(pipeline_group_t *stages, uint32_t depth, CPU_Pipeline_Reg *latch, CPU_Pipeline_Reg *lanes)
+{
+	pipeline_group_t entering;
+	
+	if (depth <= 1) {
+		return;
+	}
+	entering.lane[0] = *latch;
+	memcpy(&entering.lane[1], lanes, (ISSUE_MAX - 1) * sizeof(CPU_Pipeline_Reg));
+	*latch = stages[depth - 2].lane[0];
+	memcpy(lanes, &stages[depth - 2].lane[1], (ISSUE_MAX - 1) * sizeof(CPU_Pipeline_Reg));
+	memmove(&stages[1], &stages[0], (depth - 2) * sizeof(pipeline_group_t));
+	stages[0] = entering;
+}
+
+/************************************************************/
+/* Oldest instruction in the groups of a split stage, last stage      */
+/* first, as group_oldest(). FALSE if they are all empty                    */
+/************************************************************/
+int stages_oldest(const pipeline_group_t *stages, uint32_t depth, uint32_t *pc)
+{
+	uint32_t k;
+	
+	for (k = depth; k > 1; k--) {
+		if (group_oldest(&stages[k - 2].lane[0], &stages[k - 2].lane[1], pc)) {
+			return TRUE;
 		}
 	}
-    else{
-		switch(opcode){
-			case 0x08: //ADDI
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x09: //ADDIU
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
+	return FALSE;
+}
+
+/************************************************************/
+/* Is the MULT/DIV that queued result seq still in EX or MEM? Then   */
+/* it runs again after a flush and the result is not architectural yet */
+/************************************************************/
+int md_in_flight(uint32_t seq)
+{
+	const CPU_Pipeline_Reg *latch;
+	uint32_t k;
+	
+	for (k = 0; k < EX_DEPTH + MEM_DEPTH; k++) {
+		if (k < EX_DEPTH) {
+			latch = k + 1 < EX_DEPTH ? &EX_STAGES[k].lane[0] : &EX_MEM;
+		}
+		else {
+			latch = k + 1 < EX_DEPTH + MEM_DEPTH ? &MEM_STAGES[k - EX_DEPTH].lane[0] : &MEM_WB;
+		}
+		if (latch->inst != NULL && latch->deferred && !latch->MemRead && latch->md_seq == seq) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Drop everything in flight; PC goes back to the oldest instruction */
+/* that has not written back yet so nothing is lost                                  */ 
+/************************************************************/
+void pipeline_flush()
+{
+	const CPU_Pipeline_Reg *latch;
+	uint32_t reg, *pc;
+	
+	dram_detach(NULL);	/* whatever is queued finishes for nobody */
+	/* loads that wrote back get their values now; one still in MEM runs again */
+	for (reg = 0; reg < MEM_DEPTH; reg++) {
+		latch = reg + 1 < MEM_DEPTH ? &MEM_STAGES[reg].lane[0] : &MEM_WB;
+		if (latch->inst != NULL && latch->deferred && latch->MemRead) {
+			LOADS_PENDING &= ~(1u << latch->RegisterRd);
+		}
+	}
+	for (reg = 1; reg < MIPS_REGS; reg++) {
+		if (LOADS_PENDING & (1u << reg)) {
+			CURRENT_STATE.REGS[reg] = PENDING_VALUE[reg];
+		}
+	}
+	LOADS_PENDING = 0;
+	memset(MSHRS, 0, sizeof(MSHRS));
+	/* likewise for the multiply/divide unit */
+	md_retire(&CURRENT_STATE);
+	SB_HEAD = SB_COUNT = 0;	/* buffered stores are in memory already */
+	SB_DRAINING = FALSE;
+	/* after a SYSCALL exit WB has left the PC past it, which is still in MEM_WB */
+	for (reg = 0; RUN_FLAG && reg < NUM_THREADS; reg++) {
+		if (NUM_THREADS > 1 && !(THREAD_RUNNING & (1u << reg))) {
+			continue;
+		}
+		ACTIVE_THREAD = reg;
+		pc = reg == 0 ? &CURRENT_STATE.PC : &THREAD_STATE[reg].PC;
+		if (!group_oldest(&MEM_WB, MEM_WB_LANES, pc) &&
+			!stages_oldest(MEM_STAGES, MEM_DEPTH, pc) &&
+			!group_oldest(&EX_MEM, EX_MEM_LANES, pc) &&
+			!stages_oldest(EX_STAGES, EX_DEPTH, pc) &&
+			!group_oldest(&IF_EX, IF_EX_LANES, pc)) {
+			if (THREAD_SLOT(reg)->inst != NULL && THREAD_SLOT(reg)->inst->op != OP_BUBBLE) {
+				*pc = THREAD_SLOT(reg)->PC;
+			}
+			else {
+				stages_oldest(IF_STAGES, IF_DEPTH, pc);
+			}
+		}
+	}
+	ACTIVE_THREAD = 0;
+	pipeline_bubble(&ID_IF);
+	pipeline_bubble(&IF_EX);
+	pipeline_bubble(&EX_MEM);
+	pipeline_bubble(&MEM_WB);
+	for (reg = 0; reg < ISSUE_MAX - 1; reg++) {
+		pipeline_bubble(&ID_IF_LANES[reg]);
+		pipeline_bubble(&IF_EX_LANES[reg]);
+		pipeline_bubble(&EX_MEM_LANES[reg]);
+		pipeline_bubble(&MEM_WB_LANES[reg]);
+	}
+	for (reg = 0; reg < DEPTH_MAX - 1; reg++) {
+		group_bubble(&IF_STAGES[reg]);
+		group_bubble(&EX_STAGES[reg]);
+		group_bubble(&MEM_STAGES[reg]);
+	}
+	for (reg = 0; reg < THREADS_MAX - 1; reg++) {
+		pipeline_bubble(&ID_IF_THREADS[reg]);
+	}
+	WB_LANE_WRITES = 0;
+	WB_INST = &BUBBLE_INST;
+	WB_THREAD = 0;
+	STALL = FALSE;
+	FLUSH = FALSE;
+	REDIRECT = FALSE;
+	FETCH_READY = MEM_READY = 0;
+	FETCH_STARTED = MEM_STARTED = FALSE;
+	MEM_STALL = FALSE;
+	NEXT_STATE = CURRENT_STATE;
+}
+
+/************************************************************/
+/* Switch between the cycle-level pipeline and the functional engine */ 
+/************************************************************/
+void set_sim_mode(int mode)
+{
+	if (mode == SIM_MODE) {
+		return;
+	}
+	if (SIM_MODE == SIM_PIPELINE) {
+		pipeline_flush();
+	}
+	NEXT_STATE = CURRENT_STATE;
+	SIM_MODE = mode;
+	if (mode == SIM_TRANSLATED && DBT_CODE == NULL && !dbt_init()) {
+		SIM_MODE = SIM_FUNCTIONAL;
+	}
+	/* speculative state is dropped on the way out; on the way in, fetch starts at the PC */
+	ooo_flush();
+	printf("%s mode\n", SIM_MODE == SIM_FUNCTIONAL ? "Functional" : SIM_MODE == SIM_TRANSLATED ? "Translated" :
+		   SIM_MODE == SIM_OOO ? "Out-of-order" : "Pipeline");
+}
+
+/************************************************************/
+/* Split IF, EX and MEM over this many cycles each; FALSE if one is   */
+/* out of range                                                                                    */
+/************************************************************/
+int depth_configure(uint32_t if_depth, uint32_t ex_depth, uint32_t mem_depth)
+{
+	if (if_depth < 1 || if_depth > DEPTH_MAX || ex_depth < 1 || ex_depth > DEPTH_MAX ||
+		mem_depth < 1 || mem_depth > DEPTH_MAX) {
+		printf("Error: IF, EX and MEM each take 1 to %d cycles\n", DEPTH_MAX);
+		return FALSE;
+	}
+	if (SIM_MODE == SIM_PIPELINE) {
+		pipeline_flush();	/* nothing in flight in a stage that goes away */
+	}
+	IF_DEPTH = if_depth;
+	EX_DEPTH = ex_depth;
+	MEM_DEPTH = mem_depth;
+	return TRUE;
+}
+
+/************************************************************/
+/* Is an exit SYSCALL of this context, or a load or store of any     */
+/* context that faults, further down MEM? A store behind it must not */
+/* reach memory                                                                                         */
+/************************************************************/
+int exit_ahead(uint32_t thread)
+{
+	const CPU_Pipeline_Reg *latch;
+	uint32_t k;
+	
+	for (k = 0; k + 1 < MEM_DEPTH; k++) {
+		latch = &MEM_STAGES[k].lane[0];
+		if (latch->fault || (latch->thread == thread && ISA_INFO[latch->inst->op].mem == MEM_SYSCALL && latch->A == 0xa)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Drop what one context has fetched; unless front_only, also what */
+/* it has in EX and MEM. The other contexts keep going                      */
+/************************************************************/
+void thread_squash(uint32_t thread, int front_only)
+{
+	uint32_t k;
+	
+	pipeline_bubble(THREAD_SLOT(thread));
+	for (k = 0; k + 1 < IF_DEPTH; k++) {
+		if (IF_STAGES[k].lane[0].thread == thread) {
+			group_bubble(&IF_STAGES[k]);
+		}
+	}
+	if (FETCH_STARTED && FETCH_THREAD == thread) {
+		dram_detach(&FETCH_READY);
+		FETCH_READY = 0;
+		FETCH_STARTED = FALSE;
+	}
+	if (front_only) {
+		return;
+	}
+	if (IF_EX.thread == thread) {
+		pipeline_bubble(&IF_EX);
+	}
+	if (EX_MEM.thread == thread) {
+		pipeline_bubble(&EX_MEM);
+	}
+	for (k = 0; k < DEPTH_MAX - 1; k++) {
+		if (EX_STAGES[k].lane[0].thread == thread) {
+			group_bubble(&EX_STAGES[k]);
+		}
+		if (MEM_STAGES[k].lane[0].thread == thread) {
+			group_bubble(&MEM_STAGES[k]);
+		}
+	}
+}
+
+/************************************************************/
+/* A context ran its exit SYSCALL: it stops at pc while the others */
+/* go on; the run is over when the last one stops                            */
+/************************************************************/
+void thread_exit(uint32_t thread, uint32_t pc)
+{
+	THREAD_REGS(thread)->PC = pc;
+	THREAD_RUNNING &= ~(1u << thread);
+	THREAD_DONE[thread] = CYCLE_COUNT + 1;
+	thread_squash(thread, FALSE);
+	if (THREAD_RUNNING == 0) {
+		RUN_FLAG = FALSE;
+	}
+}
+
+/************************************************************/
+/* Count each context's instructions: front is fetched but not yet */
+/* issued, flight is everything from IF to WB                                      */
+/************************************************************/
+void thread_census(uint32_t *front, uint32_t *flight)
+{
+	const CPU_Pipeline_Reg *back[2 * DEPTH_MAX + 1];
+	uint32_t t, k, n = 0;
+	
+	for (t = 0; t < NUM_THREADS; t++) {
+		front[t] = THREAD_SLOT(t)->inst->op != OP_BUBBLE;
+	}
+	for (k = 0; k + 1 < IF_DEPTH; k++) {
+		if (IF_STAGES[k].lane[0].inst->op != OP_BUBBLE) {
+			front[IF_STAGES[k].lane[0].thread]++;
+		}
+	}
+	memcpy(flight, front, NUM_THREADS * sizeof(uint32_t));
+	back[n++] = &IF_EX;
+	for (k = 0; k + 1 < EX_DEPTH; k++) {
+		back[n++] = &EX_STAGES[k].lane[0];
+	}
+	back[n++] = &EX_MEM;
+	for (k = 0; k + 1 < MEM_DEPTH; k++) {
+		back[n++] = &MEM_STAGES[k].lane[0];
+	}
+	back[n++] = &MEM_WB;
+	for (k = 0; k < n; k++) {
+		if (back[k]->inst->op != OP_BUBBLE) {
+			flight[back[k]->thread]++;
+		}
+	}
+}
+
+/************************************************************/
+/* Pick the context IF fetches for this cycle, never one in skip;    */
+/* FALSE if none can take another instruction                                  */
+/************************************************************/
+int thread_select(uint32_t skip, uint32_t *thread)
+{
+	uint32_t front[THREADS_MAX], flight[THREADS_MAX];
+	uint32_t i, t;
+	int found = FALSE;
+	
+	thread_census(front, flight);
+	if (FETCH_POLICY == FETCH_SWITCH && (THREAD_RUNNING & (1u << FETCH_THREAD)) &&
+		!(THREAD_STALLED & (1u << FETCH_THREAD))) {
+		/* stay with the current context until it waits in ID */
+		if ((skip & (1u << FETCH_THREAD)) || front[FETCH_THREAD] >= IF_DEPTH) {
+			return FALSE;
+		}
+		*thread = FETCH_THREAD;
+		return TRUE;
+	}
+	for (i = 1; i <= NUM_THREADS; i++) {
+		t = (FETCH_THREAD + i) % NUM_THREADS;
+		if (!(THREAD_RUNNING & (1u << t)) || (skip & (1u << t)) || front[t] >= IF_DEPTH) {
+			continue;
+		}
+		/* ICOUNT favours the context with the fewest instructions in flight */
+		if (!found || flight[t] < flight[*thread]) {
+			*thread = t;
+			found = TRUE;
+		}
+		if (FETCH_POLICY != FETCH_ICOUNT) {
+			break;
+		}
+	}
+	if (found && FETCH_POLICY == FETCH_SWITCH) {
+		THREAD_STALLED &= ~(1u << *thread);
+	}
+	return found;
+}
+
+/************************************************************/
+/* Load a context's program into its own slice of memory; FALSE if  */
+/* the file cannot be read                                                                   */
+/************************************************************/
+int thread_load(uint32_t thread)
+{
+	const char *file = THREAD_PROGRAM[thread][0] != '\0' ? THREAD_PROGRAM[thread] : prog_file;
+	uint32_t address = MEM_TEXT_BEGIN + THREAD_BASE(thread);
+	uint32_t word;
+	FILE *fp;
+	
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		printf("Error: Can't open program file %s for context %u\n", file, thread);
+		return FALSE;
+	}
+	while (fscanf(fp, "%x\n", &word) == 1) {
+		mem_write_32(address, word);
+		address += 4;
+	}
+	fclose(fp);
+	printf("Context %u: %u words of %s at 0x%08x\n", thread,
+		   (address - MEM_TEXT_BEGIN - THREAD_BASE(thread)) / 4, file, MEM_TEXT_BEGIN + THREAD_BASE(thread));
+	return TRUE;
+}
+
+/************************************************************/
+/* Load the programs of the contexts the memory image does not hold  */
+/* yet and take them into the snapshot, so later resets restore them */
+/* with the rest of memory instead of reading them again                    */
+/************************************************************/
+void threads_load()
+{
+	uint32_t t, loaded = 0;
+	
+	for (t = 1; t < NUM_THREADS; t++) {
+		if (!(THREADS_LOADED & (1u << t)) && thread_load(t)) {
+			loaded |= 1u << t;
+		}
+	}
+	if (loaded) {
+		/* memory is the restored image here, so only the new programs join it */
+		mem_snapshot();
+		THREADS_LOADED |= loaded;
+	}
+}
+
+/************************************************************/
+/* Every context starts over at the beginning of its program. One    */
+/* whose program could not be loaded is done from the start              */
+/************************************************************/
+void threads_reset()
+{
+	uint32_t t;
+	
+	memset(THREAD_STATE, 0, sizeof(THREAD_STATE));
+	for (t = 1; t < NUM_THREADS; t++) {
+		THREAD_STATE[t].PC = MEM_TEXT_BEGIN;
+	}
+	THREAD_RUNNING = ((1u << NUM_THREADS) - 1) & (THREADS_LOADED | 1u);
+	THREAD_STALLED = 0;
+	/* round robin and ICOUNT start from context 0 on the first cycle */
+	FETCH_THREAD = FETCH_POLICY == FETCH_SWITCH ? 0 : NUM_THREADS - 1;
+	ISSUE_THREAD = NUM_THREADS - 1;
+	memset(THREAD_RETIRED, 0, sizeof(THREAD_RETIRED));
+	memset(THREAD_WAITS, 0, sizeof(THREAD_WAITS));
+	memset(THREAD_DONE, 0, sizeof(THREAD_DONE));
+	THREAD_FILLED = 0;
+}
+
+/************************************************************/
+/* Run n hardware contexts, fetching by policy; FALSE (and nothing */
+/* changes) if the request is out of range or the core is too wide   */
+/************************************************************/
+int threads_configure(uint32_t n, const char *policy)
+{
+	int kind = FETCH_POLICY;
+	
+	if (n < 1 || n > THREADS_MAX) {
+		printf("Error: 1 to %d hardware contexts\n", THREADS_MAX);
+		return FALSE;
+	}
+	if (policy != NULL) {
+		if (strcmp(policy, "rr") == 0) {
+			kind = FETCH_RR;
+		}
+		else if (strcmp(policy, "icount") == 0) {
+			kind = FETCH_ICOUNT;
+		}
+		else if (strcmp(policy, "switch") == 0) {
+			kind = FETCH_SWITCH;
+		}
+		else {
+			printf("Error: unknown fetch policy %s (rr, icount or switch)\n", policy);
+			return FALSE;
+		}
+	}
+	if (n > 1 && NUM_CORES > 1) {
+		/* every core would load its contexts into the same slices of memory */
+		printf("Error: hardware contexts need a single core\n");
+		return FALSE;
+	}
+	if (n > 1 && (ISSUE_WIDTH > 1 || NUM_MSHRS > 0 || MD_MULT_LATENCY > 1 || MD_DIV_LATENCY > 1)) {
+		printf("Error: hardware contexts need width 1, no MSHRs and single-cycle multiply/divide\n");
+		return FALSE;
+	}
+	NUM_THREADS = n;
+	FETCH_POLICY = kind;
+	reset();
+	return TRUE;
+}
+
+/************************************************************/
+/* Per-context and aggregate throughput for print_stats                   */
+/************************************************************/
+void threads_report()
+{
+	static const char *policies[] = {"round robin", "ICOUNT", "switch on stall"};
+	uint64_t cycles;
+	uint32_t t;
+	
+	printf("hardware contexts\t: %u, %s fetch\n", NUM_THREADS, policies[FETCH_POLICY]);
+	for (t = 0; t < NUM_THREADS; t++) {
+		cycles = (THREAD_RUNNING & (1u << t)) ? CYCLE_COUNT : THREAD_DONE[t];
+		printf("  context %u\t\t: %llu instructions, IPC %.3f, %llu cycles waiting in ID", t,
+			   (unsigned long long)THREAD_RETIRED[t], cycles ? (double)THREAD_RETIRED[t] / cycles : 0.0,
+			   (unsigned long long)THREAD_WAITS[t]);
+		if (!(THREAD_RUNNING & (1u << t))) {
+			printf(", done at cycle %llu", (unsigned long long)THREAD_DONE[t]);
+		}
+		printf("\n");
+	}
+	printf("  aggregate IPC\t\t: %.3f\n", CYCLE_COUNT ? (double)INSTRUCTION_COUNT / CYCLE_COUNT : 0.0);
+	printf("  waits covered\t\t: %llu cycles one context waited and another issued\n",
+		   (unsigned long long)THREAD_FILLED);
+}
+
+/************************************************************/
+/* Registers of contexts 1 and up; rdump shows context 0                */
+/************************************************************/
+void threads_rdump()
+{
+	uint32_t t;
+	int i;
+	
+	for (t = 1; t < NUM_THREADS; t++) {
+		printf("-------------------------------------\n");
+		printf("Context %u%s\n", t, (THREAD_RUNNING & (1u << t)) ? "" : " (done)");
+		printf("# Instructions Executed\t: %llu\n", (unsigned long long)THREAD_RETIRED[t]);
+		printf("PC\t: 0x%08x\n", THREAD_STATE[t].PC);
+		for (i = 0; i < MIPS_REGS; i++) {
+			printf("[R%d]\t: 0x%08x\n", i, THREAD_STATE[t].REGS[i]);
+		}
+		printf("[HI]\t: 0x%08x\n", THREAD_STATE[t].HI);
+		printf("[LO]\t: 0x%08x\n", THREAD_STATE[t].LO);
+	}
+}
+
+/************************************************************/
+/* maintain the pipeline: run whichever variant matches the           */
+/* current policy, see pipeline_select()                                           */
+/************************************************************/
+void handle_pipeline()
+{
+	/*INSTRUCTION_COUNT is incremented in WB when an instruction retires*/
+	HANDLE_PIPELINE();
+}
+
+/************************************************************/
+/* writeback (WB) pipeline stage:                                                                          */ 
+/************************************************************/
+void WB()
+{
+	const decoded_inst_t *inst = MEM_WB.inst;
+	
+	WB_INST = inst;
+	WB_THREAD = MEM_WB.thread;
+	if (NUM_MSHRS > 0 || LOADS_PENDING) {
+		mshr_tick();
+	}
+	if (ISSUE_WIDTH > 1) {
+		WB_lanes();
+	}
+	if (inst->op == OP_BUBBLE) {
+		return;
+	}
+	if (!IS_IMPLEMENTED(inst->op)) {
+		printf("WB at 0x%x is not implemented!\n", MEM_WB.PC);
+		return;
+	}
+	if (inst == &FETCH_ERROR_INST) {
+		/* raised here rather than in IF, in case a branch took the fetch back */
+		mem_unaligned("fetch", 32, MEM_WB.PC);
+		THREAD_REGS(MEM_WB.thread)->PC = MEM_WB.PC + 4;
+	}
+	else if (MEM_WB.fault) {
+		/* the access reports the error; nothing of it is written or retired */
+		/* and the run stops at it                                                          */
+		if (IS_LOAD(inst->op)) {
+			mem_load(inst, MEM_WB.ALUOutput);
+		}
+		else {
+			mem_store(inst, MEM_WB.ALUOutput, MEM_WB.B);
+		}
+		THREAD_REGS(MEM_WB.thread)->PC = MEM_WB.PC;
+		return;
+	}
+	else if (ISA_INFO[inst->op].mem == MEM_SYSCALL) {
+		if (MEM_WB.A == 0xa && NUM_THREADS > 1) {
+			thread_exit(MEM_WB.thread, MEM_WB.PC + 4);
+		}
+		else if (MEM_WB.A == 0xa) {
+			RUN_FLAG = FALSE;
+			NEXT_STATE.PC = MEM_WB.PC + 4;	/* precise: as if nothing younger was fetched */
+		}
+	}
+	else if (!MEM_WB.deferred) {
+		write_result(THREAD_REGS(MEM_WB.thread), inst, MEM_WB.MemRead ? MEM_WB.LMD : MEM_WB.ALUOutput, MEM_WB.AA);
+	}
+	disassemble(inst, MEM_WB.PC);
+	INSTRUCTION_COUNT++;
+	THREAD_RETIRED[MEM_WB.thread]++;
+}
+
+/************************************************************/
+/* WB for lanes 1 and up. They only hold simple integer ops, older    */
+/* than a SYSCALL in lane 0 (it ends its group), so they go first;     */
+/* those behind a load or store in lane 0 that faults never retire   */
+/************************************************************/
+void WB_lanes()
+{
+	CPU_Pipeline_Reg *latch;
+	uint32_t i;
+	
+	WB_LANE_WRITES = 0;
+	for (i = 0; i + 1 < ISSUE_WIDTH; i++) {
+		latch = &MEM_WB_LANES[i];
+		if (latch->inst->op == OP_BUBBLE || (MEM_WB.fault && latch->PC > MEM_WB.PC)) {
+			continue;
+		}
+		write_result(&NEXT_STATE, latch->inst, latch->ALUOutput, latch->AA);
+		if (latch->RegWrite) {
+			WB_LANE_WRITES |= 1u << latch->RegisterRd;
+		}
+		disassemble(latch->inst, latch->PC);
+		INSTRUCTION_COUNT++;
+	}
+}
+
+/************************************************************/
+/* memory access (MEM) pipeline stage:                                                          */ 
+/************************************************************/
+void MEM()
+{
+	uint32_t reg;
+	int buffered, trigger = CACHE_MISS;
+	
+	if (SB_COUNT > 0) {
+		sb_tick();
+	}
+	if (!MEM_STARTED && (IS_LOAD(EX_MEM.inst->op) || IS_STORE(EX_MEM.inst->op))) {
+		if (MEM_DEPTH > 1 && IS_STORE(EX_MEM.inst->op) && exit_ahead(EX_MEM.thread)) {
+			/* the program may be about to end or fault; a store after it must not land */
+			MEM_STALL = TRUE;
+			pipeline_bubble(&MEM_WB);
+			lanes_bubble(MEM_WB_LANES);
+			stages_advance(MEM_STAGES, MEM_DEPTH, &MEM_WB, MEM_WB_LANES);
+			return;
+		}
+		if (PF_KIND != PF_NONE) {
+			trigger = cache_probe(&DCACHE, EX_MEM.ALUOutput);
+		}
+		buffered = SB_DEPTH > 0 ? sb_access(EX_MEM.inst, EX_MEM.ALUOutput) : SB_MISS;
+		if (buffered == SB_WAIT) {
+			MEM_STALL = TRUE;
+			pipeline_bubble(&MEM_WB);
+			lanes_bubble(MEM_WB_LANES);
+			if (MEM_DEPTH > 1) {
+				stages_advance(MEM_STAGES, MEM_DEPTH, &MEM_WB, MEM_WB_LANES);
+			}
+			return;
+		}
+		MEM_MSHR = -1;
+		if (buffered == SB_DONE) {
+			/* nothing for the D-cache to do now */
+		}
+		else if (NUM_MSHRS > 0 && IS_LOAD(EX_MEM.inst->op)) {
+			MEM_MSHR = mshr_read(EX_MEM.ALUOutput);
+		}
+		else {
+			cache_access(&DCACHE, EX_MEM.ALUOutput, IS_STORE(EX_MEM.inst->op), &MEM_READY);
+		}
+		if (PF_KIND != PF_NONE) {
+			pf_train(EX_MEM.PC, EX_MEM.ALUOutput, trigger);
+		}
+		MEM_STARTED = TRUE;
+	}
+	MEM_STALL = CYCLE_COUNT < MEM_READY;
+	if (MEM_STALL) {
+		DCACHE.stall_cycles++;
+		pipeline_bubble(&MEM_WB);
+		lanes_bubble(MEM_WB_LANES);
+		if (MEM_DEPTH > 1) {
+			/* what is past the first MEM stage goes on to WB */
+			stages_advance(MEM_STAGES, MEM_DEPTH, &MEM_WB, MEM_WB_LANES);
+		}
+		return;
+	}
+	MEM_STARTED = FALSE;
+	MEM_WB = EX_MEM;
+	if (ISSUE_WIDTH > 1) {
+		memcpy(MEM_WB_LANES, EX_MEM_LANES, (ISSUE_WIDTH - 1) * sizeof(CPU_Pipeline_Reg));
+	}
+	if (IS_MEMORY(MEM_WB.inst->op) && (EX_MEM.ALUOutput & (MEM_BYTES(MEM_WB.inst->op) - 1))) {
+		/* precise: the address error is raised in WB, after everything older */
+		MEM_WB.fault = TRUE;
+	}
+	else if (IS_LOAD(MEM_WB.inst->op)) {
+		MEM_WB.LMD = mem_load(MEM_WB.inst, EX_MEM.ALUOutput);
+		if (MEM_MSHR >= 0 && MEM_WB.RegWrite) {
+			reg = MEM_WB.RegisterRd;
+			LOADS_PENDING |= 1u << reg;
+			PENDING_VALUE[reg] = MEM_WB.LMD;
+			PENDING_MSHR[reg] = MEM_MSHR;
+			MEM_WB.RegWrite = FALSE;	/* nothing to forward until it arrives */
+			MEM_WB.deferred = TRUE;
+		}
+	}
+	else if (IS_STORE(MEM_WB.inst->op)) {
+		MEM_WB.LMD = mem_store(MEM_WB.inst, EX_MEM.ALUOutput, EX_MEM.B);
+	}
+	if (MEM_DEPTH > 1) {
+		stages_advance(MEM_STAGES, MEM_DEPTH, &MEM_WB, MEM_WB_LANES);
+	}
+}
+
+/************************************************************/
+/* Value a producer in a pipeline register has for reg                      */ 
+/************************************************************/
+uint32_t latch_result(const CPU_Pipeline_Reg *latch, uint32_t reg)
+{
+	if (reg == REG_HI) {
+		return latch->AA >> 32;
+	}
+	if (reg == REG_LO) {
+		return (uint32_t)latch->AA;
+	}
+	return latch->MemRead ? latch->LMD : latch->ALUOutput;
+}
+
+/************************************************************/
+/* Does the instruction in latch write reg of context ACTIVE_THREAD?  */
+/************************************************************/
+int writes_reg(const CPU_Pipeline_Reg *latch, uint32_t reg)
+{
+	if (reg == 0 || !latch->RegWrite || latch->thread != ACTIVE_THREAD) {
+		return FALSE;
+	}
+	return latch->RegisterRd == reg ||
+		(latch->RegisterRd == REG_HILO && (reg == REG_HI || reg == REG_LO));
+}
+
+/************************************************************/
+/* Does anything in latch or its lanes write reg?                               */ 
+/************************************************************/
+int group_writes_reg(const CPU_Pipeline_Reg *latch, const CPU_Pipeline_Reg *lanes, uint32_t reg)
+{
+	uint32_t i;
+	
+	if (writes_reg(latch, reg)) {
+		return TRUE;
+	}
+	for (i = 0; i + 1 < ISSUE_WIDTH; i++) {
+		if (writes_reg(&lanes[i], reg)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Does a group in stages 1 .. depth - 1 of a split stage write reg? */
+/* With loads_only, only a load there counts                                    */
+/************************************************************/
+int stages_write_reg(const pipeline_group_t *stages, uint32_t depth, uint32_t reg, int loads_only)
+{
+	uint32_t k;
+	
+	for (k = 0; k + 1 < depth; k++) {
+		if (loads_only ? stages[k].lane[0].MemRead && writes_reg(&stages[k].lane[0], reg) :
+			group_writes_reg(&stages[k].lane[0], &stages[k].lane[1], reg)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Hazards the split EX and MEM stages add for inst in ID. With       */
+/* forwarding, a result is not there until it leaves the last EX stage */
+/* (a load, the last MEM stage); without, until it has written back    */
+/************************************************************/
+int stages_hazard(const decoded_inst_t *inst, int forwarding)
+{
+	return stages_write_reg(EX_STAGES, EX_DEPTH, inst->srcA, FALSE) ||
+		stages_write_reg(EX_STAGES, EX_DEPTH, inst->srcB, FALSE) ||
+		stages_write_reg(MEM_STAGES, MEM_DEPTH, inst->srcA, forwarding) ||
+		stages_write_reg(MEM_STAGES, MEM_DEPTH, inst->srcB, forwarding);
+}
+
+/************************************************************/
+/* Forwarding unit for one EX operand. By the time EX runs, MEM() has */
+/* moved the previous instruction into MEM_WB (the EX/MEM path), and */
+/* WB() has written the one before that into NEXT_STATE (MEM/WB path) */ 
+/************************************************************/
+uint32_t forward_operand(uint32_t reg, uint32_t value, int *forward)
+{
+	uint32_t i, k;
+	
+	*forward = 00;
+	/* a split MEM stage: the groups in its earlier stages are younger */
+	for (k = 0; k + 1 < MEM_DEPTH; k++) {
+		for (i = 0; i < ISSUE_WIDTH; i++) {
+			if (writes_reg(&MEM_STAGES[k].lane[i], reg)) {
+				*forward = 10;
+				return latch_result(&MEM_STAGES[k].lane[i], reg);
+			}
+		}
+	}
+	if (writes_reg(&MEM_WB, reg)) {
+		*forward = 10;
+		return latch_result(&MEM_WB, reg);
+	}
+	if (ISSUE_WIDTH > 1) {
+		/* no two instructions of a group write the same register */
+		for (i = 0; i + 1 < ISSUE_WIDTH; i++) {
+			if (writes_reg(&MEM_WB_LANES[i], reg)) {
+				*forward = 10;
+				return latch_result(&MEM_WB_LANES[i], reg);
+			}
+		}
+		if (reg < MIPS_REGS && (WB_LANE_WRITES & (1u << reg))) {
+			*forward = 01;
+			return read_reg(&NEXT_STATE, reg);
+		}
+	}
+	if (WB_INST->op != OP_BUBBLE && reg != 0 && WB_THREAD == ACTIVE_THREAD &&
+		(WB_INST->dst == reg || (WB_INST->dst == REG_HILO && (reg == REG_HI || reg == REG_LO)))) {
+		*forward = 01;
+		return read_reg(THREAD_REGS(WB_THREAD), reg);
+	}
+	return value;
+}
+
+/* is an outstanding load going to write reg? */
+#define load_pending(reg) ((reg) < MIPS_REGS && (LOADS_PENDING & (1u << (reg))))
+
+/* EX and ID take the policy as a constant so each variant gets its own copy */
+#if defined(__GNUC__)
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#else
+#define FORCE_INLINE static inline
+#endif
+
+/************************************************************/
+/* EX hands the MULT/DIV in latch to the unit, unless its latency is 1 */
+/************************************************************/
+FORCE_INLINE void md_issue(CPU_Pipeline_Reg *latch, const int forwarding)
+{
+	uint32_t latency = md_latency(latch->inst->op);
+	md_result_t *result;
+	
+	if (latency <= 1) {
+		return;
+	}
+	result = &MD_QUEUE[(MD_HEAD + MD_COUNT++) % MD_QUEUE_MAX];
+	result->hilo = latch->AA;
+	result->ready = CYCLE_COUNT + latency - 1;
+	if (result->ready < CYCLE_COUNT + EX_DEPTH + MEM_DEPTH - 1) {
+		result->ready = CYCLE_COUNT + EX_DEPTH + MEM_DEPTH - 1;	/* not under an older HI/LO write still on its way to WB */
+	}
+	if (!forwarding && result->ready < CYCLE_COUNT + EX_DEPTH + MEM_DEPTH) {
+		result->ready = CYCLE_COUNT + EX_DEPTH + MEM_DEPTH;	/* no sooner than its WB would have written HI/LO */
+	}
+	result->seq = ++MD_SEQ;
+	MD_FREE = MD_PIPELINED && latency == MD_MULT_LATENCY && (latch->inst->op == OP_MULT || latch->inst->op == OP_MULTU) ?
+		CYCLE_COUNT + 1 : CYCLE_COUNT + latency;
+	MD_OPS++;
+	latch->RegWrite = FALSE;	/* nothing to forward */
+	latch->deferred = TRUE;
+	latch->md_seq = result->seq;
+}
+
+/************************************************************/
+/* execution (EX) pipeline stage:                                                                          */ 
+/************************************************************/
+FORCE_INLINE void EX(const int forwarding)
+{
+	CPU_Pipeline_Reg *latch;
+	uint32_t i;
+	int forward;
+	
+	EX_MEM = IF_EX;
+	ACTIVE_THREAD = IF_EX.thread;
+	if (forwarding) {
+		EX_MEM.A = forward_operand(IF_EX.RegisterRs, IF_EX.A, &ForwardA);
+		EX_MEM.B = forward_operand(IF_EX.RegisterRt, IF_EX.B, &ForwardB);
+	}
+	EX_MEM.AA = 0;
+	EX_MEM.ALUOutput = alu_execute(EX_MEM.inst, EX_MEM.PC, EX_MEM.A, EX_MEM.B, &EX_MEM.AA);
+	if (EX_MEM.thread > 0 && IS_MEMORY(EX_MEM.inst->op)) {
+		EX_MEM.ALUOutput += THREAD_BASE(EX_MEM.thread);	/* into the context's own memory */
+	}
+	if (EX_MEM.inst->dst == REG_HILO && (MD_MULT_LATENCY > 1 || MD_DIV_LATENCY > 1)) {
+		md_issue(&EX_MEM, forwarding);
+	}
+	if (IS_CONTROL(EX_MEM.inst->op)) {
+		branch_resolve(&EX_MEM);
+	}
+	for (i = 0; i + 1 < ISSUE_WIDTH; i++) {
+		latch = &EX_MEM_LANES[i];
+		*latch = IF_EX_LANES[i];
+		if (latch->inst->op == OP_BUBBLE) {
+			continue;
+		}
+		if (forwarding) {
+			latch->A = forward_operand(latch->RegisterRs, latch->A, &forward);
+			latch->B = forward_operand(latch->RegisterRt, latch->B, &forward);
+		}
+		latch->AA = 0;
+		latch->ALUOutput = alu_execute(latch->inst, latch->PC, latch->A, latch->B, &latch->AA);
+	}
+	if (EX_DEPTH > 1) {
+		stages_advance(EX_STAGES, EX_DEPTH, &EX_MEM, EX_MEM_LANES);
+	}
+}
+
+/************************************************************/
+/* EX is held by MEM this cycle. What WB just wrote will be off the   */
+/* MEM/WB path by the time EX runs, so IF_EX takes it now                  */
+/************************************************************/
+void EX_hold()
+{
+	CPU_Pipeline_Reg *latch;
+	uint32_t i;
+	int forward;
+	
+	for (i = 0; i < ISSUE_WIDTH; i++) {
+		latch = LANE(IF_EX, i);
+		ACTIVE_THREAD = latch->thread;
+		latch->A = forward_operand(latch->RegisterRs, latch->A, &forward);
+		latch->B = forward_operand(latch->RegisterRt, latch->B, &forward);
+	}
+}
+
+/************************************************************/
+/* Can inst go down a lane other than 0? Simple integer ops only: no */
+/* memory, control, HI/LO or SYSCALL                                                        */
+/************************************************************/
+int issue_lane(const decoded_inst_t *inst)
+{
+	return inst != &FETCH_ERROR_INST && IS_IMPLEMENTED(inst->op) && ISA_INFO[inst->op].mem == MEM_NONE &&
+		inst->srcA < REG_HI && inst->srcB < REG_HI && inst->dst < REG_HI;
+}
+
+/************************************************************/
+/* Hazard detection for an instruction in ID: ID_GO, or why it waits. */
+/* EX_MEM and MEM_WB now hold the two groups ahead of it                 */
+/************************************************************/
+FORCE_INLINE int id_wait(const decoded_inst_t *inst, const int forwarding)
+{
+	if (forwarding) {
+		/* only a load right ahead of us cannot be forwarded in time */
+		if (EX_MEM.MemRead && (writes_reg(&EX_MEM, inst->srcA) || writes_reg(&EX_MEM, inst->srcB))) {
+			return ID_WAIT_REG;
+		}
+	}
+	else if (group_writes_reg(&EX_MEM, EX_MEM_LANES, inst->srcA) || group_writes_reg(&EX_MEM, EX_MEM_LANES, inst->srcB) ||
+			 group_writes_reg(&MEM_WB, MEM_WB_LANES, inst->srcA) || group_writes_reg(&MEM_WB, MEM_WB_LANES, inst->srcB)) {
+		return ID_WAIT_REG;
+	}
+	if ((EX_DEPTH > 1 || MEM_DEPTH > 1) && stages_hazard(inst, forwarding)) {
+		return ID_WAIT_REG;
+	}
+	if (LOADS_PENDING &&
+		(load_pending(inst->srcA) || load_pending(inst->srcB) || load_pending(inst->dst) ||
+		 ISA_INFO[inst->op].mem == MEM_SYSCALL)) {
+		/* wait for outstanding loads we read or would overwrite; SYSCALL drains them all */
+		return ID_WAIT_LOAD;
+	}
+	if (MD_COUNT > 0 || MD_MULT_LATENCY > 1 || MD_DIV_LATENCY > 1) {
+		return md_interlock(inst);
+	}
+	return ID_GO;
+}
+
+/************************************************************/
+/* ID sends the instruction in slot down the pipeline through latch */
+/************************************************************/
+FORCE_INLINE void id_issue(const CPU_Pipeline_Reg *slot, CPU_Pipeline_Reg *latch)
+{
+	const decoded_inst_t *inst = slot->inst;
+	branch_stat_t *stat;
+	uint32_t target;
+	
+	latch->PC = slot->PC;
+	latch->inst = inst;
+	latch->thread = slot->thread;
+	/* registers are written in the first half of the cycle, read in the second */
+	latch->A = read_reg(THREAD_REGS(slot->thread), inst->srcA);
+	latch->B = read_reg(THREAD_REGS(slot->thread), inst->srcB);
+	latch->imm = (uint32_t)(int32_t)(int16_t)inst->imm;
+	latch->RegisterRs = inst->srcA;
+	latch->RegisterRt = inst->srcB;
+	latch->RegisterRd = inst->dst;
+	latch->RegWrite = inst->dst != 0;
+	latch->MemRead = IS_LOAD(inst->op) || ISA_INFO[inst->op].mem == MEM_SC;	/* SC's result comes from MEM too */
+	latch->deferred = FALSE;
+	latch->fault = FALSE;
+	latch->predicted = slot->predicted;
+	
+	/* direct branches and jumps: the target is known now, even if the BTB missed it */
+	if (ISA_INFO[inst->op].mem == MEM_BRANCH || ISA_INFO[inst->op].mem == MEM_JUMP) {
+		target = ISA_INFO[inst->op].mem == MEM_JUMP ? JUMP_TARGET(slot->PC, inst->target) :
+			bp_predict(slot->PC) ? BRANCH_TARGET(slot->PC, inst->imm) : slot->PC + 4;
+		if (target != slot->predicted) {
+			stat = branch_stat(slot->PC);
+			stat->redirected++;
+			stat->wasted += BP_REDIRECT_PENALTY;
+			latch->predicted = target;
+			REDIRECT = TRUE;
+			REDIRECT_PC = target;
+			REDIRECT_THREAD = slot->thread;
+		}
+	}
+}
+
+/************************************************************/
+/* ID with several hardware contexts: issue from the first fetch slot, */
+/* round robin after the context that went last, whose instruction     */
+/* has no hazard. The context EX just found mispredicted sits it out    */
+/************************************************************/
+FORCE_INLINE void ID_threads(const int forwarding)
+{
+	CPU_Pipeline_Reg *slot, *issue = NULL;
+	uint32_t i, t;
+	int waited = FALSE;
+	
+	/* look at every context, so the waits of those behind the one issuing count too */
+	for (i = 1; i <= NUM_THREADS; i++) {
+		t = (ISSUE_THREAD + i) % NUM_THREADS;
+		slot = THREAD_SLOT(t);
+		if (slot->inst->op == OP_BUBBLE || (FLUSH && t == FLUSH_THREAD)) {
+			continue;
+		}
+		ACTIVE_THREAD = t;
+		if (id_wait(slot->inst, forwarding) != ID_GO) {
+			THREAD_WAITS[t]++;
+			THREAD_STALLED |= 1u << t;
+			waited = TRUE;
+		}
+		else if (issue == NULL) {
+			issue = slot;
+		}
+	}
+	STALL = issue == NULL;
+	if (STALL) {
+		pipeline_bubble(&IF_EX);
+		return;
+	}
+	ACTIVE_THREAD = issue->thread;
+	id_issue(issue, &IF_EX);
+	pipeline_bubble(issue);
+	ISSUE_THREAD = IF_EX.thread;
+	if (waited) {
+		THREAD_FILLED++;
+	}
+}
+
+/************************************************************/
+/* instruction decode (ID) pipeline stage: issues the longest run of */
+/* ID_IF and the ID_IF_LANES behind it that can go together; see        */
+/* ISSUE_WIDTH                                                                                      */ 
+/************************************************************/
+FORCE_INLINE void ID(const int forwarding)
+{
+	const decoded_inst_t *inst;
+	uint32_t n, i, lane, written = 0, reason = ISSUE_FETCH;
+	int wait, lead = -1;
+	
+	if (NUM_THREADS > 1) {
+		ID_threads(forwarding);
+		return;
+	}
+	if (FLUSH) {
+		/* fetched after a branch EX just found mispredicted */
+		STALL = FALSE;
+		pipeline_bubble(&IF_EX);
+		lanes_bubble(IF_EX_LANES);
+		return;
+	}
+	for (n = 0; n < ISSUE_WIDTH; n++) {
+		inst = LANE(ID_IF, n)->inst;
+		if (n > 0) {
+			if (inst->op == OP_BUBBLE) {
+				reason = ISSUE_FETCH;
+				break;
+			}
+			if (ENDS_GROUP(LANE(ID_IF, n - 1)->inst)) {
+				reason = ISSUE_CONTROL;
+				break;
+			}
+			if ((inst->srcA < MIPS_REGS && (written & (1u << inst->srcA))) ||
+				(inst->srcB < MIPS_REGS && (written & (1u << inst->srcB))) ||
+				(inst->dst < MIPS_REGS && (written & (1u << inst->dst)))) {
+				reason = ISSUE_DEPENDENCE;
+				break;
+			}
+			if (lead >= 0 && !issue_lane(inst)) {
+				reason = IS_MEMORY(inst->op) && IS_MEMORY(LANE(ID_IF, lead)->inst->op) ? ISSUE_MEMORY : ISSUE_COMPLEX;
+				break;
+			}
+		}
+		wait = id_wait(inst, forwarding);
+		if (wait != ID_GO) {
+			if (n == 0) {
+				MSHR_DEP_STALLS += wait == ID_WAIT_LOAD;
+				MD_HILO_STALLS += wait == ID_WAIT_HILO;
+				MD_BUSY_STALLS += wait == ID_WAIT_MD;
+			}
+			reason = ISSUE_HAZARD;
+			break;
+		}
+		if (ISSUE_WIDTH > 1 && !issue_lane(inst)) {
+			lead = n;
+		}
+		if (inst->dst < MIPS_REGS) {
+			written |= (1u << inst->dst) & ~1u;
+		}
+	}
+	if (ISSUE_WIDTH > 1 && ID_IF.inst->op != OP_BUBBLE) {
+		ISSUE_GROUPS[n]++;
+		if (n > 0 && n < ISSUE_WIDTH) {
+			ISSUE_LIMITS[reason]++;
+		}
+	}
+	STALL = n == 0;
+	if (STALL) {
+		pipeline_bubble(&IF_EX);
+		lanes_bubble(IF_EX_LANES);
+		return;
+	}
+	
+	/* the load/store, branch, HI/LO op or SYSCALL, if any, takes lane 0 */
+	if (lead < 0) {
+		lead = 0;
+	}
+	id_issue(LANE(ID_IF, lead), &IF_EX);
+	for (i = 0, lane = 0; i < n; i++) {
+		if ((int)i != lead) {
+			id_issue(LANE(ID_IF, i), &IF_EX_LANES[lane++]);
+		}
+	}
+	while (lane + 1 < ISSUE_WIDTH) {
+		pipeline_bubble(&IF_EX_LANES[lane++]);
+	}
+	/* what is left moves up to the front of the queue */
+	for (i = 0; i < ISSUE_WIDTH; i++) {
+		if (i + n < ISSUE_WIDTH) {
+			*LANE(ID_IF, i) = *LANE(ID_IF, i + n);
+		}
+		else {
+			pipeline_bubble(LANE(ID_IF, i));
+		}
+	}
+}
+
+/************************************************************/
+/* Fetch split over IF_DEPTH stages: the group finishing the last one */
+/* joins the queue in ID_IF if there is room for all of it, and the    */
+/* others move up wherever the stage ahead is free                          */
+/************************************************************/
+void IF_stages()
+{
+	pipeline_group_t *last = &IF_STAGES[IF_DEPTH - 2];
+	CPU_Pipeline_Reg *slot;
+	uint32_t n, m, k;
+	
+	if (NUM_THREADS > 1) {
+		/* one instruction a group, for its context's own slot */
+		slot = THREAD_SLOT(last->lane[0].thread);
+		if (last->lane[0].inst->op != OP_BUBBLE && slot->inst->op == OP_BUBBLE) {
+			*slot = last->lane[0];
+			group_bubble(last);
+		}
+	}
+	else {
+		for (n = 0; n < ISSUE_WIDTH && LANE(ID_IF, n)->inst->op != OP_BUBBLE; n++) {
+			/* still waiting in ID */
+		}
+		for (m = 0; m < ISSUE_WIDTH && last->lane[m].inst->op != OP_BUBBLE; m++) {
+			/* fetched together */
+		}
+		if (m > 0 && n + m <= ISSUE_WIDTH) {
+			for (k = 0; k < m; k++) {
+				*LANE(ID_IF, n + k) = last->lane[k];
+			}
+			group_bubble(last);
+		}
+	}
+	for (k = IF_DEPTH - 2; k > 0; k--) {
+		if (IF_STAGES[k].lane[0].inst->op == OP_BUBBLE) {
+			IF_STAGES[k] = IF_STAGES[k - 1];
+			group_bubble(&IF_STAGES[k - 1]);
+		}
+	}
+}
+
+/************************************************************/
+/* instruction fetch (IF) pipeline stage: fills ID_IF and the           */
+/* ID_IF_LANES behind it (or, split over IF_DEPTH stages, the first   */
+/* of IF_STAGES), up to the first branch or jump and, with an I-cache, */
+/* within one line                                                                                 */ 
+/************************************************************/
+void IF()
+{
+	const decoded_inst_t *inst;
+	CPU_Pipeline_Reg *slot;
+	btb_entry_t *entry;
+	uint32_t n, pc, thread = 0, skip = 0;
+	
+	if (NUM_THREADS > 1 && (FLUSH || REDIRECT)) {
+		/* only the context sent elsewhere loses what it fetched */
+		if (FLUSH) {
+			thread_squash(FLUSH_THREAD, TRUE);
+			THREAD_REGS(FLUSH_THREAD)->PC = FLUSH_PC;
+			skip |= 1u << FLUSH_THREAD;
+		}
+		if (REDIRECT) {
+			thread_squash(REDIRECT_THREAD, TRUE);
+			THREAD_REGS(REDIRECT_THREAD)->PC = REDIRECT_PC;
+			skip |= 1u << REDIRECT_THREAD;
+		}
+		FLUSH = FALSE;
+		REDIRECT = FALSE;
+	}
+	else if (FLUSH || REDIRECT) {
+		/* what we would fetch now is on the wrong path */
+		pipeline_bubble(&ID_IF);
+		lanes_bubble(ID_IF_LANES);
+		for (n = 0; n + 1 < IF_DEPTH; n++) {
+			group_bubble(&IF_STAGES[n]);
+		}
+		NEXT_STATE.PC = FLUSH ? FLUSH_PC : REDIRECT_PC;
+		FLUSH = FALSE;
+		REDIRECT = FALSE;
+		dram_detach(&FETCH_READY);
+		FETCH_READY = 0;
+		FETCH_STARTED = FALSE;
+		return;
+	}
+	if (IF_DEPTH > 1) {
+		IF_stages();
+		if (IF_STAGES[0].lane[0].inst->op != OP_BUBBLE) {
+			/* the stage ahead is still full; hold the PC */
+			return;
+		}
+		n = 0;
+	}
+	else if (NUM_THREADS > 1) {
+		n = 0;
+	}
+	else {
+		for (n = 0; n < ISSUE_WIDTH && LANE(ID_IF, n)->inst->op != OP_BUBBLE; n++) {
+			/* still waiting in ID */
+		}
+		if (n == ISSUE_WIDTH) {
+			/* hold IF/ID and the PC while ID waits */
+			return;
+		}
+	}
+	if (NUM_THREADS > 1) {
+		if (FETCH_STARTED) {
+			thread = FETCH_THREAD;	/* the I-cache is still on its line */
+		}
+		else if (!thread_select(skip, &thread)) {
+			return;
+		}
+		FETCH_THREAD = thread;
+	}
+	pc = THREAD_FETCH_PC(thread);
+	if (!FETCH_STARTED && (pc & 0x3) == 0) {
+		cache_access(&ICACHE, pc + THREAD_BASE(thread), FALSE, &FETCH_READY);
+		FETCH_STARTED = TRUE;
+	}
+	if (CYCLE_COUNT < FETCH_READY) {
+		ICACHE.stall_cycles++;
+		return;
+	}
+	FETCH_STARTED = FALSE;
+	for (; n < ISSUE_WIDTH; n++) {
+		slot = IF_DEPTH > 1 ? &IF_STAGES[0].lane[n] : NUM_THREADS > 1 ? THREAD_SLOT(thread) : LANE(ID_IF, n);
+		inst = (pc & 0x3) ? &FETCH_ERROR_INST : fetch_decoded(pc + THREAD_BASE(thread));
+		slot->inst = inst;
+		slot->thread = thread;
+		slot->PC = pc;
+		slot->predicted = pc + 4;
+		if (BTB_ENTRIES > 0 && IS_CONTROL(inst->op)) {
+			entry = &BTB[(pc >> 2) & (BTB_ENTRIES - 1)];
+			if (entry->pc == pc && (ISA_INFO[inst->op].mem != MEM_BRANCH || bp_predict(pc))) {
+				slot->predicted = entry->target;
+			}
+		}
+		pc = slot->predicted;
+		if (inst == &FETCH_ERROR_INST || IS_CONTROL(inst->op) ||
+			(ICACHE.lines != NULL && (pc >> ICACHE.line_shift) != (slot->PC >> ICACHE.line_shift))) {
+			break;
+		}
+	}
+	THREAD_REGS(thread)->PC = pc;
+}
+
+/************************************************************/
+/* pipeline variants: one handle_pipeline body per entry of        */
+/* PIPELINE_VARIANTS, with the policy folded in at compile time   */
+/************************************************************/
+#define PIPELINE_VARIANT_BODY(name, forwarding) \
+void name() \
+{ \
+	if (DRAM.queued > 0) { \
+		dram_tick(); \
+	} \
+	WB(); \
+	if (RUN_FLAG == FALSE) { \
+		/* SYSCALL exit or address error: nothing younger may touch memory or HI/LO, */ \
+		/* but what the unit still owes retired instructions lands now */ \
+		if (MD_COUNT > 0) { \
+			md_retire(&NEXT_STATE); \
+		} \
+		return; \
+	} \
+	if (MD_COUNT > 0) { \
+		/* after WB, so an older HI/LO write retiring now cannot land on top */ \
+		md_tick(); \
+	} \
+	MEM(); \
+	if (MEM_STALL) { \
+		/* a D-cache miss holds everything behind MEM */ \
+		if (forwarding) { \
+			EX_hold(); \
+		} \
+		return; \
+	} \
+	EX(forwarding); \
+	ID(forwarding); \
+	IF(); \
+}
+PIPELINE_VARIANTS(PIPELINE_VARIANT_BODY)
+#undef PIPELINE_VARIANT_BODY
+
+/************************************************************/
+/* point HANDLE_PIPELINE at the variant matching the current policy */
+/************************************************************/
+void pipeline_select()
+{
+	static const struct {
+		int forwarding;
+		void (*run)();
+	} variants[] = {
+#define PIPELINE_VARIANT_ENTRY(name, forwarding) { forwarding, name },
+		PIPELINE_VARIANTS(PIPELINE_VARIANT_ENTRY)
+#undef PIPELINE_VARIANT_ENTRY
+	};
+	int i;
+	
+	for (i = 0; i < (int)(sizeof(variants) / sizeof(variants[0])); i++) {
+		if (variants[i].forwarding == (ENABLE_FORWARDING != 0)) {
+			HANDLE_PIPELINE = variants[i].run;
+			return;
+		}
+	}
+}
+
+/************************************************************/
+/* Direction predictor: is the conditional branch at pc taken?        */
+/************************************************************/
+int bp_predict(uint32_t pc)
+{
+	switch (BP_KIND) {
+		case BP_BIMODAL:
+			return BP_COUNTERS[(pc >> 2) & ((1 << BP_TABLE_BITS) - 1)] >= 2;
+		case BP_GSHARE:
+			return BP_COUNTERS[((pc >> 2) ^ BP_HISTORY) & ((1 << BP_TABLE_BITS) - 1)] >= 2;
+		default:
+			return FALSE;
+	}
+}
+
+/************************************************************/
+/* Train the direction predictor with a resolved branch                  */
+/************************************************************/
+void bp_update(uint32_t pc, int taken)
+{
+	uint8_t *counter;
+	
+	if (BP_KIND == BP_STATIC) {
+		return;
+	}
+	counter = &BP_COUNTERS[((pc >> 2) ^ (BP_KIND == BP_GSHARE ? BP_HISTORY : 0)) & ((1 << BP_TABLE_BITS) - 1)];
+	if (taken && *counter < 3) {
+		(*counter)++;
+	}
+	else if (!taken && *counter > 0) {
+		(*counter)--;
+	}
+	BP_HISTORY = ((BP_HISTORY << 1) | (taken != 0)) & ((1 << BP_TABLE_BITS) - 1);
+}
+
+/************************************************************/
+/* Forget everything the predictor, the BTB and the per-branch         */
+/* statistics have learned                                                                           */
+/************************************************************/
+void bp_reset()
+{
+	memset(BP_COUNTERS, 1, sizeof(BP_COUNTERS));	/* weakly not taken */
+	BP_HISTORY = 0;
+	if (BTB != NULL) {
+		memset(BTB, 0, BTB_ENTRIES * sizeof(btb_entry_t));
+	}
+	free(BRANCH_STATS);
+	BRANCH_STATS = NULL;
+	BRANCH_STATS_SIZE = 0;
+	BRANCH_STATS_USED = 0;
+}
+
+/************************************************************/
+/* predictor <static|bimodal|gshare> [btb entries]; FALSE if either   */
+/* is not understood                                                                                     */
+/************************************************************/
+int bp_configure(const char *kind, uint32_t btb_entries)
+{
+	btb_entry_t *btb = NULL;
+	
+	if (btb_entries & (btb_entries - 1)) {
+		printf("Error: the BTB size must be a power of two\n");
+		return FALSE;
+	}
+	if (strcmp(kind, "static") == 0) {
+		BP_KIND = BP_STATIC;
+	}
+	else if (strcmp(kind, "bimodal") == 0) {
+		BP_KIND = BP_BIMODAL;
+	}
+	else if (strcmp(kind, "gshare") == 0) {
+		BP_KIND = BP_GSHARE;
+	}
+	else {
+		return FALSE;
+	}
+	if (btb_entries > 0 && (btb = calloc(btb_entries, sizeof(btb_entry_t))) == NULL) {
+		printf("Error: out of memory for the BTB\n");
+		btb_entries = 0;
+	}
+	free(BTB);
+	BTB = btb;
+	BTB_ENTRIES = btb_entries;
+	bp_reset();
+	return TRUE;
+}
+
+/************************************************************/
+/* Statistics slot of the branch or jump at pc, added on first use   */
+/************************************************************/
+branch_stat_t *branch_stat(uint32_t pc)
+{
+	branch_stat_t *old = BRANCH_STATS;
+	uint32_t i, old_size = BRANCH_STATS_SIZE;
+	
+	if (2 * (BRANCH_STATS_USED + 1) > BRANCH_STATS_SIZE) {
+		/* keep it at most half full */
+		BRANCH_STATS_SIZE = old_size ? old_size * 2 : 64;
+		BRANCH_STATS = calloc(BRANCH_STATS_SIZE, sizeof(branch_stat_t));
+		if (BRANCH_STATS == NULL) {
+			printf("Error: out of memory for branch statistics\n");
+			exit(-1);
+		}
+		for (i = 0; i < old_size; i++) {
+			if (old[i].pc != 0) {
+				*branch_stat(old[i].pc) = old[i];
+			}
+		}
+		free(old);
+	}
+	i = ((pc >> 2) * 2654435761u) & (BRANCH_STATS_SIZE - 1);
+	while (BRANCH_STATS[i].pc != 0 && BRANCH_STATS[i].pc != pc) {
+		i = (i + 1) & (BRANCH_STATS_SIZE - 1);
+	}
+	if (BRANCH_STATS[i].pc == 0) {
+		BRANCH_STATS[i].pc = pc;
+		BRANCH_STATS_USED++;
+	}
+	return &BRANCH_STATS[i];
+}
+
+/************************************************************/
+/* EX for a branch or jump: work out where it really goes, train the */
+/* predictor and the BTB, and flush the two younger fetches if the    */
+/* guess carried in latch->predicted was wrong                                  */
+/************************************************************/
+void branch_resolve(CPU_Pipeline_Reg *latch)
+{
+	const decoded_inst_t *inst = latch->inst;
+	uint32_t actual = next_pc(inst, latch->PC, latch->A, latch->ALUOutput);
+	int taken = ISA_INFO[inst->op].mem != MEM_BRANCH || latch->ALUOutput != 0;
+	branch_stat_t *stat = branch_stat(latch->PC);
+	btb_entry_t *entry;
+	
+	stat->op = inst->op;
+	stat->executed++;
+	stat->taken += taken;
+	if (ISA_INFO[inst->op].mem == MEM_BRANCH) {
+		bp_update(latch->PC, taken);
+	}
+	if (taken && BTB_ENTRIES > 0) {
+		entry = &BTB[(latch->PC >> 2) & (BTB_ENTRIES - 1)];
+		entry->pc = latch->PC;
+		entry->target = actual;
+	}
+	if (actual != latch->predicted) {
+		stat->mispredicted++;
+		stat->wasted += BP_MISPREDICT_PENALTY;
+		FLUSH = TRUE;
+		FLUSH_PC = actual;
+		FLUSH_THREAD = latch->thread;
+	}
+}
+
+/************************************************************/
+/* Order branch statistics by address                                                     */
+/************************************************************/
+int branch_stat_compare(const void *a, const void *b)
+{
+	uint32_t pa = ((const branch_stat_t *)a)->pc, pb = ((const branch_stat_t *)b)->pc;
+	
+	return pa < pb ? -1 : pa > pb;
+}
+
+/************************************************************/
+/* Per-branch and total prediction results since the last reset or   */
+/* predictor change (pipeline mode only)                                                */
+/************************************************************/
+void branch_report()
+{
+	static const char *kinds[] = { "static not-taken", "bimodal", "gshare" };
+	branch_stat_t *stats;
+	uint32_t i, n = 0;
+	uint64_t executed = 0, mispredicted = 0, redirected = 0, wasted = 0;
+	
+	stats = malloc((BRANCH_STATS_USED + 1) * sizeof(branch_stat_t));
+	if (stats == NULL) {
+		printf("Error: out of memory\n");
+		return;
+	}
+	for (i = 0; i < BRANCH_STATS_SIZE; i++) {
+		if (BRANCH_STATS[i].pc != 0) {
+			stats[n++] = BRANCH_STATS[i];
+		}
+	}
+	qsort(stats, n, sizeof(branch_stat_t), branch_stat_compare);
+	
+	printf("-------------------------------------\n");
+	printf("Branch prediction: %s, %u-entry BTB\n", kinds[BP_KIND], BTB_ENTRIES);
+	printf("-------------------------------------\n");
+	printf("[PC]\t\t[Op]\t[Executed]\t[Taken]\t[Mispredicted]\t[Redirected]\t[Wasted cycles]\n");
+	for (i = 0; i < n; i++) {
+		printf("0x%08x\t%s\t%u\t\t%u\t%u\t\t%u\t\t%u\n", stats[i].pc, ISA_INFO[stats[i].op].name,
+			   stats[i].executed, stats[i].taken, stats[i].mispredicted, stats[i].redirected, stats[i].wasted);
+		executed += stats[i].executed;
+		mispredicted += stats[i].mispredicted;
+		redirected += stats[i].redirected;
+		wasted += stats[i].wasted;
+	}
+	printf("-------------------------------------\n");
+	printf("branches and jumps\t: %llu\n", (unsigned long long)executed);
+	printf("mispredicted in EX\t: %llu (%.2f%%)\n", (unsigned long long)mispredicted,
+		   executed ? 100.0 * mispredicted / executed : 0.0);
+	printf("redirected in ID\t: %llu\n", (unsigned long long)redirected);
+	printf("wasted cycles\t\t: %llu\n", (unsigned long long)wasted);
+	printf("-------------------------------------\n");
+	free(stats);
+}
+
+/************************************************************/
+/* Empty a cache and zero its statistics                                                 */
+/************************************************************/
+void cache_reset(cache_t *cache)
+{
+	uint32_t i;
+	
+	if (cache->lines != NULL) {
+		for (i = 0; i < cache->sets * cache->assoc; i++) {
+			if (cache->lines[i].ready == DRAM_PENDING) {
+				dram_detach(&cache->lines[i].ready);
+			}
+		}
+		memset(cache->lines, 0, (size_t)cache->sets * cache->assoc * sizeof(cache_line_t));
+	}
+	cache->clock = 0;
+	cache->random = 0x2545F491;
+	cache->reads = cache->writes = cache->read_misses = cache->write_misses = 0;
+	cache->writebacks = cache->stall_cycles = 0;
+}
+
+/************************************************************/
+/* Set a cache's geometry and policies (size 0 turns it off); FALSE, */
+/* leaving it as it was, if the geometry does not work                     */
+/************************************************************/
+int cache_configure(cache_t *cache, uint32_t size, uint32_t assoc, uint32_t line_size, int policy, int write_back, uint32_t miss_latency)
+{
+	cache_line_t *lines = NULL;
+	uint32_t shift = 0;
+	
+	if (size != 0) {
+		if ((size & (size - 1)) || assoc == 0 || (assoc & (assoc - 1)) || line_size < 4 ||
+			(line_size & (line_size - 1)) || size < assoc * line_size) {
+			printf("Error: size, associativity and line size must be powers of two, line size at least 4, and size at least a set\n");
+			return FALSE;
+		}
+		if ((lines = calloc(size / line_size, sizeof(cache_line_t))) == NULL) {
+			printf("Error: out of memory for the %s\n", cache->name);
+			return FALSE;
+		}
+		while ((1u << shift) < line_size) {
+			shift++;
+		}
+	}
+	cache_reset(cache);		/* no prefetch may land in the old lines */
+	free(cache->lines);
+	cache->lines = lines;
+	cache->size = size;
+	cache->assoc = assoc;
+	cache->line_size = line_size;
+	cache->sets = size ? size / line_size / assoc : 0;
+	cache->line_shift = shift;
+	cache->policy = policy;
+	cache->write_back = write_back;
+	cache->miss_latency = miss_latency;
+	cache_reset(cache);
+	return TRUE;
+}
+
+/************************************************************/
+/* A trip from a cache to memory: the cache's flat miss latency on top */
+/* of *ready, or a request to the DRAM model that will set *ready       */
+/************************************************************/
+void cache_memory(cache_t *cache, uint32_t address, uint32_t bytes, int write, uint32_t *ready)
+{
+	if (DRAM.banks == 0) {
+		*ready += cache->miss_latency;
+		return;
+	}
+	dram_request(address, bytes, write, ready);
+}
+
+/************************************************************/
+/* Pick the way of set a fill replaces, writing it back if it is dirty;  */
+/* without DRAM the write-back adds the flat latency to *ready          */
+/************************************************************/
+cache_line_t *cache_victim(cache_t *cache, cache_line_t *set, uint32_t *ready)
+{
+	cache_line_t *victim = &set[0];
+	uint32_t way;
+	
+	for (way = 0; way < cache->assoc; way++) {
+		if (!set[way].valid) {
+			victim = &set[way];
+			break;
+		}
+		if (set[way].stamp < victim->stamp) {
+			victim = &set[way];
+		}
+	}
+	if (way == cache->assoc && cache->policy == CACHE_RANDOM) {
+		cache->random ^= cache->random << 13;
+		cache->random ^= cache->random >> 17;
+		cache->random ^= cache->random << 5;
+		victim = &set[cache->random & (cache->assoc - 1)];
+	}
+	if (victim->ready == DRAM_PENDING) {
+		dram_detach(&victim->ready);	/* an unused prefetch, still on its way */
+	}
+	if (victim->valid && victim->dirty) {
+		cache->writebacks++;
+		if (DRAM.banks > 0) {
+			/* posted: the fill does not wait for it */
+			dram_request(victim->block << cache->line_shift, cache->line_size, TRUE, NULL);
+		}
+		else {
+			*ready += cache->miss_latency;
+		}
+	}
+	return victim;
+}
+
+/************************************************************/
+/* Look address up for a read or a write; sets *ready to the cycle   */
+/* the access completes (this one on a hit, DRAM_PENDING while the */
+/* DRAM controller has not scheduled the miss yet)                             */
+/************************************************************/
+void cache_access(cache_t *cache, uint32_t address, int write, uint32_t *ready)
+{
+	pthread_mutex_t *lock;
+	
+	if (MC_COHERENT(cache) && cache->lines != NULL) {
+		/* no other core snoops this set while the line changes */
+		lock = mc_lock(address);
+		cache_lookup(cache, address, write, ready);
+		pthread_mutex_unlock(lock);
+		return;
+	}
+	cache_lookup(cache, address, write, ready);
+}
+
+/************************************************************/
+/* cache_access proper; with several cores a D-cache miss or a write  */
+/* to an S line goes on the bus first (see mc_snoop)                         */
+/************************************************************/
+void cache_lookup(cache_t *cache, uint32_t address, int write, uint32_t *ready)
+{
+	uint32_t block = address >> cache->line_shift;
+	cache_line_t *set, *line;
+	uint32_t way;
+	
+	*ready = CYCLE_COUNT;
+	if (cache->lines == NULL) {
+		return;
+	}
+	set = &cache->lines[(block & (cache->sets - 1)) * cache->assoc];
+	if (write) {
+		cache->writes++;
+	}
+	else {
+		cache->reads++;
+	}
+	for (way = 0; way < cache->assoc; way++) {
+		line = &set[way];
+		if (line->valid && line->block == block) {
+			if (cache->policy == CACHE_LRU) {
+				line->stamp = ++cache->clock;
+			}
+			if (line->prefetched) {
+				line->prefetched = FALSE;
+				PF_USEFUL++;
+				if (line->ready > CYCLE_COUNT) {
+					/* a late prefetch: wait for what is left of it */
+					PF_LATE++;
+					if (line->ready == DRAM_PENDING) {
+						dram_redirect(&line->ready, ready);
+					}
+					else {
+						*ready = line->ready;
+					}
+					line->ready = 0;
+				}
+			}
+			if (write && !cache->write_back) {
+				cache_memory(cache, address, 4, TRUE, ready);	/* written through */
+				return;
+			}
+			if (write && line->shared) {
+				mc_snoop(block, MC_BUS_UPGR, ready);
+				line->shared = FALSE;
+			}
+			line->dirty |= write;
+			return;
+		}
+	}
+	
+	if (write) {
+		cache->write_misses++;
+		if (!cache->write_back) {
+			cache_memory(cache, address, 4, TRUE, ready);
+			return;
+		}
+	}
+	else {
+		cache->read_misses++;
+	}
+	line = cache_victim(cache, set, ready);
+	line->shared = FALSE;
+	if (MC_COHERENT(cache) && mc_snoop(block, write ? MC_BUS_RDX : MC_BUS_RD, ready)) {
+		/* another D-cache had it and sends it over */
+		MC_CORES[CORE_ID].stats.transfers++;
+		line->shared = !write;
+	}
+	else {
+		cache_memory(cache, block << cache->line_shift, cache->line_size, FALSE, ready);
+	}
+	line->block = block;
+	line->valid = TRUE;
+	line->dirty = write;
+	line->prefetched = FALSE;
+	line->ready = 0;
+	line->stamp = ++cache->clock;
+}
+
+/************************************************************/
+/* Is address's line in the cache (CACHE_MISS, CACHE_HIT), and if so */
+/* was it prefetched and not used yet (CACHE_PREFETCHED)? No side  */
+/* effects                                                                                                        */
+/************************************************************/
+int cache_probe(const cache_t *cache, uint32_t address)
+{
+	uint32_t block = address >> cache->line_shift, way;
+	const cache_line_t *set;
+	
+	if (cache->lines == NULL) {
+		return CACHE_MISS;
+	}
+	set = &cache->lines[(block & (cache->sets - 1)) * cache->assoc];
+	for (way = 0; way < cache->assoc; way++) {
+		if (set[way].valid && set[way].block == block) {
+			return set[way].prefetched ? CACHE_PREFETCHED : CACHE_HIT;
+		}
+	}
+	return CACHE_MISS;
+}
+
+/************************************************************/
+/* The valid line holding block, NULL if it is not in the cache             */
+/************************************************************/
+cache_line_t *cache_find(cache_t *cache, uint32_t block)
+{
+	cache_line_t *set;
+	uint32_t way;
+	
+	if (cache->lines == NULL) {
+		return NULL;
+	}
+	set = &cache->lines[(block & (cache->sets - 1)) * cache->assoc];
+	for (way = 0; way < cache->assoc; way++) {
+		if (set[way].valid && set[way].block == block) {
+			return &set[way];
+		}
+	}
+	return NULL;
+}
+
+/************************************************************/
+/* Bring address's line in ahead of demand unless it is there already; */
+/* nobody waits, the line remembers when its data arrives                */
+/************************************************************/
+void cache_prefetch(cache_t *cache, uint32_t address)
+{
+	cache_line_t *line;
+	uint32_t ready = CYCLE_COUNT;
+	pthread_mutex_t *lock = NULL;
+	
+	if (cache->lines == NULL || cache_probe(cache, address) != CACHE_MISS) {
+		return;
+	}
+	if (MC_COHERENT(cache)) {
+		lock = mc_lock(address);
+	}
+	line = cache_victim(cache, &cache->lines[((address >> cache->line_shift) & (cache->sets - 1)) * cache->assoc], &ready);
+	line->block = address >> cache->line_shift;
+	line->valid = TRUE;
+	line->dirty = FALSE;
+	line->prefetched = TRUE;
+	line->stamp = ++cache->clock;
+	/* a read like any other to the other cores: their copies turn S */
+	line->shared = MC_COHERENT(cache) && mc_snoop(line->block, MC_BUS_RD, &ready);
+	line->ready = ready;
+	cache_memory(cache, line->block << cache->line_shift, cache->line_size, FALSE, &line->ready);
+	PF_ISSUED++;
+	if (lock != NULL) {
+		pthread_mutex_unlock(lock);
+	}
+}
+
+/************************************************************/
+/* One cache's configuration and hit/miss counts                              */
+/************************************************************/
+void cache_report(const cache_t *cache)
+{
+	static const char *policies[] = { "LRU", "FIFO", "random" };
+	uint64_t accesses = cache->reads + cache->writes, misses = cache->read_misses + cache->write_misses;
+	
+	if (cache->lines == NULL) {
+		printf("%s\t\t: off\n", cache->name);
+		return;
+	}
+	printf("%s\t\t: %u bytes, %u-way, %u-byte lines, %s, %s, %u-cycle miss\n", cache->name, cache->size, cache->assoc,
+		   cache->line_size, policies[cache->policy], cache->write_back ? "write-back" : "write-through", cache->miss_latency);
+	printf("  reads / misses\t: %llu / %llu\n", (unsigned long long)cache->reads, (unsigned long long)cache->read_misses);
+	printf("  writes / misses\t: %llu / %llu\n", (unsigned long long)cache->writes, (unsigned long long)cache->write_misses);
+	printf("  hit rate\t\t: %.2f%%\n", accesses ? 100.0 * (accesses - misses) / accesses : 0.0);
+	printf("  writebacks\t\t: %llu\n", (unsigned long long)cache->writebacks);
+	printf("  stall cycles\t\t: %llu\n", (unsigned long long)cache->stall_cycles);
+}
+
+/************************************************************/
+/* cache <i|d> off                                                                                             */
+/* cache <i|d> <size> <assoc> <line> [lru|fifo|random] [wb|wt] [latency] */
+/************************************************************/
+void cache_command()
+{
+	char line[80], which[8], size_text[16], policy[8] = "lru", write[8] = "wb";
+	uint32_t size = 0, assoc = 1, line_size = 4, latency = 10;
+	cache_t *cache;
+	
+	if (fgets(line, sizeof(line), stdin) == NULL || sscanf(line, "%7s %15s", which, size_text) != 2 ||
+		(strcmp(size_text, "off") != 0 &&
+		 sscanf(line, "%7s %u %u %u %7s %7s %u", which, &size, &assoc, &line_size, policy, write, &latency) < 4)) {
+		printf("Invalid Command.\n");
+		return;
+	}
+	cache = (which[0] == 'i' || which[0] == 'I') ? &ICACHE : (which[0] == 'd' || which[0] == 'D') ? &DCACHE : NULL;
+	if (cache == NULL ||
+		(strcmp(policy, "lru") != 0 && strcmp(policy, "fifo") != 0 && strcmp(policy, "random") != 0) ||
+		(strcmp(write, "wb") != 0 && strcmp(write, "wt") != 0)) {
+		printf("Invalid Command.\n");
+		return;
+	}
+	if (cache_configure(cache, size, assoc, line_size,
+						policy[0] == 'l' ? CACHE_LRU : policy[0] == 'f' ? CACHE_FIFO : CACHE_RANDOM,
+						strcmp(write, "wb") == 0, latency)) {
+		cache_report(cache);
+	}
+}
+
+/************************************************************/
+/* Forget outstanding misses and zero the MSHR statistics               */
+/************************************************************/
+void mshr_reset()
+{
+	memset(MSHRS, 0, sizeof(MSHRS));
+	LOADS_PENDING = 0;
+	MSHR_MISSES = MSHR_MERGED = MSHR_FULL = 0;
+	MSHR_HIDDEN = MSHR_DEP_STALLS = MSHR_OUTSTANDING = 0;
+}
+
+/************************************************************/
+/* D-cache read from a load with MSHRs on: returns the MSHR the load */
+/* waits on, or -1 if its data is there now. A miss to a line already   */
+/* on its way joins that MSHR; with every MSHR busy the load blocks  */
+/* MEM (MEM_READY) like a store does                                                */
+/************************************************************/
+int mshr_read(uint32_t address)
+{
+	uint32_t block = address >> DCACHE.line_shift, free = NUM_MSHRS, i;
+	
+	for (i = 0; i < NUM_MSHRS; i++) {
+		if (!MSHRS[i].busy) {
+			if (free == NUM_MSHRS) {
+				free = i;
+			}
+		}
+		else if (MSHRS[i].block == block) {
+			MSHR_MERGED++;
+			return i;
+		}
+	}
+	if (free == NUM_MSHRS) {
+		cache_access(&DCACHE, address, FALSE, &MEM_READY);
+		if (MEM_READY > CYCLE_COUNT) {
+			MSHR_FULL++;
+		}
+		return -1;
+	}
+	cache_access(&DCACHE, address, FALSE, &MSHRS[free].ready);
+	if (MSHRS[free].ready <= CYCLE_COUNT) {
+		return -1;
+	}
+	MSHR_MISSES++;
+	MSHRS[free].block = block;
+	MSHRS[free].issued = CYCLE_COUNT;
+	MSHRS[free].busy = TRUE;
+	return free;
+}
+
+/************************************************************/
+/* Start of a cycle: count busy MSHRs and write the registers of      */
+/* loads whose lines have arrived                                                           */
+/************************************************************/
+void mshr_tick()
+{
+	uint32_t i, reg;
+	
+	for (i = 0; i < NUM_MSHRS; i++) {
+		if (!MSHRS[i].busy) {
+			continue;
+		}
+		if (MSHRS[i].ready > CYCLE_COUNT) {
+			MSHR_OUTSTANDING++;
+		}
+		else {
+			MSHRS[i].busy = FALSE;
+			MSHR_HIDDEN += MSHRS[i].ready - MSHRS[i].issued;
+		}
+	}
+	for (reg = 1; LOADS_PENDING >> reg; reg++) {
+		if ((LOADS_PENDING & (1u << reg)) && MSHRS[PENDING_MSHR[reg]].ready <= CYCLE_COUNT) {
+			NEXT_STATE.REGS[reg] = PENDING_VALUE[reg];
+			LOADS_PENDING &= ~(1u << reg);
+		}
+	}
+}
+
+/************************************************************/
+/* Empty the store buffer and zero its statistics                                 */
+/************************************************************/
+void sb_reset()
+{
+	SB_HEAD = SB_COUNT = 0;
+	SB_DRAINING = FALSE;
+	SB_STORES = SB_COALESCED = SB_FORWARDED = 0;
+	SB_FULL_STALLS = SB_CONFLICT_STALLS = SB_HIDDEN = 0;
+}
+
+/************************************************************/
+/* A load or store reaching MEM with the store buffer on (SB_*). A      */
+/* store joins an entry for the same word that is not draining yet, or */
+/* takes a new one; a load whose bytes are all buffered is forwarded */
+/************************************************************/
+int sb_access(const decoded_inst_t *inst, uint32_t address)
+{
+	int store = IS_STORE(inst->op);
+	uint32_t size = MEM_BYTES(inst->op);
+	uint32_t word = address >> 2, mask = ((1u << size) - 1) << (address & 0x3), covered = 0, i;
+	sb_entry_t *entry;
+	
+	if (address & (size - 1)) {
+		return SB_MISS;		/* MEM raises the address error */
+	}
+	for (i = 0; i < SB_COUNT; i++) {
+		entry = &STORE_BUFFER[(SB_HEAD + i) % SB_DEPTH];
+		if (entry->word != word) {
+			continue;
+		}
+		if (store && (i > 0 || !SB_DRAINING)) {
+			entry->mask |= mask;
+			SB_STORES++;
+			SB_COALESCED++;
+			return SB_DONE;
+		}
+		covered |= entry->mask;
+	}
+	if (!store) {
+		if ((covered & mask) == mask) {
+			SB_FORWARDED++;
+			return SB_DONE;
+		}
+		if (covered & mask) {
+			/* the rest of the word has to come from the cache, after the buffer */
+			SB_CONFLICT_STALLS++;
+			return SB_WAIT;
+		}
+		return SB_MISS;
+	}
+	if (SB_COUNT == SB_DEPTH) {
+		SB_FULL_STALLS++;
+		return SB_WAIT;
+	}
+	entry = &STORE_BUFFER[(SB_HEAD + SB_COUNT) % SB_DEPTH];
+	entry->word = word;
+	entry->mask = mask;
+	SB_COUNT++;
+	SB_STORES++;
+	return SB_DONE;
+}
+
+/************************************************************/
+/* One cycle of draining: the head entry writes to the D-cache, taking */
+/* a cycle plus whatever the cache says a write costs                          */
+/************************************************************/
+void sb_tick()
+{
+	if (!SB_DRAINING) {
+		SB_DRAINING = TRUE;
+		SB_ISSUED = CYCLE_COUNT;
+		cache_access(&DCACHE, STORE_BUFFER[SB_HEAD].word << 2, TRUE, &SB_READY);
+	}
+	if (CYCLE_COUNT >= SB_READY) {
+		SB_HIDDEN += SB_READY - SB_ISSUED;
+		SB_DRAINING = FALSE;
+		SB_HEAD = (SB_HEAD + 1) % SB_DEPTH;
+		SB_COUNT--;
+	}
+}
+
+/************************************************************/
+/* Close every row, empty the request queue and zero the statistics */
+/************************************************************/
+void dram_reset()
+{
+	memset(DRAM.bank, 0, sizeof(DRAM.bank));
+	DRAM.queued = 0;
+	DRAM.reads = DRAM.writes = DRAM.row_hits = DRAM.row_empty = DRAM.row_conflicts = 0;
+	DRAM.bytes = DRAM.latency = 0;
+}
+
+/************************************************************/
+/* Set the DRAM geometry and timing (banks 0 turns it off); FALSE,   */
+/* leaving it as it was, if the geometry does not work. Requests still */
+/* queued complete at once                                                                       */
+/************************************************************/
+int dram_configure(uint32_t banks, uint32_t row_size, uint32_t tCAS, uint32_t tRCD, uint32_t tRP, int policy)
+{
+	uint32_t i;
+	
+	if (banks != 0 && ((banks & (banks - 1)) || banks > DRAM_BANKS_MAX || row_size < 64 ||
+					   (row_size & (row_size - 1)) || tCAS == 0)) {
+		printf("Error: banks must be a power of two up to %d, the row size a power of two of at least 64 bytes, and tCAS at least 1\n",
+			   DRAM_BANKS_MAX);
+		return FALSE;
+	}
+	for (i = 0; i < DRAM.queued; i++) {
+		if (DRAM.queue[i].ready != NULL) {
+			*DRAM.queue[i].ready = CYCLE_COUNT;
+		}
+	}
+	DRAM.banks = banks;
+	DRAM.row_size = row_size;
+	DRAM.tCAS = tCAS;
+	DRAM.tRCD = tRCD;
+	DRAM.tRP = tRP;
+	DRAM.policy = policy;
+	dram_reset();
+	return TRUE;
+}
+
+/************************************************************/
+/* Queue a read or write of bytes at address; *ready, if given, reads */
+/* DRAM_PENDING until the controller schedules it                            */
+/************************************************************/
+void dram_request(uint32_t address, uint32_t bytes, int write, uint32_t *ready)
+{
+	dram_request_t *request;
+	
+	if (DRAM.queued == DRAM_QUEUE_MAX) {
+		/* only posted writes starved by row hits pile up like this: make room */
+		dram_issue(0);
+	}
+	request = &DRAM.queue[DRAM.queued++];
+	request->address = address;
+	request->bytes = bytes;
+	request->arrival = CYCLE_COUNT;
+	request->write = write;
+	request->ready = ready;
+	if (ready != NULL) {
+		*ready = DRAM_PENDING;
+	}
+	dram_tick();
+}
+
+/************************************************************/
+/* Send queued request index to its bank: precharge and activate as     */
+/* the open row requires, then the column access and the burst          */
+/************************************************************/
+void dram_issue(uint32_t index)
+{
+	dram_request_t *request = &DRAM.queue[index];
+	uint32_t row = request->address / DRAM.row_size;
+	dram_bank_t *bank = &DRAM.bank[row & (DRAM.banks - 1)];
+	uint32_t start = bank->busy_until > CYCLE_COUNT ? bank->busy_until : CYCLE_COUNT;
+	uint32_t cycles = DRAM.tCAS + (request->bytes + DRAM_BUS_BYTES - 1) / DRAM_BUS_BYTES;
+	
+	row /= DRAM.banks;
+	if (bank->open && bank->row == row) {
+		DRAM.row_hits++;
+	}
+	else if (!bank->open) {
+		DRAM.row_empty++;
+		cycles += DRAM.tRCD;
+	}
+	else {
+		DRAM.row_conflicts++;
+		cycles += DRAM.tRP + DRAM.tRCD;
+	}
+	bank->open = TRUE;
+	bank->row = row;
+	bank->busy_until = start + cycles;
+	if (request->write) {
+		DRAM.writes++;
+	}
+	else {
+		DRAM.reads++;
+	}
+	DRAM.bytes += request->bytes;
+	DRAM.latency += bank->busy_until - request->arrival;
+	if (request->ready != NULL) {
+		*request->ready = bank->busy_until;
+	}
+	memmove(request, request + 1, (DRAM.queued - index - 1) * sizeof(dram_request_t));
+	DRAM.queued--;
+}
+
+/************************************************************/
+/* Give every idle bank its next request: the oldest (FCFS), or the   */
+/* oldest that hits the open row and else the oldest (FR-FCFS)          */
+/************************************************************/
+void dram_tick()
+{
+	uint32_t bank, row, pick, i;
+	
+	for (bank = 0; bank < DRAM.banks && DRAM.queued > 0; bank++) {
+		if (DRAM.bank[bank].busy_until > CYCLE_COUNT) {
+			continue;
+		}
+		pick = DRAM.queued;
+		for (i = 0; i < DRAM.queued; i++) {
+			row = DRAM.queue[i].address / DRAM.row_size;
+			if ((row & (DRAM.banks - 1)) != bank) {
+				continue;
+			}
+			if (pick == DRAM.queued) {
+				pick = i;
+				if (DRAM.policy == DRAM_FCFS) {
+					break;
+				}
+			}
+			if (DRAM.bank[bank].open && DRAM.bank[bank].row == row / DRAM.banks) {
+				pick = i;
 				break;
-			case 0x0A: //SLTI
-				if ( (  IF_EX.A - (int32_t)( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF))) < 0){
-					EX_MEM.ALUOutput = 0x1;
-				}else{
-					EX_MEM.ALUOutput = 0x0;
+			}
+		}
+		if (pick < DRAM.queued) {
+			dram_issue(pick);
+		}
+	}
+}
+
+/************************************************************/
+/* Forget who waits on queued requests (NULL: on all of them); the  */
+/* requests still take their turn at the banks                                   */
+/************************************************************/
+void dram_detach(const uint32_t *ready)
+{
+	uint32_t i;
+	
+	for (i = 0; i < DRAM.queued; i++) {
+		if (ready == NULL || DRAM.queue[i].ready == ready) {
+			DRAM.queue[i].ready = NULL;
+		}
+	}
+}
+
+/************************************************************/
+/* Hand whoever waits on from over to to (a demand access catching up */
+/* with a prefetch); to keeps the cycle it has if nothing is queued      */
+/************************************************************/
+void dram_redirect(const uint32_t *from, uint32_t *to)
+{
+	uint32_t i;
+	
+	for (i = 0; i < DRAM.queued; i++) {
+		if (DRAM.queue[i].ready == from) {
+			DRAM.queue[i].ready = to;
+			*to = DRAM_PENDING;
+		}
+	}
+}
+
+/************************************************************/
+/* DRAM configuration, row-buffer hit rate and bandwidth                  */
+/************************************************************/
+void dram_report()
+{
+	uint64_t accesses = DRAM.reads + DRAM.writes;
+	
+	printf("DRAM\t\t\t: %u banks, %u-byte rows, tCAS %u tRCD %u tRP %u, %s\n", DRAM.banks, DRAM.row_size,
+		   DRAM.tCAS, DRAM.tRCD, DRAM.tRP, DRAM.policy == DRAM_FRFCFS ? "FR-FCFS" : "FCFS");
+	printf("  reads / writes\t: %llu / %llu\n", (unsigned long long)DRAM.reads, (unsigned long long)DRAM.writes);
+	printf("  row hit / empty / conflict\t: %llu / %llu / %llu\n", (unsigned long long)DRAM.row_hits,
+		   (unsigned long long)DRAM.row_empty, (unsigned long long)DRAM.row_conflicts);
+	printf("  row hit rate\t\t: %.2f%%\n", accesses ? 100.0 * DRAM.row_hits / accesses : 0.0);
+	printf("  avg latency\t\t: %.2f cycles\n", accesses ? (double)DRAM.latency / accesses : 0.0);
+	printf("  bandwidth\t\t: %.3f bytes/cycle (peak %d)\n", CYCLE_COUNT ? (double)DRAM.bytes / CYCLE_COUNT : 0.0,
+		   DRAM_BUS_BYTES);
+}
+
+/************************************************************/
+/* dram off                                                                                                        */
+/* dram <banks> <row bytes> <tCAS> <tRCD> <tRP> [fcfs|frfcfs]          */
+/************************************************************/
+void dram_command()
+{
+	char line[80], policy[8] = "frfcfs";
+	uint32_t banks = 0, row_size = 0, tCAS = 0, tRCD = 0, tRP = 0;
+	int n = 0;
+	
+	if (fgets(line, sizeof(line), stdin) == NULL ||
+		(strstr(line, "off") == NULL &&
+		 (n = sscanf(line, "%u %u %u %u %u %7s", &banks, &row_size, &tCAS, &tRCD, &tRP, policy)) < 5) ||
+		(n > 0 && strcmp(policy, "fcfs") != 0 && strcmp(policy, "frfcfs") != 0)) {
+		printf("Invalid Command.\n");
+		return;
+	}
+	if (dram_configure(banks, row_size, tCAS, tRCD, tRP, strcmp(policy, "fcfs") == 0 ? DRAM_FCFS : DRAM_FRFCFS)) {
+		if (DRAM.banks == 0) {
+			printf("DRAM off: cache misses cost their flat latency\n");
+		}
+		else {
+			dram_report();
+		}
+	}
+}
+
+/************************************************************/
+/* Empty the multiply/divide unit and zero its statistics                  */
+/************************************************************/
+void md_reset()
+{
+	MD_HEAD = MD_COUNT = MD_FREE = 0;
+	MD_OPS = MD_HILO_STALLS = MD_BUSY_STALLS = 0;
+}
+
+/************************************************************/
+/* HI/LO hazards for the instruction in ID, with the unit on: ID_GO   */
+/* or why it has to wait this cycle                                                         */
+/************************************************************/
+int md_interlock(const decoded_inst_t *inst)
+{
+	uint32_t latency;
+	
+	if (inst->dst == REG_HILO && (latency = md_latency(inst->op)) > 1) {
+		/* it can start in EX next cycle if the unit is free then, and */
+		/* it must not finish before what the unit already holds            */
+		if (MD_COUNT == MD_QUEUE_MAX || CYCLE_COUNT + 1 < MD_FREE ||
+			(MD_COUNT > 0 && CYCLE_COUNT + latency < MD_QUEUE[(MD_HEAD + MD_COUNT - 1) % MD_QUEUE_MAX].ready)) {
+			return ID_WAIT_MD;
+		}
+		return ID_GO;
+	}
+	if (MD_COUNT > 0 && (inst->srcA == REG_HI || inst->srcA == REG_LO || inst->srcB == REG_HI ||
+						 inst->srcB == REG_LO || inst->dst == REG_HI || inst->dst == REG_LO || inst->dst == REG_HILO)) {
+		return ID_WAIT_HILO;
+	}
+	return ID_GO;
+}
+
+/************************************************************/
+/* Write HI and LO for the results the unit finishes this cycle         */
+/************************************************************/
+void md_tick()
+{
+	while (MD_COUNT > 0 && MD_QUEUE[MD_HEAD].ready <= CYCLE_COUNT) {
+		NEXT_STATE.HI = MD_QUEUE[MD_HEAD].hilo >> 32;
+		NEXT_STATE.LO = (uint32_t)MD_QUEUE[MD_HEAD].hilo;
+		MD_HEAD = (MD_HEAD + 1) % MD_QUEUE_MAX;
+		MD_COUNT--;
+	}
+}
+
+/************************************************************/
+/* Empty the unit as the pipeline stops or is flushed: the newest     */
+/* result whose MULT/DIV has retired goes to HI/LO in state, those   */
+/* still in EX or MEM are dropped                                                         */
+/************************************************************/
+void md_retire(CPU_State *state)
+{
+	const md_result_t *result;
+	
+	while (MD_COUNT > 0) {
+		result = &MD_QUEUE[(MD_HEAD + MD_COUNT - 1) % MD_QUEUE_MAX];
+		if (!md_in_flight(result->seq)) {
+			state->HI = result->hilo >> 32;
+			state->LO = (uint32_t)result->hilo;
+			break;
+		}
+		MD_COUNT--;
+	}
+	MD_HEAD = MD_COUNT = MD_FREE = 0;
+}
+
+/* entry i places behind the head of the ROB */
+#define rob_index(i) ((OOO_HEAD + (i)) % OOO_ROB_MAX)
+
+/************************************************************/
+/* Reservation station class of an instruction                                   */
+/************************************************************/
+int ooo_rs_class(const decoded_inst_t *inst)
+{
+	if (IS_MEMORY(inst->op)) {
+		return RS_MEM;
+	}
+	return inst->dst == REG_HILO ? RS_MULDIV : RS_ALU;
+}
+
+/************************************************************/
+/* Value the ROB entry produces for reg (a GPR, HI or LO)               */
+/************************************************************/
+uint32_t ooo_value(const rob_entry_t *entry, uint32_t reg)
+{
+	if (reg == REG_HI) {
+		return entry->hilo >> 32;
+	}
+	if (reg == REG_LO) {
+		return (uint32_t)entry->hilo;
+	}
+	return entry->result;
+}
+
+/************************************************************/
+/* Rename: the ROB entry at index is now the latest writer of its    */
+/* destination                                                                                             */
+/************************************************************/
+void ooo_claim(uint32_t index)
+{
+	uint32_t dst = OOO_ROB[index].inst->dst;
+	
+	if (dst == REG_HILO) {
+		OOO_RAT[REG_HI] = OOO_RAT[REG_LO] = index;
+	}
+	else if (dst != 0) {
+		OOO_RAT[dst] = index;
+	}
+}
+
+/************************************************************/
+/* Throw away everything speculative; CURRENT_STATE already holds   */
+/* the committed state and fetch starts again from its PC               */
+/************************************************************/
+void ooo_flush()
+{
+	uint32_t i;
+	
+	ooo_squash(0);
+	for (i = 0; i < RS_CLASSES; i++) {
+		OOO_RS_USED[i] = 0;
+	}
+	OOO_LSQ_USED = 0;
+	dram_detach(&OOO_STORE_READY);
+	OOO_HEAD = 0;
+	OOO_FETCH_PC = CURRENT_STATE.PC;
+	OOO_MD_FREE = 0;
+}
+
+/************************************************************/
+/* Empty the engine and zero its statistics                                         */
+/************************************************************/
+void ooo_reset()
+{
+	ooo_flush();
+	memset(OOO_ROB_HIST, 0, sizeof(OOO_ROB_HIST));
+	memset(OOO_RS_HIST, 0, sizeof(OOO_RS_HIST));
+	memset(OOO_LSQ_HIST, 0, sizeof(OOO_LSQ_HIST));
+	memset(OOO_STALLS, 0, sizeof(OOO_STALLS));
+	OOO_SQUASHED = OOO_FORWARDED = OOO_LOAD_WAITS = 0;
+}
+
+/************************************************************/
+/* ooo <rob> <width> <alu rs> <mem rs> <muldiv rs> <lsq>; FALSE if a */
+/* size is out of range. Whatever was in flight is dropped                    */
+/************************************************************/
+int ooo_configure(uint32_t rob, uint32_t width, uint32_t alu_rs, uint32_t mem_rs, uint32_t md_rs, uint32_t lsq)
+{
+	if (rob == 0 || rob > OOO_ROB_MAX || width == 0 || width > OOO_WIDTH_MAX) {
+		printf("Error: the ROB takes 1 to %d entries and the width is 1 to %d\n", OOO_ROB_MAX, OOO_WIDTH_MAX);
+		return FALSE;
+	}
+	if (alu_rs == 0 || mem_rs == 0 || md_rs == 0 || lsq == 0 || alu_rs > rob || mem_rs > rob || md_rs > rob || lsq > rob) {
+		printf("Error: reservation stations and the load/store queue take 1 to %u entries\n", rob);
+		return FALSE;
+	}
+	ooo_flush();
+	OOO_ROB_SIZE = rob;
+	OOO_WIDTH = width;
+	OOO_RS_SIZE[RS_ALU] = alu_rs;
+	OOO_RS_SIZE[RS_MEM] = mem_rs;
+	OOO_RS_SIZE[RS_MULDIV] = md_rs;
+	OOO_LSQ_SIZE = lsq;
+	return TRUE;
+}
+
+/************************************************************/
+/* Drop the ROB entries after the first keep, rebuild the rename      */
+/* table from the ones left and empty the fetch queue                        */
+/************************************************************/
+void ooo_squash(uint32_t keep)
+{
+	rob_entry_t *entry;
+	uint32_t i;
+	
+	for (i = keep; i < OOO_COUNT; i++) {
+		entry = &OOO_ROB[rob_index(i)];
+		if (entry->state == OOO_WAITING) {
+			OOO_RS_USED[entry->rs]--;
+		}
+		else if (entry->state == OOO_EXECUTING && entry->ready == DRAM_PENDING) {
+			dram_detach(&entry->ready);
+		}
+		if (entry->rs == RS_MEM) {
+			OOO_LSQ_USED--;
+		}
+		OOO_SQUASHED++;
+	}
+	OOO_COUNT = keep;
+	for (i = 0; i <= REG_LO; i++) {
+		OOO_RAT[i] = -1;
+	}
+	for (i = 0; i < OOO_COUNT; i++) {
+		ooo_claim(rob_index(i));
+	}
+	OOO_FETCH_COUNT = 0;
+	dram_detach(&OOO_FETCH_READY);
+	OOO_FETCH_READY = 0;
+	OOO_FETCH_STARTED = FALSE;
+}
+
+/************************************************************/
+/* Commit: retire up to OOO_WIDTH finished instructions from the      */
+/* head of the ROB into CURRENT_STATE, in program order. Stores write */
+/* memory here; SYSCALL and faults take effect here, precisely          */
+/************************************************************/
+void ooo_commit()
+{
+	rob_entry_t *entry;
+	const decoded_inst_t *inst;
+	mem_page_t *page;
+	uint32_t n, reg;
+	
+	for (n = 0; n < OOO_WIDTH && OOO_COUNT > 0; n++) {
+		entry = &OOO_ROB[OOO_HEAD];
+		inst = entry->inst;
+		if (entry->state != OOO_DONE) {
+			break;
+		}
+		if (inst == &FETCH_ERROR_INST) {
+			mem_unaligned("fetch", 32, entry->pc);
+		}
+		else if (ISA_INFO[inst->op].mem == MEM_SYSCALL) {
+			if (entry->src[0] == 0xa) {
+				RUN_FLAG = FALSE;
+			}
+		}
+		else if (IS_MEMORY(inst->op) && entry->fault) {
+			/* the access reports the address error; nothing of it is written */
+			/* or retired, and the guest stops at it                           */
+			if (IS_LOAD(inst->op)) {
+				mem_load(inst, entry->address);
+			}
+			else {
+				mem_store(inst, entry->address, entry->store_value);
+			}
+			CURRENT_STATE.PC = entry->pc;
+			ooo_squash(0);
+			return;
+		}
+		else if (IS_STORE(inst->op)) {
+			mem_store(inst, entry->address, entry->store_value);
+			cache_access(&DCACHE, entry->address, TRUE, &OOO_STORE_READY);
+		}
+		write_result(&CURRENT_STATE, inst, entry->result, entry->hilo);
+		for (reg = 0; reg <= REG_LO; reg++) {
+			if (OOO_RAT[reg] == (int)OOO_HEAD) {
+				OOO_RAT[reg] = -1;
+			}
+		}
+		CURRENT_STATE.PC = IS_CONTROL(inst->op) ? entry->actual : entry->pc + 4;
+		if (IS_IMPLEMENTED(inst->op)) {
+			disassemble(inst, entry->pc);
+			INSTRUCTION_COUNT++;
+		}
+		else {
+			printf("Instruction at 0x%x is not implemented!\n", entry->pc);
+		}
+		if (entry->rs == RS_MEM) {
+			OOO_LSQ_USED--;
+		}
+		OOO_HEAD = (OOO_HEAD + 1) % OOO_ROB_MAX;
+		OOO_COUNT--;
+		if (RUN_FLAG == FALSE) {
+			/* nothing younger happened */
+			ooo_squash(0);
+			return;
+		}
+		page = IS_STORE(inst->op) ? PAGE_TABLE[entry->address >> MEM_PAGE_SHIFT] : NULL;
+		if (page != NULL && page->decoded != NULL) {
+			/* the store may have rewritten code already fetched: fetch it again. */
+			/* A store to an unmapped address was dropped and has no page          */
+			ooo_squash(0);
+			OOO_FETCH_PC = CURRENT_STATE.PC;
+			return;
+		}
+	}
+}
+
+/************************************************************/
+/* Completion: results whose latency is up go on the common data    */
+/* bus to the reservation stations waiting for them. A branch or jump */
+/* that went somewhere fetch did not expect squashes what came after */
+/************************************************************/
+void ooo_complete()
+{
+	rob_entry_t *entry, *waiting;
+	branch_stat_t *stat;
+	btb_entry_t *btb;
+	uint32_t i, j, k;
+	int taken;
+	
+	for (i = 0; i < OOO_COUNT; i++) {
+		entry = &OOO_ROB[rob_index(i)];
+		if (entry->state != OOO_EXECUTING || CYCLE_COUNT < entry->ready) {
+			continue;
+		}
+		entry->state = OOO_DONE;
+		for (j = i + 1; j < OOO_COUNT; j++) {
+			waiting = &OOO_ROB[rob_index(j)];
+			for (k = 0; k < 2; k++) {
+				if (waiting->tag[k] == (int)rob_index(i)) {
+					waiting->src[k] = ooo_value(entry, k == 0 ? waiting->inst->srcA : waiting->inst->srcB);
+					waiting->tag[k] = -1;
 				}
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //ANDI
-				EX_MEM.ALUOutput = IF_EX.A & (IF_EX.imm & 0x0000FFFF);
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0D: //ORI
-				EX_MEM.ALUOutput = IF_EX.A | (IF_EX.imm & 0x0000FFFF);
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0E: //XORI
-				EX_MEM.ALUOutput = IF_EX.A ^ (IF_EX.imm & 0x0000FFFF);
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0F: //LUI
-				EX_MEM.ALUOutput = IF_EX.imm << 16;
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //LB
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //LH
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //LW
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-                EX_MEM.RegisterRd = rt;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
+			}
+		}
+		if (!IS_CONTROL(entry->inst->op)) {
+			continue;
+		}
+		taken = ISA_INFO[entry->inst->op].mem != MEM_BRANCH || entry->result != 0;
+		stat = branch_stat(entry->pc);
+		stat->op = entry->inst->op;
+		stat->executed++;
+		stat->taken += taken;
+		if (ISA_INFO[entry->inst->op].mem == MEM_BRANCH) {
+			bp_update(entry->pc, taken);
+		}
+		if (taken && BTB_ENTRIES > 0) {
+			btb = &BTB[(entry->pc >> 2) & (BTB_ENTRIES - 1)];
+			btb->pc = entry->pc;
+			btb->target = entry->actual;
+		}
+		if (entry->actual != entry->predicted) {
+			stat->mispredicted++;
+			stat->wasted += OOO_COUNT - i - 1 + OOO_FETCH_COUNT;
+			ooo_squash(i + 1);
+			OOO_FETCH_PC = entry->actual;
+			return;
+		}
+	}
+}
+
+/************************************************************/
+/* Execute: start the oldest ready instructions, as many as there are */
+/* units: OOO_WIDTH ALUs, OOO_MEM_PORTS load/store ports and the       */
+/* multiply/divide unit. A load waits while an older store's address  */
+/* is unknown or partly overlaps it, and takes the value of one that  */
+/* writes exactly what it reads                                                                */
+/************************************************************/
+void ooo_execute()
+{
+	rob_entry_t *entry, *store;
+	const decoded_inst_t *inst;
+	uint32_t i, j, bytes, latency, alu = 0, mem = 0;
+	int trigger = CACHE_MISS, blocked, forwarded;
+	
+	for (i = 0; i < OOO_COUNT; i++) {
+		entry = &OOO_ROB[rob_index(i)];
+		inst = entry->inst;
+		if (entry->state != OOO_WAITING || entry->tag[0] >= 0 || entry->tag[1] >= 0 ||
+			(entry->rs == RS_ALU && alu == OOO_WIDTH) || (entry->rs == RS_MEM && mem == OOO_MEM_PORTS) ||
+			(entry->rs == RS_MULDIV && CYCLE_COUNT < OOO_MD_FREE)) {
+			continue;
+		}
+		entry->result = alu_execute(inst, entry->pc, entry->src[0], entry->src[1], &entry->hilo);
+		entry->ready = CYCLE_COUNT + 1;
+		if (entry->rs == RS_MEM) {
+			entry->address = entry->result;
+			bytes = MEM_BYTES(inst->op);
+			entry->fault = (entry->address & (bytes - 1)) != 0;
+			if (IS_STORE(inst->op)) {
+				entry->store_value = entry->src[1];
+				if (ISA_INFO[inst->op].mem == MEM_SC) {
+					entry->result = TRUE;	/* one core: the link holds */
+				}
+			}
+			else if (!entry->fault) {
+				/* the youngest older store that overlaps decides */
+				blocked = forwarded = FALSE;
+				for (j = i; j-- > 0; ) {
+					store = &OOO_ROB[rob_index(j)];
+					if (!IS_STORE(store->inst->op) || (store->state == OOO_DONE && store->fault)) {
+						continue;
+					}
+					if (store->state != OOO_DONE) {
+						blocked = TRUE;
+						break;
+					}
+					if (store->address < entry->address + bytes && entry->address < store->address + MEM_BYTES(store->inst->op)) {
+						if (store->address == entry->address && MEM_BYTES(store->inst->op) == bytes) {
+							entry->result = bytes == 1 ? (uint32_t)(int32_t)(int8_t)store->store_value :
+								bytes == 2 ? (uint32_t)(int32_t)(int16_t)store->store_value : store->store_value;
+							forwarded = TRUE;
+						}
+						else {
+							blocked = TRUE;
+						}
+						break;
+					}
+				}
+				if (blocked) {
+					OOO_LOAD_WAITS++;
+					continue;
+				}
+				if (forwarded) {
+					OOO_FORWARDED++;
+				}
+				else {
+					if (PF_KIND != PF_NONE) {
+						trigger = cache_probe(&DCACHE, entry->address);
+					}
+					entry->result = mem_load(inst, entry->address);
+					cache_access(&DCACHE, entry->address, FALSE, &entry->ready);
+					if (entry->ready <= CYCLE_COUNT) {
+						entry->ready = CYCLE_COUNT + 1;
+					}
+					if (PF_KIND != PF_NONE) {
+						pf_train(entry->pc, entry->address, trigger);
+					}
+				}
+			}
+			mem++;
+		}
+		else if (entry->rs == RS_MULDIV) {
+			latency = md_latency(inst->op);
+			entry->ready = CYCLE_COUNT + latency;
+			OOO_MD_FREE = MD_PIPELINED && (inst->op == OP_MULT || inst->op == OP_MULTU) ?
+				CYCLE_COUNT + 1 : CYCLE_COUNT + latency;
+		}
+		else {
+			if (IS_CONTROL(inst->op)) {
+				entry->actual = next_pc(inst, entry->pc, entry->src[0], entry->result);
+			}
+			alu++;
+		}
+		entry->state = OOO_EXECUTING;
+		OOO_RS_USED[entry->rs]--;
+	}
+}
+
+/************************************************************/
+/* Dispatch: rename up to OOO_WIDTH instructions from the fetch queue */
+/* into the ROB and their reservation stations, reading operands from */
+/* CURRENT_STATE, a finished ROB entry or, failing that, its tag          */
+/************************************************************/
+void ooo_dispatch()
+{
+	fetch_entry_t *fetched;
+	rob_entry_t *entry;
+	const decoded_inst_t *inst;
+	branch_stat_t *stat;
+	uint32_t n, k, index, reg, target;
+	int rs, producer;
+	
+	for (n = 0; n < OOO_WIDTH && OOO_FETCH_COUNT > 0; n++) {
+		fetched = &OOO_FETCH_QUEUE[OOO_FETCH_HEAD];
+		inst = fetched->inst;
+		rs = ooo_rs_class(inst);
+		if (OOO_COUNT == OOO_ROB_SIZE) {
+			OOO_STALLS[OOO_STALL_ROB]++;
+			break;
+		}
+		if (OOO_RS_USED[rs] == OOO_RS_SIZE[rs]) {
+			OOO_STALLS[OOO_STALL_RS]++;
+			break;
+		}
+		if (rs == RS_MEM && OOO_LSQ_USED == OOO_LSQ_SIZE) {
+			OOO_STALLS[OOO_STALL_LSQ]++;
+			break;
+		}
+		index = rob_index(OOO_COUNT);
+		entry = &OOO_ROB[index];
+		memset(entry, 0, sizeof(*entry));
+		entry->inst = inst;
+		entry->pc = fetched->pc;
+		entry->predicted = fetched->predicted;
+		entry->rs = rs;
+		entry->state = OOO_WAITING;
+		for (k = 0; k < 2; k++) {
+			reg = k == 0 ? inst->srcA : inst->srcB;
+			producer = reg != 0 && reg <= REG_LO ? OOO_RAT[reg] : -1;
+			entry->tag[k] = -1;
+			if (producer < 0) {
+				entry->src[k] = read_reg(&CURRENT_STATE, reg);
+			}
+			else if (OOO_ROB[producer].state == OOO_DONE) {
+				entry->src[k] = ooo_value(&OOO_ROB[producer], reg);
+			}
+			else {
+				entry->tag[k] = producer;
+			}
+		}
+		ooo_claim(index);
+		OOO_COUNT++;
+		OOO_RS_USED[rs]++;
+		if (rs == RS_MEM) {
+			OOO_LSQ_USED++;
+		}
+		OOO_FETCH_HEAD = (OOO_FETCH_HEAD + 1) % OOO_FETCH_MAX;
+		OOO_FETCH_COUNT--;
+		
+		/* direct branches and jumps: the target is known now, even if the BTB missed it */
+		if (ISA_INFO[inst->op].mem == MEM_BRANCH || ISA_INFO[inst->op].mem == MEM_JUMP) {
+			target = ISA_INFO[inst->op].mem == MEM_JUMP ? JUMP_TARGET(entry->pc, inst->target) :
+				bp_predict(entry->pc) ? BRANCH_TARGET(entry->pc, inst->imm) : entry->pc + 4;
+			if (target != entry->predicted) {
+				stat = branch_stat(entry->pc);
+				stat->redirected++;
+				stat->wasted += OOO_FETCH_COUNT;
+				entry->predicted = target;
+				ooo_squash(OOO_COUNT);
+				OOO_FETCH_PC = target;
 				break;
-			case 0x28: //SB
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-				EX_MEM.B = IF_EX.B;
-                EX_MEM.RegisterRd = 0;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);				
+			}
+		}
+	}
+}
+
+/************************************************************/
+/* Fetch: up to OOO_WIDTH instructions into the fetch queue, up to the */
+/* first branch or jump and, with an I-cache, within one line            */
+/************************************************************/
+void ooo_fetch()
+{
+	fetch_entry_t *fetched;
+	const decoded_inst_t *inst;
+	btb_entry_t *entry;
+	uint32_t n, pc = OOO_FETCH_PC;
+	
+	if (OOO_FETCH_COUNT >= OOO_WIDTH) {
+		/* dispatch is behind */
+		return;
+	}
+	if (!OOO_FETCH_STARTED && (pc & 0x3) == 0) {
+		cache_access(&ICACHE, pc, FALSE, &OOO_FETCH_READY);
+		OOO_FETCH_STARTED = TRUE;
+	}
+	if (CYCLE_COUNT < OOO_FETCH_READY) {
+		ICACHE.stall_cycles++;
+		return;
+	}
+	OOO_FETCH_STARTED = FALSE;
+	for (n = 0; n < OOO_WIDTH; n++) {
+		fetched = &OOO_FETCH_QUEUE[(OOO_FETCH_HEAD + OOO_FETCH_COUNT++) % OOO_FETCH_MAX];
+		inst = (pc & 0x3) ? &FETCH_ERROR_INST : fetch_decoded(pc);
+		fetched->inst = inst;
+		fetched->pc = pc;
+		fetched->predicted = pc + 4;
+		if (BTB_ENTRIES > 0 && IS_CONTROL(inst->op)) {
+			entry = &BTB[(pc >> 2) & (BTB_ENTRIES - 1)];
+			if (entry->pc == pc && (ISA_INFO[inst->op].mem != MEM_BRANCH || bp_predict(pc))) {
+				fetched->predicted = entry->target;
+			}
+		}
+		pc = fetched->predicted;
+		if (inst == &FETCH_ERROR_INST || IS_CONTROL(inst->op) ||
+			(ICACHE.lines != NULL && (pc >> ICACHE.line_shift) != (fetched->pc >> ICACHE.line_shift))) {
+			break;
+		}
+	}
+	OOO_FETCH_PC = pc;
+}
+
+/************************************************************/
+/* One cycle of the out-of-order engine, stages last to first so      */
+/* nothing moves through two of them in one cycle                             */
+/************************************************************/
+void ooo_cycle()
+{
+	uint32_t k;
+	
+	if (DRAM.queued > 0) {
+		dram_tick();
+	}
+	ooo_commit();
+	if (RUN_FLAG == FALSE) {
+		return;
+	}
+	ooo_complete();
+	ooo_execute();
+	ooo_dispatch();
+	ooo_fetch();
+	OOO_ROB_HIST[OOO_COUNT * OOO_HIST / OOO_ROB_SIZE]++;
+	for (k = 0; k < RS_CLASSES; k++) {
+		OOO_RS_HIST[k][OOO_RS_USED[k] * OOO_HIST / OOO_RS_SIZE[k]]++;
+	}
+	OOO_LSQ_HIST[OOO_LSQ_USED * OOO_HIST / OOO_LSQ_SIZE]++;
+}
+
+/************************************************************/
+/* One occupancy histogram: the share of cycles in each eighth of size */
+/************************************************************/
+void ooo_histogram(const char *name, const uint64_t *hist, uint32_t size)
+{
+	uint64_t total = 0;
+	uint32_t b, low, high;
+	
+	for (b = 0; b <= OOO_HIST; b++) {
+		total += hist[b];
+	}
+	printf("  %s\t:", name);
+	for (b = 0; b <= OOO_HIST; b++) {
+		/* occupancy x lands in bucket x * OOO_HIST / size */
+		low = (b * size + OOO_HIST - 1) / OOO_HIST;
+		high = b == OOO_HIST ? size : ((b + 1) * size + OOO_HIST - 1) / OOO_HIST - 1;
+		if (low > high) {
+			continue;
+		}
+		if (low == high) {
+			printf(" %u:%.1f%%", low, total ? 100.0 * hist[b] / total : 0.0);
+		}
+		else {
+			printf(" %u-%u:%.1f%%", low, high, total ? 100.0 * hist[b] / total : 0.0);
+		}
+	}
+	printf("\n");
+}
+
+/************************************************************/
+/* Out-of-order engine statistics since the last reset                        */
+/************************************************************/
+void ooo_report()
+{
+	printf("out-of-order core\t: ROB %u, width %u, RS %u ALU / %u load-store / %u mul-div, LSQ %u\n",
+		   OOO_ROB_SIZE, OOO_WIDTH, OOO_RS_SIZE[RS_ALU], OOO_RS_SIZE[RS_MEM], OOO_RS_SIZE[RS_MULDIV], OOO_LSQ_SIZE);
+	printf("  IPC\t\t\t: %.3f\n", CYCLE_COUNT ? (double)INSTRUCTION_COUNT / CYCLE_COUNT : 0.0);
+	printf("  occupancy, entries:share of cycles\n");
+	ooo_histogram("ROB\t\t", OOO_ROB_HIST, OOO_ROB_SIZE);
+	ooo_histogram("ALU RS\t\t", OOO_RS_HIST[RS_ALU], OOO_RS_SIZE[RS_ALU]);
+	ooo_histogram("load/store RS\t", OOO_RS_HIST[RS_MEM], OOO_RS_SIZE[RS_MEM]);
+	ooo_histogram("mul/div RS\t", OOO_RS_HIST[RS_MULDIV], OOO_RS_SIZE[RS_MULDIV]);
+	ooo_histogram("LSQ\t\t", OOO_LSQ_HIST, OOO_LSQ_SIZE);
+	printf("  dispatch stalls\t: ROB full %llu, RS full %llu, LSQ full %llu\n", (unsigned long long)OOO_STALLS[OOO_STALL_ROB],
+		   (unsigned long long)OOO_STALLS[OOO_STALL_RS], (unsigned long long)OOO_STALLS[OOO_STALL_LSQ]);
+	printf("  squashed\t\t: %llu\n", (unsigned long long)OOO_SQUASHED);
+	printf("  loads forwarded\t: %llu\n", (unsigned long long)OOO_FORWARDED);
+	printf("  load waits on stores\t: %llu\n", (unsigned long long)OOO_LOAD_WAITS);
+}
+
+/************************************************************/
+/* Print what is in the ROB, oldest first                                              */
+/************************************************************/
+void ooo_show()
+{
+	static const char *states[] = { "waiting", "executing", "done" };
+	rob_entry_t *entry;
+	uint32_t i;
+	
+	printf("\nCommitted PC:[0x%x]\tfetch PC:[0x%x]\tfetch queue: %u\n", CURRENT_STATE.PC, OOO_FETCH_PC, OOO_FETCH_COUNT);
+	for (i = 0; i < OOO_COUNT; i++) {
+		entry = &OOO_ROB[rob_index(i)];
+		printf("ROB[%u] %-9s\t[0x%x]\t", rob_index(i), states[entry->state], entry->pc);
+		disassemble(entry->inst, entry->pc);
+	}
+	printf("CYCLE %u\n", CYCLE_COUNT);
+}
+
+/************************************************************/
+/* Forget what the prefetchers learned and zero their statistics       */
+/************************************************************/
+void pf_reset()
+{
+	memset(PF_STRIDE_TABLE, 0, sizeof(PF_STRIDE_TABLE));
+	memset(PF_STREAM_TABLE, 0, sizeof(PF_STREAM_TABLE));
+	PF_CLOCK = 0;
+	PF_ISSUED = PF_USEFUL = PF_LATE = 0;
+}
+
+/************************************************************/
+/* Select the prefetcher by name and how far ahead it runs (0 keeps */
+/* the degree); FALSE if the name is unknown                                    */
+/************************************************************/
+int pf_configure(const char *kind, uint32_t degree)
+{
+	static const char *names[] = { "none", "nextline", "stride", "stream" };
+	int i;
+	
+	for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+		if (strcmp(kind, names[i]) == 0) {
+			break;
+		}
+	}
+	if (i == (int)(sizeof(names) / sizeof(names[0])) || degree > 16) {
+		return FALSE;
+	}
+	PF_KIND = i;
+	if (degree > 0) {
+		PF_DEGREE = degree;
+	}
+	pf_reset();
+	if (PF_KIND == PF_NONE) {
+		printf("No prefetcher\n");
+	}
+	else {
+		printf("%s prefetcher, degree %u\n", names[PF_KIND], PF_DEGREE);
+	}
+	return TRUE;
+}
+
+/************************************************************/
+/* A load or store at pc touched address; trigger is what cache_probe */
+/* said about its line before the access                                                */
+/************************************************************/
+void pf_train(uint32_t pc, uint32_t address, int trigger)
+{
+	uint32_t block = address >> DCACHE.line_shift, i;
+	pf_stride_t *entry;
+	pf_stream_t *stream, *victim;
+	int32_t stride;
+	
+	switch (PF_KIND) {
+		case PF_NEXTLINE:
+			if (trigger != CACHE_HIT) {
+				for (i = 1; i <= PF_DEGREE; i++) {
+					cache_prefetch(&DCACHE, (block + i) << DCACHE.line_shift);
+				}
+			}
+			break;
+		case PF_STRIDE:
+			entry = &PF_STRIDE_TABLE[(pc >> 2) & (PF_STRIDE_ENTRIES - 1)];
+			if (entry->pc != pc) {
+				entry->pc = pc;
+				entry->stride = 0;
+				entry->confidence = 0;
+			}
+			else {
+				stride = (int32_t)(address - entry->last);
+				if (stride == entry->stride && stride != 0) {
+					entry->confidence += entry->confidence < 3;
+				}
+				else {
+					entry->stride = stride;
+					entry->confidence = 0;
+				}
+			}
+			entry->last = address;
+			if (entry->confidence >= 1) {
+				for (i = 1; i <= PF_DEGREE; i++) {
+					cache_prefetch(&DCACHE, address + i * (uint32_t)entry->stride);
+				}
+			}
+			break;
+		case PF_STREAM:
+			victim = &PF_STREAM_TABLE[0];
+			for (i = 0; i < PF_STREAMS; i++) {
+				stream = &PF_STREAM_TABLE[i];
+				if (!stream->valid) {
+					if (victim->valid) {
+						victim = stream;
+					}
+					continue;
+				}
+				if (stream->direction == 0 && (block == stream->last + 1 || block == stream->last - 1)) {
+					/* a second miss next to the first: a stream, going that way */
+					stream->direction = (int32_t)(block - stream->last);
+					stream->ahead = block;
+				}
+				else if (stream->direction == 0 || (int32_t)(block - stream->last) * stream->direction <= 0 ||
+						 (int32_t)(stream->ahead - block) * stream->direction < 0) {
+					if (victim->valid && stream->stamp < victim->stamp) {
+						victim = stream;
+					}
+					continue;
+				}
+				/* block lies past the last demand and no further than the prefetches */
+				stream->last = block;
+				stream->stamp = ++PF_CLOCK;
+				while ((int32_t)(stream->ahead - block) * stream->direction < (int32_t)PF_DEGREE) {
+					stream->ahead += stream->direction;
+					cache_prefetch(&DCACHE, stream->ahead << DCACHE.line_shift);
+				}
+				return;
+			}
+			if (trigger == CACHE_MISS) {
+				victim->valid = TRUE;
+				victim->last = block;
+				victim->direction = 0;
+				victim->stamp = ++PF_CLOCK;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/************************************************************/
+/* Prefetcher accuracy, coverage and timeliness                                */
+/************************************************************/
+void pf_report()
+{
+	static const char *names[] = { "none", "next-line", "stride", "stream" };
+	uint64_t misses = DCACHE.read_misses + DCACHE.write_misses;
+	
+	printf("prefetcher\t\t: %s, degree %u\n", names[PF_KIND], PF_DEGREE);
+	printf("  issued / useful\t: %llu / %llu\n", (unsigned long long)PF_ISSUED, (unsigned long long)PF_USEFUL);
+	printf("  accuracy\t\t: %.2f%%\n", PF_ISSUED ? 100.0 * PF_USEFUL / PF_ISSUED : 0.0);
+	printf("  coverage\t\t: %.2f%%\n", PF_USEFUL + misses ? 100.0 * PF_USEFUL / (PF_USEFUL + misses) : 0.0);
+	printf("  late\t\t\t: %llu (%.2f%% of useful)\n", (unsigned long long)PF_LATE,
+		   PF_USEFUL ? 100.0 * PF_LATE / PF_USEFUL : 0.0);
+}
+
+/************************************************************/
+/* Multicore locks, and core 0's entry in MC_CORES; once at start-up */
+/************************************************************/
+void mc_init()
+{
+	pthread_mutexattr_t attr;
+	int i;
+	
+	for (i = 0; i < MC_LOCKS; i++) {
+		pthread_mutex_init(&MC_LOCK[i], NULL);
+	}
+	/* fetch_decoded holds it while mem_read_32 may look a page up */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&MC_MEMORY_LOCK, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&MC_MUTEX, NULL);
+	pthread_cond_init(&MC_WAKE, NULL);
+	pthread_cond_init(&MC_DONE, NULL);
+	NUM_CORES = 1;
+	MC_QUANTUM = 100;
+	MC_BUS_LATENCY = 4;
+	mc_publish();
+}
+
+/************************************************************/
+/* Take and return the stripe lock for address's D-cache set; every  */
+/* core has the same geometry, so it covers that set in all of them */
+/************************************************************/
+pthread_mutex_t *mc_lock(uint32_t address)
+{
+	pthread_mutex_t *lock = &MC_LOCK[(address >> DCACHE.line_shift) & (DCACHE.sets - 1) & (MC_LOCKS - 1)];
+	
+	pthread_mutex_lock(lock);
+	return lock;
+}
+
+/************************************************************/
+/* mem_lookup while other cores may be creating pages too                  */
+/************************************************************/
+uint8_t *mc_lookup(uint32_t address, int write)
+{
+	uint8_t *host;
+	
+	pthread_mutex_lock(&MC_MEMORY_LOCK);
+	host = mem_lookup(address, write);
+	pthread_mutex_unlock(&MC_MEMORY_LOCK);
+	return host;
+}
+
+/************************************************************/
+/* LL with several cores: no store gets between the read and the link */
+/************************************************************/
+uint32_t mc_load_linked(uint32_t address)
+{
+	pthread_mutex_t *lock = mc_lock(address);
+	uint32_t value = mem_read_32(address);
+	
+	__atomic_store_n(&MC_CORES[CORE_ID].link, MC_LINK(address), __ATOMIC_RELAXED);
+	MC_CORES[CORE_ID].stats.linked++;
+	pthread_mutex_unlock(lock);
+	return value;
+}
+
+/************************************************************/
+/* This core is about to store to address, under its mc_lock: FALSE   */
+/* for an SC (conditional) whose link is gone, otherwise every core's */
+/* link to the line, its own included, is broken                              */
+/************************************************************/
+int mc_link_store(uint32_t address, int conditional)
+{
+	mc_core_t *core = &MC_CORES[CORE_ID];
+	uint32_t link = MC_LINK(address), k;
+	
+	if (conditional) {
+		if (__atomic_load_n(&core->link, __ATOMIC_RELAXED) != link) {
+			__atomic_store_n(&core->link, MC_NO_LINK, __ATOMIC_RELAXED);
+			core->stats.sc_failed++;
+			return FALSE;
+		}
+		core->stats.sc_stored++;
+	}
+	for (k = 0; k < NUM_CORES; k++) {
+		/* a core may be linking another line under another lock right now */
+		__sync_bool_compare_and_swap(&MC_CORES[k].link, link, MC_NO_LINK);
+	}
+	return TRUE;
+}
+
+/************************************************************/
+/* Put request (MC_BUS_*) for block on the bus, under its mc_lock.    */
+/* Every other D-cache's copy is written back if it is M, then turns */
+/* S on a BusRd or is invalidated. Adds the bus latency to *ready;    */
+/* TRUE if another cache had the line                                              */
+/************************************************************/
+int mc_snoop(uint32_t block, int request, uint32_t *ready)
+{
+	mc_stats_t *stats = &MC_CORES[CORE_ID].stats;
+	cache_line_t *line;
+	uint32_t k;
+	int held = FALSE;
+	
+	for (k = 0; k < NUM_CORES; k++) {
+		if (k == CORE_ID || (line = cache_find(MC_CORES[k].dcache, block)) == NULL) {
+			continue;
+		}
+		held = TRUE;
+		if (line->dirty) {
+			line->dirty = FALSE;
+			stats->flushes++;
+		}
+		if (request == MC_BUS_RD) {
+			line->shared = TRUE;
+		}
+		else {
+			line->valid = FALSE;
+			line->shared = FALSE;
+			stats->invalidations++;
+			__atomic_add_fetch(&MC_CORES[k].stats.invalidated, 1, __ATOMIC_RELAXED);
+		}
+	}
+	stats->bus[request]++;
+	if (*ready != DRAM_PENDING) {
+		*ready += MC_BUS_LATENCY;
+	}
+	return held;
+}
+
+/************************************************************/
+/* Show the other cores and the reports where this core's state is     */
+/************************************************************/
+void mc_publish()
+{
+	mc_core_t *core = &MC_CORES[CORE_ID];
+	
+	core->state = &CURRENT_STATE;
+	core->dcache = &DCACHE;
+	core->run_flag = &RUN_FLAG;
+	core->cycles = &CYCLE_COUNT;
+	core->instructions = &INSTRUCTION_COUNT;
+}
+
+/************************************************************/
+/* What the other cores need to be set up like this one                      */
+/************************************************************/
+void mc_config_capture(mc_config_t *config)
+{
+	const cache_t *caches[2] = { &ICACHE, &DCACHE };
+	int i;
+	
+	memset(config, 0, sizeof(*config));	/* so configurations compare with memcmp */
+	config->forwarding = ENABLE_FORWARDING != 0;
+	config->bp_kind = BP_KIND;
+	config->btb_entries = BTB_ENTRIES;
+	config->pf_kind = PF_KIND;
+	config->pf_degree = PF_DEGREE;
+	config->sb_depth = SB_DEPTH;
+	config->mshrs = NUM_MSHRS;
+	config->width = ISSUE_WIDTH;
+	config->depth[0] = IF_DEPTH;
+	config->depth[1] = EX_DEPTH;
+	config->depth[2] = MEM_DEPTH;
+	config->md_latency[0] = MD_MULT_LATENCY;
+	config->md_latency[1] = MD_DIV_LATENCY;
+	config->md_pipelined = MD_PIPELINED;
+	for (i = 0; i < 2; i++) {
+		config->cache[i][0] = caches[i]->size;
+		config->cache[i][1] = caches[i]->assoc;
+		config->cache[i][2] = caches[i]->line_size;
+		config->cache[i][3] = caches[i]->policy;
+		config->cache[i][4] = caches[i]->write_back;
+		config->cache[i][5] = caches[i]->miss_latency;
+	}
+	config->dram[0] = DRAM.banks;
+	config->dram[1] = DRAM.row_size;
+	config->dram[2] = DRAM.tCAS;
+	config->dram[3] = DRAM.tRCD;
+	config->dram[4] = DRAM.tRP;
+	config->dram_policy = DRAM.policy;
+}
+
+/************************************************************/
+/* Set this core up as config says; core 0 checked every value        */
+/************************************************************/
+void mc_config_apply(const mc_config_t *config)
+{
+	static const char *kinds[] = { "static", "bimodal", "gshare" };
+	cache_t *caches[2] = { &ICACHE, &DCACHE };
+	int i;
+	
+	ENABLE_FORWARDING = config->forwarding;
+	pipeline_select();
+	bp_configure(kinds[config->bp_kind], config->btb_entries);
+	for (i = 0; i < 2; i++) {
+		cache_configure(caches[i], config->cache[i][0], config->cache[i][1], config->cache[i][2],
+						config->cache[i][3], config->cache[i][4], config->cache[i][5]);
+	}
+	dram_configure(config->dram[0], config->dram[1], config->dram[2], config->dram[3], config->dram[4],
+				   config->dram_policy);
+	PF_KIND = config->pf_kind;
+	PF_DEGREE = config->pf_degree;
+	SB_DEPTH = config->sb_depth;
+	NUM_MSHRS = config->mshrs;
+	ISSUE_WIDTH = config->width;
+	IF_DEPTH = config->depth[0];
+	EX_DEPTH = config->depth[1];
+	MEM_DEPTH = config->depth[2];
+	MD_MULT_LATENCY = config->md_latency[0];
+	MD_DIV_LATENCY = config->md_latency[1];
+	MD_PIPELINED = config->md_pipelined;
+	NUM_THREADS = 1;
+	FETCH_POLICY = FETCH_RR;
+}
+
+/************************************************************/
+/* This core's part of MC_RUN: up to MC_RUN_CYCLES cycles, in its turn */
+/* if deterministic                                                                                  */
+/************************************************************/
+void mc_core_run()
+{
+	uint32_t i, epoch;
+	
+	if (MC_DETERMINISTIC) {
+		pthread_mutex_lock(&MC_MUTEX);
+		while (MC_TURN != CORE_ID) {
+			pthread_cond_wait(&MC_DONE, &MC_MUTEX);
+		}
+		pthread_mutex_unlock(&MC_MUTEX);
+	}
+	epoch = __atomic_load_n(&MC_CODE_EPOCH, __ATOMIC_RELAXED);
+	if (CORE_CODE_EPOCH != epoch) {
+		/* a page another core has decoded may still be writable through the TLB */
+		tlb_flush();
+		CORE_CODE_EPOCH = epoch;
+	}
+	for (i = 0; i < MC_RUN_CYCLES && RUN_FLAG; i++) {
+		cycle();
+	}
+	if (MC_DETERMINISTIC) {
+		pthread_mutex_lock(&MC_MUTEX);
+		MC_TURN++;
+		pthread_cond_broadcast(&MC_DONE);
+		pthread_mutex_unlock(&MC_MUTEX);
+	}
+}
+
+/************************************************************/
+/* Host thread of core arg (1 and up): take jobs until MC_EXIT            */
+/************************************************************/
+void *mc_core_main(void *arg)
+{
+	mc_core_t *core;
+	int job;
+	
+	CORE_ID = (uint32_t)(uintptr_t)arg;
+	core = &MC_CORES[CORE_ID];
+	mc_publish();
+	tlb_flush();	/* empty entries must not look like page 0 */
+	ICACHE.name = "I-cache";
+	DCACHE.name = "D-cache";
+	for (;;) {
+		pthread_mutex_lock(&MC_MUTEX);
+		while (core->seen == MC_JOB_SEQ) {
+			pthread_cond_wait(&MC_WAKE, &MC_MUTEX);
+		}
+		core->seen = MC_JOB_SEQ;
+		job = MC_JOB;
+		pthread_mutex_unlock(&MC_MUTEX);
+		if (job == MC_EXIT) {
+			return NULL;
+		}
+		if (job == MC_RESET) {
+			mc_config_apply(&MC_CONFIG);
+			tlb_flush();	/* core 0 may have freed or restored pages */
+			core_reset();
+		}
+		else {
+			mc_core_run();
+		}
+		pthread_mutex_lock(&MC_MUTEX);
+		if (--MC_PENDING == 0) {
+			pthread_cond_broadcast(&MC_DONE);
+		}
+		pthread_mutex_unlock(&MC_MUTEX);
+	}
+}
+
+/************************************************************/
+/* Give cores 1 and up a job; on MC_RUN core 0 runs its part here.    */
+/* Returns once they are all done, or at once for MC_EXIT                 */
+/************************************************************/
+void mc_dispatch(int job)
+{
+	pthread_mutex_lock(&MC_MUTEX);
+	MC_JOB = job;
+	MC_JOB_SEQ++;
+	MC_PENDING = NUM_CORES - 1;
+	MC_TURN = 0;
+	pthread_cond_broadcast(&MC_WAKE);
+	pthread_mutex_unlock(&MC_MUTEX);
+	if (job == MC_EXIT) {
+		return;
+	}
+	if (job == MC_RUN) {
+		mc_core_run();
+	}
+	pthread_mutex_lock(&MC_MUTEX);
+	while (MC_PENDING > 0) {
+		pthread_cond_wait(&MC_DONE, &MC_MUTEX);
+	}
+	pthread_mutex_unlock(&MC_MUTEX);
+}
+
+/************************************************************/
+/* Back to core 0 alone: the other cores' threads end                       */
+/************************************************************/
+void mc_stop()
+{
+	uint32_t k;
+	
+	if (NUM_CORES > 1) {
+		mc_dispatch(MC_EXIT);
+		for (k = 1; k < NUM_CORES; k++) {
+			pthread_join(MC_CORES[k].thread, NULL);
+		}
+	}
+	NUM_CORES = 1;
+}
+
+/************************************************************/
+/* Can cores run as things are set up? If not, says why                     */
+/************************************************************/
+int mc_supported()
+{
+	if (SIM_MODE != SIM_PIPELINE || NUM_THREADS > 1 || DCACHE.lines == NULL || !DCACHE.write_back) {
+		printf("Error: cores run the pipeline (sim --pipeline) with one hardware context and a write-back D-cache each\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/************************************************************/
+/* cores <n> [parallel|deterministic] [quantum] [bus latency]: start  */
+/* n - 1 more cores and reset; FALSE (and nothing changes) if the    */
+/* request is out of range or the cores cannot run like this              */
+/************************************************************/
+int mc_configure(uint32_t n, const char *mode, uint32_t quantum, uint32_t bus_latency)
+{
+	uint32_t k;
+	
+	if (n < 1 || n > CORES_MAX || quantum == 0) {
+		printf("Error: 1 to %d cores and a quantum of at least one cycle\n", CORES_MAX);
+		return FALSE;
+	}
+	if (strcmp(mode, "parallel") != 0 && strcmp(mode, "deterministic") != 0) {
+		printf("Error: unknown mode %s (parallel or deterministic)\n", mode);
+		return FALSE;
+	}
+	if (n > 1 && !mc_supported()) {
+		return FALSE;
+	}
+	mc_stop();
+	MC_DETERMINISTIC = strcmp(mode, "deterministic") == 0;
+	MC_QUANTUM = quantum;
+	MC_BUS_LATENCY = bus_latency;
+	for (k = 1; k < n; k++) {
+		MC_CORES[k].seen = MC_JOB_SEQ;
+		if (pthread_create(&MC_CORES[k].thread, NULL, mc_core_main, (void *)(uintptr_t)k) != 0) {
+			printf("Error: no host thread for core %u\n", k);
+			break;
+		}
+		NUM_CORES = k + 1;
+	}
+	reset();
+	return TRUE;
+}
+
+/************************************************************/
+/* Has any core not exited yet?                                                            */
+/************************************************************/
+int mc_running()
+{
+	uint32_t k;
+	
+	for (k = 0; k < NUM_CORES; k++) {
+		if (*MC_CORES[k].run_flag) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Can run and sim go on with the cores? If not, says why; cores 1     */
+/* and up only take core 0's configuration at reset                           */
+/************************************************************/
+int mc_ready()
+{
+	mc_config_t config;
+	
+	if (!mc_supported()) {
+		return FALSE;
+	}
+	mc_config_capture(&config);
+	if (memcmp(&config, &MC_CONFIG, sizeof(config)) != 0) {
+		printf("Error: core 0 was configured again since the cores were reset; reset to set them all up like it\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/************************************************************/
+/* Run every core for up to cycles cycles, a quantum at a time           */
+/************************************************************/
+void mc_run(uint32_t cycles)
+{
+	while (cycles > 0 && mc_running()) {
+		MC_RUN_CYCLES = cycles < MC_QUANTUM ? cycles : MC_QUANTUM;
+		mc_dispatch(MC_RUN);
+		cycles -= MC_RUN_CYCLES;
+	}
+}
+
+/************************************************************/
+/* Per-core CPI and coherence traffic for print_stats                          */
+/************************************************************/
+void mc_report()
+{
+	static const char *requests[] = { "BusRd", "BusRdX", "BusUpgr" };
+	const mc_core_t *core;
+	const cache_t *dcache;
+	uint64_t accesses, misses, bus, instructions = 0, transactions[3] = { 0, 0, 0 };
+	uint64_t invalidations = 0, transfers = 0, flushes = 0;
+	uint32_t k, i, cycles = 0;
+	
+	printf("cores\t\t\t: %u, %s, %u-cycle quantum, %u-cycle bus\n", NUM_CORES,
+		   MC_DETERMINISTIC ? "deterministic" : "parallel", MC_QUANTUM, MC_BUS_LATENCY);
+	for (k = 0; k < NUM_CORES; k++) {
+		core = &MC_CORES[k];
+		dcache = core->dcache;
+		accesses = dcache->reads + dcache->writes;
+		misses = dcache->read_misses + dcache->write_misses;
+		printf("  core %u\t\t: %u instructions, %u cycles, CPI %.3f, D-cache hit rate %.2f%%%s\n", k,
+			   *core->instructions, *core->cycles, *core->instructions ? (double)*core->cycles / *core->instructions : 0.0,
+			   accesses ? 100.0 * (accesses - misses) / accesses : 0.0, *core->run_flag ? "" : ", done");
+		printf("    bus\t\t\t: %llu BusRd, %llu BusRdX, %llu BusUpgr; %llu lines from another cache, %llu flushes\n",
+			   (unsigned long long)core->stats.bus[MC_BUS_RD], (unsigned long long)core->stats.bus[MC_BUS_RDX],
+			   (unsigned long long)core->stats.bus[MC_BUS_UPGR], (unsigned long long)core->stats.transfers,
+			   (unsigned long long)core->stats.flushes);
+		printf("    invalidations\t: %llu sent, %llu received\n", (unsigned long long)core->stats.invalidations,
+			   (unsigned long long)core->stats.invalidated);
+		printf("    LL / SC\t\t: %llu LL, %llu SC stored, %llu SC failed\n", (unsigned long long)core->stats.linked,
+			   (unsigned long long)core->stats.sc_stored, (unsigned long long)core->stats.sc_failed);
+		for (i = 0; i < 3; i++) {
+			transactions[i] += core->stats.bus[i];
+		}
+		invalidations += core->stats.invalidations;
+		transfers += core->stats.transfers;
+		flushes += core->stats.flushes;
+		instructions += *core->instructions;
+		if (*core->cycles > cycles) {
+			cycles = *core->cycles;
+		}
+	}
+	bus = transactions[0] + transactions[1] + transactions[2];
+	printf("  bus transactions\t: %llu (%llu cycles)\n", (unsigned long long)bus, (unsigned long long)bus * MC_BUS_LATENCY);
+	for (i = 0; i < 3; i++) {
+		printf("    %s\t\t: %llu\n", requests[i], (unsigned long long)transactions[i]);
+	}
+	printf("  invalidations\t\t: %llu\n", (unsigned long long)invalidations);
+	printf("  cache-to-cache\t: %llu lines, %llu flushes\n", (unsigned long long)transfers, (unsigned long long)flushes);
+	printf("  aggregate IPC\t\t: %.3f\n", cycles ? (double)instructions / cycles : 0.0);
+}
+
+/************************************************************/
+/* Registers of cores 1 and up; rdump shows core 0                           */
+/************************************************************/
+void mc_rdump()
+{
+	const CPU_State *state;
+	uint32_t k;
+	int i;
+	
+	for (k = 1; k < NUM_CORES; k++) {
+		state = MC_CORES[k].state;
+		printf("-------------------------------------\n");
+		printf("Core %u%s\n", k, *MC_CORES[k].run_flag ? "" : " (done)");
+		printf("# Instructions Executed\t: %u\n", *MC_CORES[k].instructions);
+		printf("# Cycles Executed\t: %u\n", *MC_CORES[k].cycles);
+		printf("PC\t: 0x%08x\n", state->PC);
+		for (i = 0; i < MIPS_REGS; i++) {
+			printf("[R%d]\t: 0x%08x\n", i, state->REGS[i]);
+		}
+		printf("[HI]\t: 0x%08x\n", state->HI);
+		printf("[LO]\t: 0x%08x\n", state->LO);
+	}
+}
+
+/************************************************************/
+/* Superscalar issue: IPC, how many instructions ID issued together  */
+/* and what kept groups short                                                                  */
+/************************************************************/
+void issue_report()
+{
+	static const char *reasons[ISSUE_REASONS] = {
+		[ISSUE_FETCH] = "nothing more fetched",
+		[ISSUE_DEPENDENCE] = "dependence in group",
+		[ISSUE_MEMORY] = "second load/store",
+		[ISSUE_COMPLEX] = "second branch/HI-LO/SYSCALL",
+		[ISSUE_HAZARD] = "waits on older",
+		[ISSUE_CONTROL] = "after branch/SYSCALL",
+	};
+	uint64_t issuing = 0, multi = 0;
+	uint32_t i;
+	
+	for (i = 1; i <= ISSUE_WIDTH; i++) {
+		issuing += ISSUE_GROUPS[i];
+		multi += i > 1 ? ISSUE_GROUPS[i] : 0;
+	}
+	printf("issue width\t\t: %u\n", ISSUE_WIDTH);
+	printf("  IPC\t\t\t: %.3f\n", CYCLE_COUNT ? (double)INSTRUCTION_COUNT / CYCLE_COUNT : 0.0);
+	for (i = 0; i <= ISSUE_WIDTH; i++) {
+		printf("  cycles issuing %u\t: %llu\n", i, (unsigned long long)ISSUE_GROUPS[i]);
+	}
+	printf("  multi-issue rate\t: %.2f%% of issuing cycles\n", issuing ? 100.0 * multi / issuing : 0.0);
+	printf("  short groups, why\n");
+	for (i = 0; i < ISSUE_REASONS; i++) {
+		printf("    %-28s: %llu\n", reasons[i], (unsigned long long)ISSUE_LIMITS[i]);
+	}
+}
+
+/************************************************************/
+/* Pipeline statistics since the last reset                                          */
+/************************************************************/
+void print_stats()
+{
+	printf("-------------------------------------\n");
+	printf("Pipeline statistics\n");
+	printf("-------------------------------------\n");
+	printf("instructions\t\t: %u\n", INSTRUCTION_COUNT);
+	printf("cycles\t\t\t: %u\n", CYCLE_COUNT);
+	printf("CPI\t\t\t: %.3f\n", INSTRUCTION_COUNT ? (double)CYCLE_COUNT / INSTRUCTION_COUNT : 0.0);
+	if (IF_DEPTH > 1 || EX_DEPTH > 1 || MEM_DEPTH > 1) {
+		printf("pipeline depth\t\t: %u stages (IF %u, ID 1, EX %u, MEM %u, WB 1)\n",
+			   IF_DEPTH + EX_DEPTH + MEM_DEPTH + 2, IF_DEPTH, EX_DEPTH, MEM_DEPTH);
+	}
+	cache_report(&ICACHE);
+	cache_report(&DCACHE);
+	if (NUM_MSHRS > 0) {
+		printf("MSHRs\t\t\t: %u\n", NUM_MSHRS);
+		printf("  misses / merged\t: %llu / %llu\n", (unsigned long long)MSHR_MISSES, (unsigned long long)MSHR_MERGED);
+		printf("  blocked, MSHRs full\t: %llu\n", (unsigned long long)MSHR_FULL);
+		printf("  avg outstanding\t: %.3f\n", CYCLE_COUNT ? (double)MSHR_OUTSTANDING / CYCLE_COUNT : 0.0);
+		printf("  dependent stalls\t: %llu\n", (unsigned long long)MSHR_DEP_STALLS);
+		printf("  stall cycles saved\t: %lld\n", (long long)MSHR_HIDDEN - (long long)MSHR_DEP_STALLS);
+	}
+	if (MD_MULT_LATENCY > 1 || MD_DIV_LATENCY > 1) {
+		printf("multiply/divide unit\t: MULT %u cycles%s, DIV %u cycles\n", MD_MULT_LATENCY,
+			   MD_PIPELINED ? " pipelined" : "", MD_DIV_LATENCY);
+		printf("  operations\t\t: %llu\n", (unsigned long long)MD_OPS);
+		printf("  HI/LO interlock stalls\t: %llu\n", (unsigned long long)MD_HILO_STALLS);
+		printf("  unit busy stalls\t: %llu\n", (unsigned long long)MD_BUSY_STALLS);
+	}
+	if (ISSUE_WIDTH > 1) {
+		issue_report();
+	}
+	if (NUM_THREADS > 1) {
+		threads_report();
+	}
+	if (NUM_CORES > 1) {
+		mc_report();
+	}
+	if (SIM_MODE == SIM_OOO) {
+		ooo_report();
+	}
+	if (PF_KIND != PF_NONE) {
+		pf_report();
+	}
+	if (DRAM.banks > 0) {
+		dram_report();
+	}
+	if (SB_DEPTH > 0) {
+		printf("store buffer\t\t: %u entries\n", SB_DEPTH);
+		printf("  stores / coalesced\t: %llu / %llu\n", (unsigned long long)SB_STORES, (unsigned long long)SB_COALESCED);
+		printf("  loads forwarded\t: %llu\n", (unsigned long long)SB_FORWARDED);
+		printf("  full / overlap stalls\t: %llu / %llu\n", (unsigned long long)SB_FULL_STALLS, (unsigned long long)SB_CONFLICT_STALLS);
+		printf("  stall cycles saved\t: %lld\n",
+			   (long long)SB_HIDDEN - (long long)(SB_FULL_STALLS + SB_CONFLICT_STALLS));
+	}
+	printf("-------------------------------------\n");
+}
+
+/************************************************************/
+/* functional mode: execute one instruction straight against      */
+/* CURRENT_STATE, no pipeline registers involved                                */ 
+/************************************************************/
+void functional_step()
+{
+	const decoded_inst_t *inst = fetch_decoded(CURRENT_STATE.PC);
+	uint32_t a, b, result;
+	uint64_t hilo = 0;
+	
+	if (!IS_IMPLEMENTED(inst->op)) {
+		printf("Instruction at 0x%x is not implemented!\n", CURRENT_STATE.PC);
+		CURRENT_STATE.PC += 4;
+		return;
+	}
+	a = read_reg(&CURRENT_STATE, inst->srcA);
+	b = read_reg(&CURRENT_STATE, inst->srcB);
+	
+	result = alu_execute(inst, CURRENT_STATE.PC, a, b, &hilo);
+	if (IS_MEMORY(inst->op)) {
+		result = IS_LOAD(inst->op) ? mem_load(inst, result) : mem_store(inst, result, b);
+		if (RUN_FLAG == FALSE) {
+			/* address error: stop at the access, nothing written or retired */
+			return;
+		}
+	}
+	else if (ISA_INFO[inst->op].mem == MEM_SYSCALL && a == 0xa) {
+		RUN_FLAG = FALSE;
+	}
+	CURRENT_STATE.PC = next_pc(inst, CURRENT_STATE.PC, a, result);
+	write_result(&CURRENT_STATE, inst, result, hilo);
+	INSTRUCTION_COUNT++;
+}
+
+/************************************************************/
+/* functional mode building blocks: one isa_step_ function per op,  */
+/* running the table's exec, memory and writeback columns on a    */
+/* local register file (the GPRs plus HI and LO). Each returns the  */
+/* address of the next instruction                                                         */
+/************************************************************/
+#define SRC_NONE 0
+#define SRC_RS regs[inst->rs]
+#define SRC_RT regs[inst->rt]
+#define SRC_RD regs[inst->rd]
+#define SRC_HI regs[REG_HI]
+#define SRC_LO regs[REG_LO]
+#define SRC_V0 regs[2]
+/* an address error stops the run at the access, leaving rt alone */
+#define STEP_FAULT if (RUN_FLAG == FALSE) { return pc; }
+#define STEP_NONE
+#define STEP_LB r = (uint32_t)(int32_t)(int8_t)mem_read_8(r); STEP_FAULT
+#define STEP_LH r = (uint32_t)(int32_t)(int16_t)mem_read_16(r); STEP_FAULT
+#define STEP_LW r = mem_read_32(r); STEP_FAULT
+#define STEP_LL r = mem_read_32(r); STEP_FAULT
+#define STEP_SB mem_write_8(r, b & 0x000000FF); STEP_FAULT
+#define STEP_SH mem_write_16(r, b & 0x0000FFFF); STEP_FAULT
+#define STEP_SW mem_write_32(r, b); STEP_FAULT
+#define STEP_SC mem_write_32(r, b); STEP_FAULT r = TRUE;	/* one core: nothing else can break the link */
+#define STEP_SYSCALL if (a == 0xa) { RUN_FLAG = FALSE; }
+#define STEP_BRANCH if (r) { next = BRANCH_TARGET(pc, imm); }
+#define STEP_JUMP next = JUMP_TARGET(pc, inst->target);
+#define STEP_JUMPR next = a;
+#define WB_NONE
+#define WB_RT regs[inst->dst] = r;
+#define WB_RD regs[inst->dst] = r;
+#define WB_RA regs[31] = r;
+#define WB_HI regs[REG_HI] = hilo >> 32;
+#define WB_LO regs[REG_LO] = (uint32_t)hilo;
+#define WB_HILO regs[REG_HI] = hilo >> 32; regs[REG_LO] = (uint32_t)hilo;
+#define ISA_STEP(name, code, fmt, srcA, srcB, dst, exec, mem) \
+FORCE_INLINE uint32_t isa_step_##name(uint32_t *regs, const decoded_inst_t *inst, uint32_t pc) \
+{ \
+	uint32_t a = SRC_##srcA, b = SRC_##srcB; \
+	uint32_t sa = inst->sa, imm = inst->imm, simm = (uint32_t)(int32_t)(int16_t)imm; \
+	uint32_t r = 0, next = pc + 4; \
+	uint64_t hilo = 0; \
+	(void)a; (void)b; (void)sa; (void)simm; (void)r; (void)hilo; \
+	exec; \
+	STEP_##mem \
+	WB_##dst \
+	regs[0] = 0; \
+	return next; \
+}
+MIPS_ISA(ISA_STEP)
+#undef ISA_STEP
+#undef SRC_NONE
+#undef SRC_RS
+#undef SRC_RT
+#undef SRC_RD
+#undef SRC_HI
+#undef SRC_LO
+#undef SRC_V0
+#undef STEP_FAULT
+#undef STEP_NONE
+#undef STEP_LB
+#undef STEP_LH
+#undef STEP_LW
+#undef STEP_LL
+#undef STEP_SB
+#undef STEP_SH
+#undef STEP_SW
+#undef STEP_SC
+#undef STEP_SYSCALL
+#undef STEP_BRANCH
+#undef STEP_JUMP
+#undef STEP_JUMPR
+#undef WB_NONE
+#undef WB_RT
+#undef WB_RD
+#undef WB_RA
+#undef WB_HI
+#undef WB_LO
+#undef WB_HILO
+
+/************************************************************/
+/* functional mode, threaded: run up to max instructions. Each       */
+/* decoded record's handler selects a label and every label jumps */
+/* straight to the next one (GCC labels-as-values); other                  */
+/* compilers, or -DNO_COMPUTED_GOTO, get the same handlers as a   */
+/* switch. Fused pairs retire two instructions per dispatch.          */
+/* Returns the number of steps taken                                                    */
+/************************************************************/
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define THREADED_DISPATCH
+#endif
+
+uint32_t functional_run(uint32_t max)
+{
+	/* the GPRs plus HI and LO, so operand routing is plain indexing */
+	uint32_t regs[REG_LO + 1];
+	uint32_t pc = CURRENT_STATE.PC;
+	uint32_t steps = 0, retired = 0;
+	const decoded_inst_t *inst;
+
+#ifdef THREADED_DISPATCH
+#define ISA_HANDLER_ADDRESS(name, code, fmt, srcA, srcB, dst, exec, mem) [OP_##name] = &&do_OP_##name,
+#define FUSED_HANDLER_ADDRESS(first, second) [OP_##first##_##second] = &&do_OP_##first##_##second,
+	static const void *handlers[NUM_HANDLERS] = {
+		[0 ... NUM_HANDLERS - 1] = &&do_unimplemented,
+		[OP_NOP] = &&do_OP_NOP,
+		MIPS_ISA(ISA_HANDLER_ADDRESS)
+		MIPS_FUSED_PAIRS(FUSED_HANDLER_ADDRESS)
+	};
+#undef ISA_HANDLER_ADDRESS
+#undef FUSED_HANDLER_ADDRESS
+#define HANDLER(op) do_##op:
+#define DISPATCH(h) goto *handlers[h]
+#else
+	uint8_t handler;
+#define HANDLER(op) case op:
+#define DISPATCH(h) do { handler = (h); goto dispatch; } while (0)
+#endif
+/* retire the current instruction and go to the next one */
+#define NEXT() do { retired++; goto next; } while (0)
+/* an access that stopped the run faulted and is not retired */
+#define ISA_HANDLER(name, code, fmt, srcA, srcB, dst, exec, mem) \
+	HANDLER(OP_##name) \
+		pc = isa_step_##name(regs, inst, pc); \
+		if (MEM_##mem >= MEM_LB && MEM_##mem <= MEM_SC && RUN_FLAG == FALSE) { \
+			goto done; \
+		} \
+		NEXT();
+/* with a single step of budget left only the first half runs. No */
+/* pair holds a SYSCALL, so only an address error stops either half */
+#define FUSED_HANDLER(first, second) \
+	HANDLER(OP_##first##_##second) \
+		if (steps == max) { \
+			DISPATCH(inst->op); \
+		} \
+		steps++; \
+		pc = isa_step_##first(regs, inst, pc); \
+		if (RUN_FLAG == FALSE) { \
+			goto done; \
+		} \
+		retired++; \
+		pc = isa_step_##second(regs, inst + 1, pc); \
+		if (RUN_FLAG == FALSE) { \
+			goto done; \
+		} \
+		retired++; \
+		goto next;
+
+	memcpy(regs, CURRENT_STATE.REGS, sizeof(CURRENT_STATE.REGS));
+	regs[REG_HI] = CURRENT_STATE.HI;
+	regs[REG_LO] = CURRENT_STATE.LO;
+
+next:
+	if (steps == max || RUN_FLAG == FALSE) {
+		goto done;
+	}
+	steps++;
+	inst = fetch_decoded(pc);
+	DISPATCH(inst->handler);
+
+#ifndef THREADED_DISPATCH
+dispatch:
+	switch (handler) {
+#endif
+	HANDLER(OP_NOP)
+		pc += 4;
+		NEXT();
+	MIPS_ISA(ISA_HANDLER)
+	MIPS_FUSED_PAIRS(FUSED_HANDLER)
+#ifndef THREADED_DISPATCH
+	default:
+		goto do_unimplemented;
+	}
+#endif
+
+do_unimplemented:
+	printf("Instruction at 0x%x is not implemented!\n", pc);
+	pc += 4;
+	goto next;
+
+done:
+	memcpy(CURRENT_STATE.REGS, regs, sizeof(CURRENT_STATE.REGS));
+	CURRENT_STATE.HI = regs[REG_HI];
+	CURRENT_STATE.LO = regs[REG_LO];
+	CURRENT_STATE.PC = pc;
+	INSTRUCTION_COUNT += retired;
+	return steps;
+#undef ISA_HANDLER
+#undef FUSED_HANDLER
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+}
+
+/************************************************************/
+/* Dynamic binary translation (x86-64 hosts). Straight-line runs  */
+/* of guest code within one page, up to and including a branch or  */
+/* jump, become host code working on CURRENT_STATE in place          */
+/* (r15 = &CURRENT_STATE, rbx = &DBT_CTX). Blocks are chained by   */
+/* patching their exit jumps once the next block exists. A write to */
+/* a page holding translations throws the whole cache away            */
+/************************************************************/
+#define DBT_REG_OFFSET(r) ((r) == REG_HI ? offsetof(CPU_State, HI) : \
+						   (r) == REG_LO ? offsetof(CPU_State, LO) : \
+						   offsetof(CPU_State, REGS) + 4 * (r))
+
+/* host registers by x86 encoding */
+#define HOST_EAX 0
+#define HOST_ECX 1
+#define HOST_EDX 2
+#define HOST_ESI 6
+#define HOST_EDI 7
+
+static inline void dbt_emit8(uint8_t b)
+{
+	*DBT_CODE_PTR++ = b;
+}
+
+static inline void dbt_emit32(uint32_t v)
+{
+	memcpy(DBT_CODE_PTR, &v, 4);
+	DBT_CODE_PTR += 4;
+}
+
+static inline void dbt_emit64(uint64_t v)
+{
+	memcpy(DBT_CODE_PTR, &v, 8);
+	DBT_CODE_PTR += 8;
+}
+
+/* opcode host, [r15 + offset of guest reg] */
+void dbt_emit_guest(uint8_t opcode, int host, uint32_t reg)
+{
+	dbt_emit8(0x41);
+	dbt_emit8(opcode);
+	dbt_emit8(0x87 | (host << 3));
+	dbt_emit32(DBT_REG_OFFSET(reg));
+}
+
+/* jmp rel32 to target */
+void dbt_emit_jmp(uint8_t *target)
+{
+	dbt_emit8(0xE9);
+	dbt_emit32((uint32_t)(target - (DBT_CODE_PTR + 4)));
+}
+
+/* leave translated code at guest pc, handing back refund unexecuted instructions */
+void dbt_emit_exit(uint32_t pc, uint32_t refund)
+{
+	if (refund) {
+		dbt_emit8(0x48); dbt_emit8(0x81); dbt_emit8(0x43);		/* add qword [rbx+budget], refund */
+		dbt_emit8(offsetof(dbt_context_t, budget));
+		dbt_emit32(refund);
+	}
+	dbt_emit8(0xB8); dbt_emit32(pc);							/* mov eax, pc */
+	dbt_emit8(0x31); dbt_emit8(0xD2);							/* xor edx, edx: not chainable */
+	dbt_emit_jmp(DBT_EXIT);
+}
+
+/* chainable exit: mov eax, next; jmp <patched to the next block>; */
+/* until then the jmp lands on lea rdx, [its rel32]; jmp exit               */
+void dbt_emit_chain_exit(uint32_t next)
+{
+	dbt_emit8(0xB8); dbt_emit32(next);
+	dbt_emit8(0xE9); dbt_emit32(0);
+	dbt_emit8(0x48); dbt_emit8(0x8D); dbt_emit8(0x15); dbt_emit32((uint32_t)-11);
+	dbt_emit_jmp(DBT_EXIT);
+}
+
+/* host code for the branch or jump ending a block */
+void dbt_emit_control(const decoded_inst_t *inst, uint32_t pc)
+{
+	uint8_t *taken;
+	uint32_t rel;
+	uint8_t cc;
+	
+	switch (ISA_INFO[inst->op].mem) {
+		case MEM_BRANCH:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->rs);
+			if (inst->op == OP_BEQ || inst->op == OP_BNE) {
+				dbt_emit_guest(0x3B, HOST_EAX, inst->rt);		/* cmp eax, [rt] */
+			}
+			else {
+				dbt_emit8(0x85); dbt_emit8(0xC0);				/* test eax, eax */
+			}
+			switch (inst->op) {
+				case OP_BEQ: cc = 0x84; break;					/* je */
+				case OP_BNE: cc = 0x85; break;					/* jne */
+				case OP_BLEZ: cc = 0x8E; break;					/* jle */
+				case OP_BGTZ: cc = 0x8F; break;					/* jg */
+				case OP_BLTZ: cc = 0x8C; break;					/* jl */
+				default: cc = 0x8D; break;						/* jge */
+			}
+			dbt_emit8(0x0F); dbt_emit8(cc); dbt_emit32(0);
+			taken = DBT_CODE_PTR;
+			dbt_emit_chain_exit(pc + 4);
+			rel = (uint32_t)(DBT_CODE_PTR - taken);			/* jcc lands on the taken exit */
+			memcpy(taken - 4, &rel, 4);
+			dbt_emit_chain_exit(BRANCH_TARGET(pc, inst->imm));
+			break;
+		case MEM_JUMP:
+			if (inst->dst) {
+				dbt_emit8(0x41); dbt_emit8(0xC7); dbt_emit8(0x87);	/* mov dword [r15+dst], pc + 4 */
+				dbt_emit32(DBT_REG_OFFSET(inst->dst));
+				dbt_emit32(pc + 4);
+			}
+			dbt_emit_chain_exit(JUMP_TARGET(pc, inst->target));
+			break;
+		default:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->rs);
+			if (inst->dst) {
+				dbt_emit8(0x41); dbt_emit8(0xC7); dbt_emit8(0x87);	/* mov dword [r15+dst], pc + 4 */
+				dbt_emit32(DBT_REG_OFFSET(inst->dst));
+				dbt_emit32(pc + 4);
+			}
+			dbt_emit8(0x31); dbt_emit8(0xD2);							/* xor edx, edx: not chainable */
+			dbt_emit_jmp(DBT_EXIT);
+			break;
+	}
+}
+
+/* call a C function; the block entry keeps rsp 16-byte aligned */
+void dbt_emit_call(void *fn)
+{
+	dbt_emit8(0x48); dbt_emit8(0xB8); dbt_emit64((uint64_t)(uintptr_t)fn);	/* movabs rax, fn */
+	dbt_emit8(0xFF); dbt_emit8(0xD0);										/* call rax */
+}
+
+/* leave at pc, refunding refund, if the context field at offset is set */
+void dbt_emit_exit_if(uint8_t offset, uint32_t pc, uint32_t refund)
+{
+	uint8_t *skip;
+	
+	dbt_emit8(0x83); dbt_emit8(0x7B); dbt_emit8(offset); dbt_emit8(0x00);	/* cmp dword [rbx+offset], 0 */
+	dbt_emit8(0x74); dbt_emit8(0x00);										/* je over the exit */
+	skip = DBT_CODE_PTR;
+	dbt_emit_exit(pc, refund);
+	skip[-1] = (uint8_t)(DBT_CODE_PTR - skip);
+}
+
+/* after a memory access, before its result is written: an address */
+/* error leaves at the access itself, which is not retired           */
+void dbt_emit_fault_check(uint32_t pc, uint32_t refund)
+{
+	dbt_emit_exit_if(offsetof(dbt_context_t, fault), pc, refund + 1);
+}
+
+/* after a memory access: stop here if it flushed the cache */
+void dbt_emit_stop_check(uint32_t next_pc, uint32_t refund)
+{
+	dbt_emit_exit_if(offsetof(dbt_context_t, stop), next_pc, refund);
+}
+
+/* ops without a hand-written encoding (DIV/DIVU, and any new table */
+/* entry without memory or system effects) run through alu_execute */
+void dbt_helper_exec(const decoded_inst_t *inst)
+{
+	uint64_t hilo = 0;
+	uint32_t r;
+	
+	r = alu_execute(inst, CURRENT_STATE.PC, read_reg(&CURRENT_STATE, inst->srcA), read_reg(&CURRENT_STATE, inst->srcB), &hilo);
+	write_result(&CURRENT_STATE, inst, r, hilo);
+}
+
+/* host code for one guest instruction; FALSE if it has to be interpreted */
+int dbt_translate_inst(const decoded_inst_t *inst, uint32_t pc, uint32_t refund)
+{
+	uint32_t simm = (uint32_t)(int32_t)(int16_t)inst->imm;
+	
+	switch (inst->op) {
+		case OP_NOP:
+			return TRUE;
+		case OP_SLL:
+		case OP_SRL:
+		case OP_SRA:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->rt);
+			if (inst->sa) {
+				dbt_emit8(0xC1);
+				dbt_emit8(inst->op == OP_SLL ? 0xE0 : inst->op == OP_SRL ? 0xE8 : 0xF8);
+				dbt_emit8(inst->sa);
+			}
+			break;
+		case OP_MFHI:
+		case OP_MFLO:
+		case OP_MTHI:
+		case OP_MTLO:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->srcA);
+			break;
+		case OP_MULT:
+		case OP_MULTU:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->rs);
+			dbt_emit_guest(0xF7, inst->op == OP_MULT ? 5 : 4, inst->rt);	/* imul/mul dword [rt] */
+			dbt_emit_guest(0x89, HOST_EAX, REG_LO);
+			dbt_emit_guest(0x89, HOST_EDX, REG_HI);
+			return TRUE;
+		case OP_ADD:
+		case OP_ADDU:
+		case OP_SUB:
+		case OP_SUBU:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+		case OP_NOR:
+		case OP_SLT:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->rs);
+			switch (inst->op) {
+				case OP_ADD: case OP_ADDU: dbt_emit_guest(0x03, HOST_EAX, inst->rt); break;
+				case OP_SUB: case OP_SUBU: dbt_emit_guest(0x2B, HOST_EAX, inst->rt); break;
+				case OP_AND: dbt_emit_guest(0x23, HOST_EAX, inst->rt); break;
+				case OP_OR: dbt_emit_guest(0x0B, HOST_EAX, inst->rt); break;
+				case OP_XOR: dbt_emit_guest(0x33, HOST_EAX, inst->rt); break;
+				case OP_NOR:
+					dbt_emit_guest(0x0B, HOST_EAX, inst->rt);
+					dbt_emit8(0xF7); dbt_emit8(0xD0);				/* not eax */
+					break;
+				default:
+					dbt_emit_guest(0x3B, HOST_EAX, inst->rt);		/* cmp eax, [rt] */
+					dbt_emit8(0x0F); dbt_emit8(0x9C); dbt_emit8(0xC0);	/* setl al */
+					dbt_emit8(0x0F); dbt_emit8(0xB6); dbt_emit8(0xC0);	/* movzx eax, al */
+					break;
+			}
+			break;
+		case OP_ADDI:
+		case OP_ADDIU:
+		case OP_SLTI:
+		case OP_ANDI:
+		case OP_ORI:
+		case OP_XORI:
+			dbt_emit_guest(0x8B, HOST_EAX, inst->rs);
+			switch (inst->op) {
+				case OP_ANDI: dbt_emit8(0x25); dbt_emit32(inst->imm); break;
+				case OP_ORI: dbt_emit8(0x0D); dbt_emit32(inst->imm); break;
+				case OP_XORI: dbt_emit8(0x35); dbt_emit32(inst->imm); break;
+				case OP_SLTI:
+					dbt_emit8(0x3D); dbt_emit32(simm);					/* cmp eax, simm */
+					dbt_emit8(0x0F); dbt_emit8(0x9C); dbt_emit8(0xC0);	/* setl al */
+					dbt_emit8(0x0F); dbt_emit8(0xB6); dbt_emit8(0xC0);	/* movzx eax, al */
+					break;
+				default: dbt_emit8(0x05); dbt_emit32(simm); break;
+			}
+			break;
+		case OP_LUI:
+			dbt_emit8(0xB8); dbt_emit32(inst->imm << 16);
+			break;
+		case OP_LB:
+		case OP_LH:
+		case OP_LW:
+			dbt_emit_guest(0x8B, HOST_EDI, inst->rs);
+			dbt_emit8(0x81); dbt_emit8(0xC7); dbt_emit32(simm);		/* add edi, simm */
+			if (inst->op == OP_LB) {
+				dbt_emit_call(mem_read_8);
+				dbt_emit8(0x0F); dbt_emit8(0xBE); dbt_emit8(0xC0);	/* movsx eax, al */
+			}
+			else if (inst->op == OP_LH) {
+				dbt_emit_call(mem_read_16);
+				dbt_emit8(0x0F); dbt_emit8(0xBF); dbt_emit8(0xC0);	/* movsx eax, ax */
+			}
+			else {
+				dbt_emit_call(mem_read_32);
+			}
+			dbt_emit_fault_check(pc, refund);
+			if (inst->dst) {
+				dbt_emit_guest(0x89, HOST_EAX, inst->dst);
+			}
+			dbt_emit_stop_check(pc + 4, refund);
+			return TRUE;
+		case OP_SB:
+		case OP_SH:
+		case OP_SW:
+			dbt_emit_guest(0x8B, HOST_EDI, inst->rs);
+			dbt_emit8(0x81); dbt_emit8(0xC7); dbt_emit32(simm);		/* add edi, simm */
+			dbt_emit_guest(0x8B, HOST_ESI, inst->rt);
+			if (inst->op == OP_SB) {
+				dbt_emit8(0x40); dbt_emit8(0x0F); dbt_emit8(0xB6); dbt_emit8(0xF6);	/* movzx esi, sil */
+				dbt_emit_call(mem_write_8);
+			}
+			else if (inst->op == OP_SH) {
+				dbt_emit8(0x0F); dbt_emit8(0xB7); dbt_emit8(0xF6);	/* movzx esi, si */
+				dbt_emit_call(mem_write_16);
+			}
+			else {
+				dbt_emit_call(mem_write_32);
+			}
+			dbt_emit_fault_check(pc, refund);
+			dbt_emit_stop_check(pc + 4, refund);
+			return TRUE;
+		case OP_LL:
+		case OP_SC:
+			/* through mem_load/mem_store, which keep the link; SC leaves 1 (stored) in rt */
+			dbt_emit8(0x48); dbt_emit8(0xBF); dbt_emit64((uint64_t)(uintptr_t)inst);	/* movabs rdi, inst */
+			dbt_emit_guest(0x8B, HOST_ESI, inst->rs);
+			dbt_emit8(0x81); dbt_emit8(0xC6); dbt_emit32(simm);		/* add esi, simm */
+			if (inst->op == OP_LL) {
+				dbt_emit_call(mem_load);
+			}
+			else {
+				dbt_emit_guest(0x8B, HOST_EDX, inst->rt);
+				dbt_emit_call(mem_store);
+			}
+			dbt_emit_fault_check(pc, refund);
+			if (inst->dst) {
+				dbt_emit_guest(0x89, HOST_EAX, inst->dst);
+			}
+			dbt_emit_stop_check(pc + 4, refund);
+			return TRUE;
+		default:
+			/* SYSCALL and anything unimplemented are interpreted; dbt_translate ends the block before them */
+			if (!IS_IMPLEMENTED(inst->op) || ISA_INFO[inst->op].mem != MEM_NONE) {
+				return FALSE;
+			}
+			dbt_emit8(0x48); dbt_emit8(0xBF); dbt_emit64((uint64_t)(uintptr_t)inst);	/* movabs rdi, inst */
+			dbt_emit_call(dbt_helper_exec);
+			return TRUE;
+	}
+	if (inst->dst) {
+		dbt_emit_guest(0x89, HOST_EAX, inst->dst);
+	}
+	return TRUE;
+}
+
+/************************************************************/
+/* Translate the block starting at pc; NULL if its first instruction */
+/* has to be interpreted                                                                               */
+/************************************************************/
+uint8_t *dbt_translate(uint32_t pc)
+{
+	const decoded_inst_t *insts[DBT_MAX_BLOCK];
+	mem_page_t *page = PAGE_TABLE[pc >> MEM_PAGE_SHIFT];
+	uint8_t *block, *skip;
+	uint32_t n = 0, i;
+	
+	if (page == NULL || (pc & 0x3)) {
+		return NULL;
+	}
+	/* find the extent first: the budget check needs the length */
+	do {
+		insts[n] = fetch_decoded(pc + 4 * n);
+		if (!IS_IMPLEMENTED(insts[n]->op) ||
+			(ISA_INFO[insts[n]->op].mem != MEM_NONE && !IS_MEMORY(insts[n]->op) && !IS_CONTROL(insts[n]->op))) {
+			break;	/* what dbt_translate_inst turns down */
+		}
+		if (IS_CONTROL(insts[n++]->op)) {
+			break;
+		}
+	} while (n < DBT_MAX_BLOCK && ((pc + 4 * n) & MEM_PAGE_MASK) != 0);
+	if (n == 0) {
+		return NULL;
+	}
+	if (DBT_CODE_END - DBT_CODE_PTR < DBT_MAX_BLOCK_BYTES) {
+		dbt_flush();
+	}
+	page->translated = TRUE;
+	block = DBT_CODE_PTR;
+	
+	/* sub qword [rbx+budget], n; jae body; otherwise give it back and leave */
+	dbt_emit8(0x48); dbt_emit8(0x81); dbt_emit8(0x6B); dbt_emit8(offsetof(dbt_context_t, budget));
+	dbt_emit32(n);
+	dbt_emit8(0x73); dbt_emit8(0x00);
+	skip = DBT_CODE_PTR;
+	dbt_emit_exit(pc, n);
+	skip[-1] = (uint8_t)(DBT_CODE_PTR - skip);
+	
+	for (i = 0; i < n; i++) {
+		if (IS_CONTROL(insts[i]->op)) {
+			dbt_emit_control(insts[i], pc + 4 * i);
+			break;
+		}
+		if (!dbt_translate_inst(insts[i], pc + 4 * i, n - i - 1)) {
+			/* never skip it: leave for the interpreter, handing back what is left of the budget */
+			dbt_emit_exit(pc + 4 * i, n - i);
+			break;
+		}
+	}
+	if (i == n) {
+		dbt_emit_chain_exit(pc + 4 * n);
+	}
+	
+	DBT_HASH[DBT_HASH_INDEX(pc)].pc = pc;
+	DBT_HASH[DBT_HASH_INDEX(pc)].code = block;
+	DBT_BLOCKS++;
+	return block;
+}
+
+/************************************************************/
+/* Map the code cache and emit the entry/exit glue                        */
+/************************************************************/
+int dbt_init()
+{
+#ifdef DBT_SUPPORTED
+	void *mem = mmap(NULL, DBT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	
+	if (mem == MAP_FAILED) {
+		printf("Error: cannot map the translation cache\n");
+		return FALSE;
+	}
+	DBT_CODE = DBT_CODE_PTR = mem;
+	DBT_CODE_END = DBT_CODE + DBT_CODE_SIZE;
+	
+	/* entry(state, ctx, code): save what we use, pin the context, jump in */
+	DBT_ENTER = (uint32_t (*)(CPU_State *, dbt_context_t *, uint8_t *))DBT_CODE_PTR;
+	dbt_emit8(0x53);									/* push rbx */
+	dbt_emit8(0x55);									/* push rbp */
+	dbt_emit8(0x41); dbt_emit8(0x57);					/* push r15 */
+	dbt_emit8(0x49); dbt_emit8(0x89); dbt_emit8(0xFF);	/* mov r15, rdi */
+	dbt_emit8(0x48); dbt_emit8(0x89); dbt_emit8(0xF3);	/* mov rbx, rsi */
+	dbt_emit8(0xFF); dbt_emit8(0xE2);					/* jmp rdx */
+	
+	/* exit: eax = next guest pc, rdx = chainable jmp or NULL */
+	DBT_EXIT = DBT_CODE_PTR;
+	dbt_emit8(0x48); dbt_emit8(0x89); dbt_emit8(0x53); dbt_emit8(offsetof(dbt_context_t, chain_site));	/* mov [rbx+chain_site], rdx */
+	dbt_emit8(0x41); dbt_emit8(0x5F);					/* pop r15 */
+	dbt_emit8(0x5D);									/* pop rbp */
+	dbt_emit8(0x5B);									/* pop rbx */
+	dbt_emit8(0xC3);									/* ret */
+	
+	DBT_CODE_START = DBT_CODE_PTR;
+	dbt_flush();
+	return TRUE;
+#else
+	printf("Binary translation needs an x86-64 host.\n");
+	return FALSE;
+#endif
+}
+
+/************************************************************/
+/* Drop every translation. Safe from inside translated code: the    */
+/* running block stays intact and leaves at its next stop check     */
+/************************************************************/
+void dbt_flush()
+{
+	uint32_t i;
+	
+	if (DBT_CODE == NULL) {
+		return;
+	}
+	memset(DBT_HASH, 0, sizeof(DBT_HASH));
+	for (i = 0; i < NUM_TOUCHED_PAGES; i++) {
+		TOUCHED_PAGES[i]->translated = FALSE;
+	}
+	DBT_CODE_PTR = DBT_CODE_START;
+	DBT_CTX.chain_site = NULL;
+	DBT_CTX.stop = TRUE;
+}
+
+/************************************************************/
+/* Translated mode: run up to max instructions, translating blocks */
+/* on first use and interpreting what cannot be translated              */
+/************************************************************/
+uint32_t dbt_run(uint32_t max)
+{
+	uint32_t steps = 0, retired;
+	uint32_t pc;
+	uint8_t *code;
+	dbt_entry_t *entry;
+	
+	if (DBT_CODE == NULL && !dbt_init()) {
+		return functional_run(max);
+	}
+	DBT_CTX.chain_site = NULL;
+	while (steps < max && RUN_FLAG) {
+		pc = CURRENT_STATE.PC;
+		entry = &DBT_HASH[DBT_HASH_INDEX(pc)];
+		code = (entry->code != NULL && entry->pc == pc) ? entry->code : dbt_translate(pc);
+		if (code == NULL) {
+			DBT_CTX.chain_site = NULL;
+			steps += functional_run(1);
+			continue;
+		}
+		if (DBT_CTX.chain_site != NULL) {
+			/* the block we just left falls into this one: jump straight here next time */
+			retired = (uint32_t)(code - (DBT_CTX.chain_site + 4));
+			memcpy(DBT_CTX.chain_site, &retired, 4);
+		}
+		DBT_CTX.budget = max - steps;
+		DBT_CTX.stop = FALSE;
+		DBT_CTX.fault = FALSE;
+		CURRENT_STATE.PC = DBT_ENTER(&CURRENT_STATE, &DBT_CTX, code);
+		retired = (uint32_t)((max - steps) - DBT_CTX.budget);
+		INSTRUCTION_COUNT += retired;
+		steps += retired;
+		if (retired == 0 && DBT_CTX.stop == FALSE) {
+			/* fewer instructions left than the block holds: finish them in the interpreter */
+			steps += functional_run(max - steps);
+		}
+	}
+	return steps;
+}
+
+/************************************************************/
+/* export-c: the runtime every exported translation unit starts      */
+/* with. Same memory map, accessors and dump formats as the            */
+/* simulator                                                                                                   */
+/************************************************************/
+const char *EXPORT_C_RUNTIME =
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"#include <stdint.h>\n"
+	"\n"
+	"typedef struct CPU_State_Struct {\n"
+	"\tuint32_t PC;\n"
+	"\tuint32_t REGS[32];\n"
+	"\tuint32_t HI, LO;\n"
+	"} CPU_State;\n"
+	"\n"
+	"static CPU_State CURRENT_STATE;\n"
+	"static uint32_t INSTRUCTION_COUNT;\n"
+	"static int RUN_FLAG = 1;\n"
+	"static int FAULT;\n"
+	"static int IMAGE_LOADED;\n"
+	"static uint8_t *PAGE_TABLE[1 << 20];\n"
+	"\n"
+	"static uint8_t *mem_lookup(uint32_t address, int write)\n"
+	"{\n"
+	"\tuint8_t **page = &PAGE_TABLE[address >> 12];\n"
+	"\tint i;\n"
+	"\tif (*page == NULL) {\n"
+	"\t\tif (!write) {\n"
+	"\t\t\treturn NULL;\n"
+	"\t\t}\n"
+	"\t\tfor (i = 0; i < NUM_MEM_REGION; i++) {\n"
+	"\t\t\tif (address >= MEM_REGIONS[i][0] && address <= MEM_REGIONS[i][1]) {\n"
+	"\t\t\t\tbreak;\n"
+	"\t\t\t}\n"
+	"\t\t}\n"
+	"\t\tif (i == NUM_MEM_REGION || (*page = calloc(1, 4096)) == NULL) {\n"
+	"\t\t\treturn NULL;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\tif (write && IMAGE_LOADED && address >= ENTRY_PC && address < END_PC) {\n"
+	"\t\tprintf(\"Store into the program text at 0x%08x: exported code cannot follow it\\n\", address);\n"
+	"\t\tRUN_FLAG = 0;\n"
+	"\t}\n"
+	"\treturn *page + (address & 0xFFF);\n"
+	"}\n"
+	"\n"
+	"static void mem_unaligned(const char *access, int width, uint32_t address)\n"
+	"{\n"
+	"\tprintf(\"Address error: unaligned %d-bit %s at 0x%08x\\n\", width, access, address);\n"
+	"\tRUN_FLAG = 0;\n"
+	"\tFAULT = 1;\n"
+	"}\n"
+	"\n"
+	"static inline uint8_t mem_read_8(uint32_t address)\n"
+	"{\n"
+	"\tuint8_t *p = mem_lookup(address, 0);\n"
+	"\treturn p ? p[0] : 0;\n"
+	"}\n"
+	"\n"
+	"static inline uint16_t mem_read_16(uint32_t address)\n"
+	"{\n"
+	"\tuint8_t *p;\n"
+	"\tif (address & 1) {\n"
+	"\t\tmem_unaligned(\"read\", 16, address);\n"
+	"\t\treturn 0;\n"
+	"\t}\n"
+	"\tp = mem_lookup(address, 0);\n"
+	"\treturn p ? (uint16_t)(p[0] | (p[1] << 8)) : 0;\n"
+	"}\n"
+	"\n"
+	"static inline uint32_t mem_read_32(uint32_t address)\n"
+	"{\n"
+	"\tuint8_t *p;\n"
+	"\tif (address & 3) {\n"
+	"\t\tmem_unaligned(\"read\", 32, address);\n"
+	"\t\treturn 0;\n"
+	"\t}\n"
+	"\tp = mem_lookup(address, 0);\n"
+	"\treturn p ? (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24) : 0;\n"
+	"}\n"
+	"\n"
+	"static inline void mem_write_8(uint32_t address, uint8_t value)\n"
+	"{\n"
+	"\tuint8_t *p = mem_lookup(address, 1);\n"
+	"\tif (p != NULL) {\n"
+	"\t\tp[0] = value;\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"static inline void mem_write_16(uint32_t address, uint16_t value)\n"
+	"{\n"
+	"\tuint8_t *p;\n"
+	"\tif (address & 1) {\n"
+	"\t\tmem_unaligned(\"write\", 16, address);\n"
+	"\t\treturn;\n"
+	"\t}\n"
+	"\tif ((p = mem_lookup(address, 1)) != NULL) {\n"
+	"\t\tp[0] = value; p[1] = value >> 8;\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"static inline void mem_write_32(uint32_t address, uint32_t value)\n"
+	"{\n"
+	"\tuint8_t *p;\n"
+	"\tif (address & 3) {\n"
+	"\t\tmem_unaligned(\"write\", 32, address);\n"
+	"\t\treturn;\n"
+	"\t}\n"
+	"\tif ((p = mem_lookup(address, 1)) != NULL) {\n"
+	"\t\tp[0] = value; p[1] = value >> 8; p[2] = value >> 16; p[3] = value >> 24;\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"/* divide by zero leaves quotient 0 and remainder a, as in the simulator */\n"
+	"static inline uint64_t div_signed(uint32_t a, uint32_t b)\n"
+	"{\n"
+	"\tif (b == 0) {\n"
+	"\t\treturn (uint64_t)a << 32;\n"
+	"\t}\n"
+	"\tif (a == 0x80000000 && b == 0xFFFFFFFF) {\n"
+	"\t\treturn 0x80000000;\n"
+	"\t}\n"
+	"\treturn ((uint64_t)(uint32_t)((int32_t)a % (int32_t)b) << 32) | (uint32_t)((int32_t)a / (int32_t)b);\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t div_unsigned(uint32_t a, uint32_t b)\n"
+	"{\n"
+	"\tif (b == 0) {\n"
+	"\t\treturn (uint64_t)a << 32;\n"
+	"\t}\n"
+	"\treturn ((uint64_t)(a % b) << 32) | (a / b);\n"
+	"}\n"
+	"\n"
+	"static void rdump(void)\n"
+	"{\n"
+	"\tint i;\n"
+	"\tprintf(\"-------------------------------------\\n\");\n"
+	"\tprintf(\"Dumping Register Content\\n\");\n"
+	"\tprintf(\"-------------------------------------\\n\");\n"
+	"\tprintf(\"# Instructions Executed\\t: %u\\n\", INSTRUCTION_COUNT);\n"
+	"\tprintf(\"# Cycles Executed\\t: %u\\n\", INSTRUCTION_COUNT);\n"
+	"\tprintf(\"PC\\t: 0x%08x\\n\", CURRENT_STATE.PC);\n"
+	"\tprintf(\"-------------------------------------\\n\");\n"
+	"\tprintf(\"[Register]\\t[Value]\\n\");\n"
+	"\tprintf(\"-------------------------------------\\n\");\n"
+	"\tfor (i = 0; i < 32; i++) {\n"
+	"\t\tprintf(\"[R%d]\\t: 0x%08x\\n\", i, CURRENT_STATE.REGS[i]);\n"
+	"\t}\n"
+	"\tprintf(\"-------------------------------------\\n\");\n"
+	"\tprintf(\"[HI]\\t: 0x%08x\\n\", CURRENT_STATE.HI);\n"
+	"\tprintf(\"[LO]\\t: 0x%08x\\n\", CURRENT_STATE.LO);\n"
+	"\tprintf(\"-------------------------------------\\n\");\n"
+	"}\n"
+	"\n"
+	"static void mdump(uint32_t start, uint32_t stop)\n"
+	"{\n"
+	"\tuint32_t address;\n"
+	"\tprintf(\"-------------------------------------------------------------\\n\");\n"
+	"\tprintf(\"Memory content [0x%08x..0x%08x] :\\n\", start, stop);\n"
+	"\tprintf(\"-------------------------------------------------------------\\n\");\n"
+	"\tprintf(\"\\t[Address in Hex (Dec) ]\\t[Value]\\n\");\n"
+	"\tstart &= ~0x3;\n"
+	"\tfor (address = start; address <= stop; address += 4) {\n"
+	"\t\tprintf(\"\\t0x%08x (%d) :\\t0x%08x\\n\", address, address, mem_read_32(address));\n"
+	"\t}\n"
+	"\tprintf(\"\\n\");\n"
+	"}\n"
+	"\n"
+	"static void run(void);\n"
+	"\n"
+	"/* usage: <program> [start stop]... -- rdump, then mdump each range */\n"
+	"int main(int argc, char *argv[])\n"
+	"{\n"
+	"\tuint32_t i;\n"
+	"\tint arg;\n"
+	"\tfor (i = 0; i < sizeof(IMAGE) / sizeof(IMAGE[0]); i++) {\n"
+	"\t\tmem_write_32(IMAGE[i][0], IMAGE[i][1]);\n"
+	"\t}\n"
+	"\tIMAGE_LOADED = 1;\n"
+	"\trun();\n"
+	"\trdump();\n"
+	"\tfor (arg = 1; arg + 1 < argc; arg += 2) {\n"
+	"\t\tmdump(strtoul(argv[arg], NULL, 16), strtoul(argv[arg + 1], NULL, 16));\n"
+	"\t}\n"
+	"\treturn 0;\n"
+	"}\n"
+	"\n";
+
+/************************************************************/
+/* export-c: C text for the ISA table's operand, memory and             */
+/* writeback columns, mirroring the isa_step_ functions                           */
+/************************************************************/
+const char *export_c_operand(uint8_t operand, const decoded_inst_t *inst, char *buf)
+{
+	switch (operand) {
+		case OPND_RS: sprintf(buf, "R[%u]", inst->rs); return buf;
+		case OPND_RT: sprintf(buf, "R[%u]", inst->rt); return buf;
+		case OPND_RD: sprintf(buf, "R[%u]", inst->rd); return buf;
+		case OPND_HI: return "CURRENT_STATE.HI";
+		case OPND_LO: return "CURRENT_STATE.LO";
+		case OPND_V0: return "R[2]";
+		default: return "0";
+	}
+}
+
+const char *EXPORT_C_MEM_STEP[] = {
+	[MEM_NONE] = "",
+	[MEM_LB] = "\tr = (uint32_t)(int32_t)(int8_t)mem_read_8(r);\n",
+	[MEM_LH] = "\tr = (uint32_t)(int32_t)(int16_t)mem_read_16(r);\n",
+	[MEM_LW] = "\tr = mem_read_32(r);\n",
+	[MEM_LL] = "\tr = mem_read_32(r);\n",
+	[MEM_SB] = "\tmem_write_8(r, b & 0xFF);\n",
+	[MEM_SH] = "\tmem_write_16(r, b & 0xFFFF);\n",
+	[MEM_SW] = "\tmem_write_32(r, b);\n",
+	[MEM_SC] = "\tmem_write_32(r, b);\n\tr = 1;\n",
+	[MEM_SYSCALL] = "\tif (a == 0xa) { RUN_FLAG = 0; }\n",
+	/* control steps come after the count, in export_c_inst */
+	[MEM_BRANCH] = "",
+	[MEM_JUMP] = "",
+	[MEM_JUMPR] = "",
+};
+
+/************************************************************/
+/* export-c: one static inline function per implemented op, made   */
+/* from the ISA table's exec column                                                      */
+/************************************************************/
+void export_c_ops(FILE *fp)
+{
+	int op;
+	
+	for (op = OP_BUBBLE + 1; op < NUM_OPS; op++) {
+		fprintf(fp, "static inline uint32_t op_%s(uint32_t pc, uint32_t a, uint32_t b, uint32_t sa, uint32_t imm, uint32_t simm, uint64_t *hilo_out)\n", ISA_INFO[op].name);
+		fprintf(fp, "{\n\tuint32_t r = 0;\n\tuint64_t hilo = 0;\n");
+		fprintf(fp, "\t%s;\n", ISA_INFO[op].exec);
+		fprintf(fp, "\t*hilo_out = hilo;\n\treturn r;\n}\n\n");
+	}
+}
+
+/************************************************************/
+/* export-c: go to target from inside the chunk [chunk, end): a goto */
+/* when it is there, otherwise back to the run loop                          */
+/************************************************************/
+int export_c_local(uint32_t target, uint32_t chunk, uint32_t end)
+{
+	return target >= chunk && target < end && target < chunk + MEM_PAGE_SIZE && (target & 0x3) == 0;
+}
+
+void export_c_goto(FILE *fp, uint32_t target, uint32_t chunk, uint32_t end)
+{
+	if (export_c_local(target, chunk, end)) {
+		fprintf(fp, "goto L_%08x;", target);
+	}
+	else {
+		fprintf(fp, "return 0x%08xu;", target);
+	}
+}
+
+/************************************************************/
+/* export-c: C statements for one instruction. R is the register file; */
+/* after anything that can stop the machine the chunk returns the  */
+/* PC to stop at. Branches and jumps end in a goto or return, see   */
+/* export_c_goto                                                                                          */
+/************************************************************/
+void export_c_inst(FILE *fp, const decoded_inst_t *inst, uint32_t pc, uint32_t chunk, uint32_t end)
+{
+	const isa_info_t *info = &ISA_INFO[inst->op];
+	char a[16], b[16];
+	
+	if (!IS_IMPLEMENTED(inst->op)) {
+		fprintf(fp, "\tprintf(\"Instruction at 0x%%x is not implemented!\\n\", 0x%08xu);\n", pc);
+		return;
+	}
+	if (inst->op != OP_NOP) {
+		fprintf(fp, "\ta = %s; b = %s;\n", export_c_operand(info->srcA, inst, a), export_c_operand(info->srcB, inst, b));
+		fprintf(fp, "\tr = op_%s(0x%08xu, a, b, %uu, 0x%04xu, 0x%08xu, &hilo);\n", info->name, pc, inst->sa, inst->imm,
+				(uint32_t)(int32_t)(int16_t)inst->imm);
+		fputs(EXPORT_C_MEM_STEP[info->mem], fp);
+		if (IS_MEMORY(inst->op)) {
+			/* an address error stops at the access, nothing written or counted */
+			fprintf(fp, "\tif (FAULT) { return 0x%08xu; }\n", pc);
+		}
+		switch (info->dst) {
+			case OPND_RT:
+			case OPND_RD:
+			case OPND_RA:
+				fprintf(fp, "\tR[%u] = r;\n\tR[0] = 0;\n", inst->dst);
 				break;
-			case 0x29: //SH
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-				EX_MEM.B = IF_EX.B;
-                EX_MEM.RegisterRd = 0;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
+			case OPND_HI:
+				fprintf(fp, "\tCURRENT_STATE.HI = hilo >> 32;\n");
 				break;
-			case 0x2B: //SW
-				EX_MEM.ALUOutput = IF_EX.A + ( (IF_EX.imm & 0x8000) > 0 ? (IF_EX.imm | 0xFFFF0000) : (IF_EX.imm & 0x0000FFFF));
-				EX_MEM.B = IF_EX.B;
-                EX_MEM.RegisterRd = 0;
-                EX_MEM.RegWrite = IF_EX.RegWrite;
-				//print_instruction(CURRENT_STATE.PC);
+			case OPND_LO:
+				fprintf(fp, "\tCURRENT_STATE.LO = (uint32_t)hilo;\n");
 				break;
-			default:
-				// put more things here
-				printf("EX at 0x%x is not implemented!\n", CURRENT_STATE.PC);
+			case OPND_HILO:
+				fprintf(fp, "\tCURRENT_STATE.HI = hilo >> 32;\n\tCURRENT_STATE.LO = (uint32_t)hilo;\n");
 				break;
-		  }
-	   }
-    }
+		}
+	}
+	fprintf(fp, "\tINSTRUCTION_COUNT++;\n");
+	switch (info->mem) {
+		case MEM_NONE:
+			break;
+		case MEM_BRANCH:
+			fprintf(fp, "\tif (r) { ");
+			export_c_goto(fp, BRANCH_TARGET(pc, inst->imm), chunk, end);
+			fprintf(fp, " }\n");
+			break;
+		case MEM_JUMP:
+			fprintf(fp, "\t");
+			export_c_goto(fp, JUMP_TARGET(pc, inst->target), chunk, end);
+			fprintf(fp, "\n");
+			break;
+		case MEM_JUMPR:
+			fprintf(fp, "\treturn a;\n");
+			break;
+		default:
+			fprintf(fp, "\tif (!RUN_FLAG) { return 0x%08xu; }\n", pc + 4);
+			break;
+	}
+}
+
+/************************************************************/
+/* Write the loaded program out as a self-contained C program     */
+/* that runs it from the post-load state and prints rdump(). The     */
+/* text becomes one function per page so -O3 stays quick; a chunk    */
+/* is entered at any of its instructions through a switch                 */
+/************************************************************/
+void export_c(const char *path)
+{
+	FILE *fp;
+	uint32_t i, j, word, pc, end, chunk, target;
+	mem_page_t *page;
+	const uint8_t *bytes;
+	const decoded_inst_t *inst;
+	uint8_t label[MEM_PAGE_SIZE / 4];
+	
+	if (PROGRAM_SIZE == 0) {
+		printf("Error: no program loaded\n");
+		return;
+	}
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("Error: Can't open %s for writing\n", path);
+		return;
+	}
+	fprintf(fp, "/* %s, exported by mu-mips export-c. Build with cc -O3 */\n", prog_file);
+	fprintf(fp, "#include <stdint.h>\n\n");
+	fprintf(fp, "#define NUM_MEM_REGION %d\n", NUM_MEM_REGION);
+	fprintf(fp, "static const uint32_t MEM_REGIONS[NUM_MEM_REGION][2] = {\n");
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		fprintf(fp, "\t{ 0x%08xu, 0x%08xu },\n", MEM_REGIONS[i].begin, MEM_REGIONS[i].end);
+	}
+	fprintf(fp, "};\n\n");
+	
+	/* memory as load_program left it (the snapshot, if reset has one) */
+	fprintf(fp, "static const uint32_t IMAGE[][2] = {\n");
+	for (i = 0; i < NUM_TOUCHED_PAGES; i++) {
+		page = TOUCHED_PAGES[i];
+		bytes = SNAPSHOT_TAKEN ? page->snapshot : page->data;
+		if (bytes == NULL) {
+			continue;
+		}
+		for (j = 0; j < MEM_PAGE_SIZE; j += 4) {
+			word = bytes[j] | (bytes[j + 1] << 8) | (bytes[j + 2] << 16) | ((uint32_t)bytes[j + 3] << 24);
+			if (word != 0) {
+				fprintf(fp, "\t{ 0x%08xu, 0x%08xu },\n", (page->vpn << MEM_PAGE_SHIFT) + j, word);
+			}
+		}
+	}
+	fprintf(fp, "};\n\n");
+	end = MEM_TEXT_BEGIN + 4 * PROGRAM_SIZE;
+	fprintf(fp, "#define ENTRY_PC 0x%08xu\n", MEM_TEXT_BEGIN);
+	fprintf(fp, "#define END_PC 0x%08xu\n\n", end);
+	fputs(EXPORT_C_RUNTIME, fp);
+	export_c_ops(fp);
+	
+	for (chunk = MEM_TEXT_BEGIN; chunk < end; chunk += MEM_PAGE_SIZE) {
+		fprintf(fp, "static uint32_t run_%08x(uint32_t pc)\n{\n", chunk);
+		fprintf(fp, "\tuint32_t *R = CURRENT_STATE.REGS;\n");
+		fprintf(fp, "\tuint32_t a, b, r;\n\tuint64_t hilo;\n");
+		fprintf(fp, "\t(void)a; (void)b; (void)r; (void)hilo;\n\n");
+		/* labels only where a branch or jump in this chunk lands */
+		memset(label, 0, sizeof(label));
+		for (pc = chunk; pc < end && pc < chunk + MEM_PAGE_SIZE; pc += 4) {
+			inst = fetch_decoded(pc);
+			if (ISA_INFO[inst->op].mem == MEM_BRANCH || ISA_INFO[inst->op].mem == MEM_JUMP) {
+				target = ISA_INFO[inst->op].mem == MEM_BRANCH ? BRANCH_TARGET(pc, inst->imm) : JUMP_TARGET(pc, inst->target);
+				if (export_c_local(target, chunk, end)) {
+					label[(target - chunk) >> 2] = TRUE;
+				}
+			}
+		}
+		fprintf(fp, "\tswitch (pc) {\n");
+		for (pc = chunk; pc < end && pc < chunk + MEM_PAGE_SIZE; pc += 4) {
+			fprintf(fp, "\tcase 0x%08xu:\n", pc);
+			if (label[(pc - chunk) >> 2]) {
+				fprintf(fp, "\tL_%08x:\n", pc);
+			}
+			fprintf(fp, "\t/* 0x%08x: 0x%08x */\n", pc, fetch_decoded(pc)->raw);
+			export_c_inst(fp, fetch_decoded(pc), pc, chunk, end);
+		}
+		fprintf(fp, "\t}\n");
+		fprintf(fp, "\treturn 0x%08xu;\n}\n\n", pc);
+	}
+	fprintf(fp, "static uint32_t (*const CHUNKS[])(uint32_t) = {\n");
+	for (chunk = MEM_TEXT_BEGIN; chunk < end; chunk += MEM_PAGE_SIZE) {
+		fprintf(fp, "\trun_%08x,\n", chunk);
+	}
+	fprintf(fp, "};\n\n");
+	
+	fprintf(fp, "static void run(void)\n{\n");
+	fprintf(fp, "\tuint32_t pc = ENTRY_PC;\n");
+	fprintf(fp, "\twhile (RUN_FLAG) {\n");
+	/* the simulator would go on through zeroed memory (NOPs) forever */
+	fprintf(fp, "\t\tif (pc < ENTRY_PC || pc >= END_PC) {\n");
+	fprintf(fp, "\t\t\tprintf(\"Ran past the end of the program at 0x%%08x\\n\", pc);\n");
+	fprintf(fp, "\t\t\tbreak;\n");
+	fprintf(fp, "\t\t}\n");
+	/* a jump register to an odd address fetches a NOP and stops, as in the simulator */
+	fprintf(fp, "\t\tif (pc & 0x3) {\n");
+	fprintf(fp, "\t\t\tmem_unaligned(\"fetch\", 32, pc);\n");
+	fprintf(fp, "\t\t\tINSTRUCTION_COUNT++;\n");
+	fprintf(fp, "\t\t\tpc += 4;\n");
+	fprintf(fp, "\t\t\tbreak;\n");
+	fprintf(fp, "\t\t}\n");
+	fprintf(fp, "\t\tpc = CHUNKS[(pc - ENTRY_PC) >> 12](pc);\n");
+	fprintf(fp, "\t}\n");
+	fprintf(fp, "\tCURRENT_STATE.PC = pc;\n");
+	fprintf(fp, "}\n");
+	fclose(fp);
+	printf("Exported %u instructions to %s\n", PROGRAM_SIZE, path);
+}
+
+/************************************************************/
+/* Run the loaded program from its post-load state on one engine   */
+/* (SIM_PIPELINE stands for functional_step), at most limit           */
+/* instructions. Memory is rolled back first so every repetition   */
+/* sees the same data                                                                                 */ 
+/************************************************************/
+uint64_t bench_one_run(const CPU_State *start, int engine, uint32_t limit, double *elapsed)
+{
+	uint32_t before;
+	double t0;
+	
+	mem_restore_snapshot();
+	CURRENT_STATE = *start;
+	RUN_FLAG = TRUE;
+	before = INSTRUCTION_COUNT;
+	t0 = now_seconds();
+	if (engine == SIM_FUNCTIONAL) {
+		functional_run(limit);
+	}
+	else if (engine == SIM_TRANSLATED) {
+		dbt_run(limit);
+	}
+	else {
+		while (RUN_FLAG && INSTRUCTION_COUNT - before < limit) {
+			functional_step();
+		}
+	}
+	*elapsed += now_seconds() - t0;
+	return INSTRUCTION_COUNT - before;
+}
+
+/************************************************************/
+/* Host MIPS of the switch-based functional_step() against the      */
+/* threaded functional_run() and the translated dbt_run() on the     */
+/* loaded program, reps times each                                                         */
+/************************************************************/
+void bench_dispatch(uint32_t reps) {
+	CPU_State saved = CURRENT_STATE, start;
+	uint32_t saved_count = INSTRUCTION_COUNT;
+	int saved_run = RUN_FLAG;
+	uint64_t n_switch = 0, n_threaded = 0, n_dbt = 0;
+	double t_switch = 0, t_threaded = 0, t_dbt = 0;
+	CPU_State after;
+	uint32_t i;
+
+	if (reps == 0) {
+		return;
+	}
+	if (!SNAPSHOT_TAKEN) {
+		printf("Error: no program loaded\n");
+		return;
+	}
+	memset(&start, 0, sizeof(start));
+	start.PC = MEM_TEXT_BEGIN;
+	for (i = 0; i < reps; i++) {
+		n_switch += bench_one_run(&start, SIM_PIPELINE, 100000000, &t_switch);
+		after = CURRENT_STATE;
+		n_threaded += bench_one_run(&start, SIM_FUNCTIONAL, 100000000, &t_threaded);
+		if (memcmp(&after, &CURRENT_STATE, sizeof(after)) != 0) {
+			printf("Warning: threaded engine disagrees with functional_step\n");
+		}
+		n_dbt += bench_one_run(&start, SIM_TRANSLATED, 100000000, &t_dbt);
+		if (memcmp(&after, &CURRENT_STATE, sizeof(after)) != 0) {
+			printf("Warning: translated code disagrees with functional_step\n");
+		}
+	}
+
+	/* leave the machine where the user had it (memory as after reset) */
+	mem_restore_snapshot();
+	CURRENT_STATE = saved;
+	NEXT_STATE = saved;
+	INSTRUCTION_COUNT = saved_count;
+	RUN_FLAG = saved_run;
+
+	printf("-------------------------------------\n");
+	printf("Dispatch benchmark (%u runs, %llu instructions each)\n", reps, (unsigned long long)(n_threaded / reps));
+	printf("-------------------------------------\n");
+	printf("switch (functional_step)\t: %8.2f MIPS\n", n_switch / t_switch / 1e6);
+#ifdef THREADED_DISPATCH
+	printf("threaded (computed goto)\t: %8.2f MIPS\n", n_threaded / t_threaded / 1e6);
+#else
+	printf("threaded (switch fallback)\t: %8.2f MIPS\n", n_threaded / t_threaded / 1e6);
+#endif
+	printf("translated (%u blocks)\t\t: %8.2f MIPS\n", DBT_BLOCKS, n_dbt / t_dbt / 1e6);
+	printf("-------------------------------------\n");
+}
+
+
+/************************************************************/
+/* Batch mode. The loaded program runs on BATCH.lanes inputs in   */
+/* lockstep: every lane is at the same pc, so each decoded           */
+/* instruction is one loop over the lanes, BATCH_CHUNK at a time,    */
+/* that the compiler turns into SSE/AVX code. Memory is shared       */
+/* until lanes store different things; from then on each lane keeps */
+/* its own writes and memory ops go lane by lane                             */
+/************************************************************/
+
+/************************************************************/
+/* The word at address in an overlay, NULL if it was never written    */
+/************************************************************/
+uint32_t *batch_overlay_find(const batch_overlay_t *overlay, uint32_t address)
+{
+	uint32_t i;
+
+	if (overlay->size == 0) {
+		return NULL;
+	}
+	i = ((address >> 2) * 2654435761u) & (overlay->size - 1);
+	while (overlay->words[i].key != 0) {
+		if (overlay->words[i].key == (address | 1)) {
+			return &overlay->words[i].value;
+		}
+		i = (i + 1) & (overlay->size - 1);
+	}
+	return NULL;
+}
+
+/************************************************************/
+/* Set a word in an overlay; TRUE if it was not there before          */
+/************************************************************/
+int batch_overlay_put(batch_overlay_t *overlay, uint32_t address, uint32_t value)
+{
+	uint32_t *slot = batch_overlay_find(overlay, address);
+	batch_word_t *old = overlay->words;
+	uint32_t i, old_size = overlay->size;
+
+	if (slot != NULL) {
+		*slot = value;
+		return FALSE;
+	}
+	if (2 * (overlay->used + 1) > overlay->size) {
+		/* keep it at most half full */
+		overlay->size = old_size ? old_size * 2 : 64;
+		overlay->words = calloc(overlay->size, sizeof(batch_word_t));
+		if (overlay->words == NULL) {
+			printf("Error: out of memory in batch mode\n");
+			exit(-1);
+		}
+		overlay->used = 0;
+		for (i = 0; i < old_size; i++) {
+			if (old[i].key != 0) {
+				batch_overlay_put(overlay, old[i].key & ~1u, old[i].value);
+			}
+		}
+		free(old);
+	}
+	i = ((address >> 2) * 2654435761u) & (overlay->size - 1);
+	while (overlay->words[i].key != 0) {
+		i = (i + 1) & (overlay->size - 1);
+	}
+	overlay->words[i].key = address | 1;
+	overlay->words[i].value = value;
+	overlay->used++;
+	return TRUE;
+}
+
+/************************************************************/
+/* Word-aligned read as lane sees it: its own writes, then the       */
+/* shared ones, then memory. lane == BATCH.lanes reads the shared view */
+/************************************************************/
+uint32_t batch_read_word(uint32_t lane, uint32_t address)
+{
+	uint32_t *word;
+
+	if (lane < BATCH.lanes && (word = batch_overlay_find(&BATCH.overlays[lane], address)) != NULL) {
+		return *word;
+	}
+	if ((word = batch_overlay_find(&BATCH.overlays[BATCH.lanes], address)) != NULL) {
+		return *word;
+	}
+	return mem_read_32(address);
+}
+
+/************************************************************/
+/* Sign-extended load of 1, 2 or 4 bytes as lane sees memory         */
+/************************************************************/
+uint32_t batch_read(uint32_t lane, uint32_t address, int bytes)
+{
+	uint32_t word = batch_read_word(lane, address & ~3u) >> ((address & 3) * 8);
+
+	if (bytes == 1) {
+		return (uint32_t)(int32_t)(int8_t)word;
+	}
+	if (bytes == 2) {
+		return (uint32_t)(int32_t)(int16_t)word;
+	}
+	return word;
+}
+
+/************************************************************/
+/* Store 1, 2 or 4 bytes into lane's overlay (BATCH.lanes: the shared */
+/* one); TRUE if the overlay gained a word                                           */
+/************************************************************/
+int batch_write(uint32_t lane, uint32_t address, uint32_t value, int bytes)
+{
+	uint32_t shift = (address & 3) * 8;
+	uint32_t mask = (bytes == 4 ? 0xFFFFFFFF : (1u << (8 * bytes)) - 1) << shift;
+	uint32_t word = batch_read_word(lane, address & ~3u);
+
+	word = (word & ~mask) | ((value << shift) & mask);
+	return batch_overlay_put(&BATCH.overlays[lane], address & ~3u, word);
+}
+
+/************************************************************/
+/* Take a lane out of the run; batch_run records its final state       */
+/* once the current op has written back                                              */
+/************************************************************/
+void batch_stop_lane(uint32_t lane, int status, const char *why, uint32_t address)
+{
+	if (why != NULL) {
+		printf("Lane %u: %s at 0x%08x\n", lane, why, address);
+	}
+	BATCH.status[lane] = status;
+	BATCH.running--;
+	BATCH.stopping++;
+}
+
+/************************************************************/
+/* The access of the op at pc faulted on lane: it is not made, and    */
+/* the lane stops at it with nothing written back or retired             */
+/************************************************************/
+void batch_fault_lane(uint32_t lane, uint32_t pc, const char *why, uint32_t address)
+{
+	batch_stop_lane(lane, BATCH_FAULTED, why, address);
+	BATCH.mask[lane] = 0;
+	BATCH.pc[lane] = pc;
+	batch_record_lane(lane);
+}
+
+/************************************************************/
+/* First lane of the current op if all its lanes have the same row   */
+/* value (and the same row2 value, unless row2 is NULL), else           */
+/* BATCH.lanes                                                                                               */
+/************************************************************/
+uint32_t batch_uniform(const uint32_t *row, const uint32_t *row2)
+{
+	uint32_t lane, first = BATCH.lanes;
+
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (!BATCH.mask[lane]) {
+			continue;
+		}
+		if (first == BATCH.lanes) {
+			first = lane;
+		}
+		else if (row[lane] != row[first] || (row2 != NULL && row2[lane] != row2[first])) {
+			return BATCH.lanes;
+		}
+	}
+	return first;
+}
+
+/************************************************************/
+/* Memory step of a load at pc: BATCH.result holds each lane's        */
+/* address and gets the loaded value                                                */
+/************************************************************/
+void batch_load(uint32_t pc, int bytes)
+{
+	uint32_t *r = BATCH.result;
+	uint32_t lane, value;
+	uint32_t first = BATCH.private_words == 0 ? batch_uniform(r, NULL) : BATCH.lanes;
+
+	if (first < BATCH.lanes && (r[first] & (bytes - 1)) == 0) {
+		BATCH.uniform_ops++;
+		value = batch_read(BATCH.lanes, r[first], bytes);
+		for (lane = 0; lane < BATCH.width; lane++) {
+			r[lane] = value;
+		}
+		return;
+	}
+	BATCH.scalar_ops++;
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (!BATCH.mask[lane]) {
+			continue;
+		}
+		if (r[lane] & (bytes - 1)) {
+			batch_fault_lane(lane, pc, "address error: unaligned load", r[lane]);
+			continue;
+		}
+		r[lane] = batch_read(lane, r[lane], bytes);
+	}
+}
+
+/************************************************************/
+/* Memory step of a store at pc: BATCH.result holds each lane's      */
+/* address. The program text is read-only here, lanes share one     */
+/* decoding. Only a store every running lane makes can go to the    */
+/* shared view                                                                                           */
+/************************************************************/
+void batch_store(uint32_t pc, const uint32_t *values, int bytes)
+{
+	uint32_t *r = BATCH.result;
+	uint32_t lane, address;
+	uint32_t first = BATCH.private_words == 0 && BATCH.converged ? batch_uniform(r, values) : BATCH.lanes;
+
+	if (first < BATCH.lanes && (r[first] & (bytes - 1)) == 0 &&
+		(r[first] < MEM_TEXT_BEGIN || r[first] >= MEM_TEXT_BEGIN + PROGRAM_SIZE * 4)) {
+		BATCH.uniform_ops++;
+		if (mem_region(r[first]) >= 0) {
+			batch_write(BATCH.lanes, r[first], values[first], bytes);
+		}
+		return;
+	}
+	BATCH.scalar_ops++;
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (!BATCH.mask[lane]) {
+			continue;
+		}
+		address = r[lane];
+		if (address & (bytes - 1)) {
+			batch_fault_lane(lane, pc, "address error: unaligned store", address);
+			continue;
+		}
+		if (address >= MEM_TEXT_BEGIN && address < MEM_TEXT_BEGIN + PROGRAM_SIZE * 4) {
+			batch_fault_lane(lane, pc, "store into the program text", address);
+			continue;
+		}
+		if (mem_region(address) < 0) {
+			/* dropped, as mem_write_* would */
+			continue;
+		}
+		if (batch_write(lane, address, values[lane], bytes)) {
+			BATCH.private_words++;
+		}
+	}
+}
+
+/************************************************************/
+/* SYSCALL: lanes with $v0 = 10 exit                                                       */
+/************************************************************/
+void batch_syscall(const uint32_t *v0)
+{
+	uint32_t lane;
+
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (BATCH.mask[lane] && v0[lane] == 0xa) {
+			batch_stop_lane(lane, BATCH_EXITED, NULL, 0);
+		}
+	}
+}
+
+/************************************************************/
+/* Branch/jump step: lanes of the current op whose cond is nonzero   */
+/* (all of them if cond is NULL) go to taken, the others to fall       */
+/************************************************************/
+void batch_branch(const uint32_t *cond, uint32_t taken, uint32_t fall)
+{
+	uint32_t lane;
+
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (BATCH.mask[lane]) {
+			BATCH.pc[lane] = (cond == NULL || cond[lane]) ? taken : fall;
+		}
+	}
+}
+
+/************************************************************/
+/* JR/JALR step: each lane of the current op goes to its own target   */
+/************************************************************/
+void batch_jump_register(const uint32_t *targets)
+{
+	uint32_t lane;
+
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (BATCH.mask[lane]) {
+			BATCH.pc[lane] = targets[lane];
+		}
+	}
+}
+
+/************************************************************/
+/* One function per op, generated from the ISA table: the exec        */
+/* column runs lane by lane in fixed BATCH_CHUNK groups so it            */
+/* vectorizes, then the memory step, then writeback of whole rows   */
+/************************************************************/
+#define BATCH_SRC_NONE BATCH.zero
+#define BATCH_SRC_RS BATCH.regs[inst->rs]
+#define BATCH_SRC_RT BATCH.regs[inst->rt]
+#define BATCH_SRC_RD BATCH.regs[inst->rd]
+#define BATCH_SRC_HI BATCH.regs[REG_HI]
+#define BATCH_SRC_LO BATCH.regs[REG_LO]
+#define BATCH_SRC_V0 BATCH.regs[2]
+#define BATCH_STEP_NONE
+#define BATCH_STEP_LB batch_load(pc, 1);
+#define BATCH_STEP_LH batch_load(pc, 2);
+#define BATCH_STEP_LW batch_load(pc, 4);
+#define BATCH_STEP_LL batch_load(pc, 4);
+#define BATCH_STEP_SB batch_store(pc, rowB, 1);
+#define BATCH_STEP_SH batch_store(pc, rowB, 2);
+#define BATCH_STEP_SW batch_store(pc, rowB, 4);
+/* every lane is a core of its own, so its link always holds */
+#define BATCH_STEP_SC batch_store(pc, rowB, 4); for (lane = 0; lane < BATCH.width; lane++) { rowR[lane] = TRUE; }
+#define BATCH_STEP_SYSCALL batch_syscall(rowA);
+#define BATCH_STEP_BRANCH batch_branch(rowR, BRANCH_TARGET(pc, imm), pc + 4);
+#define BATCH_STEP_JUMP batch_branch(NULL, JUMP_TARGET(pc, inst->target), 0);
+#define BATCH_STEP_JUMPR batch_jump_register(rowA);
+/* whether the op's result is hilo rather than r */
+#define BATCH_HILO_NONE 0
+#define BATCH_HILO_RT 0
+#define BATCH_HILO_RD 0
+#define BATCH_HILO_RA 0
+#define BATCH_HILO_HI 1
+#define BATCH_HILO_LO 1
+#define BATCH_HILO_HILO 1
+/* only the lanes of the current op write back */
+#define BATCH_MERGE(dst, value) (dst) = ((value) & BATCH.mask[lane]) | ((dst) & ~BATCH.mask[lane])
+#define BATCH_WB_NONE
+#define BATCH_WB_RT if (inst->dst != 0) { for (lane = 0; lane < BATCH.width; lane++) { BATCH_MERGE(BATCH.regs[inst->dst][lane], rowR[lane]); } }
+#define BATCH_WB_RD BATCH_WB_RT
+#define BATCH_WB_RA BATCH_WB_RT
+#define BATCH_WB_HI for (lane = 0; lane < BATCH.width; lane++) { BATCH_MERGE(BATCH.regs[REG_HI][lane], (uint32_t)(rowH[lane] >> 32)); }
+#define BATCH_WB_LO for (lane = 0; lane < BATCH.width; lane++) { BATCH_MERGE(BATCH.regs[REG_LO][lane], (uint32_t)rowH[lane]); }
+#define BATCH_WB_HILO BATCH_WB_HI BATCH_WB_LO
+#define BATCH_OP(name, code, fmt, srcA, srcB, dst, exec, mem) \
+static void batch_op_##name(const decoded_inst_t *inst, uint32_t pc) \
+{ \
+	const uint32_t *rowA = BATCH_SRC_##srcA, *rowB = BATCH_SRC_##srcB; \
+	uint32_t *rowR = BATCH.result; \
+	uint64_t *rowH = BATCH.hilo; \
+	const uint32_t sa = inst->sa, imm = inst->imm, simm = (uint32_t)(int32_t)(int16_t)imm; \
+	uint32_t lane, k; \
+	for (lane = 0; lane < BATCH.width; lane += BATCH_CHUNK) { \
+		/* chunk-sized locals: no aliasing, fixed trip count */ \
+		uint32_t va[BATCH_CHUNK], vb[BATCH_CHUNK], vr[BATCH_CHUNK]; \
+		uint64_t vh[BATCH_CHUNK]; \
+		memcpy(va, rowA + lane, sizeof(va)); \
+		memcpy(vb, rowB + lane, sizeof(vb)); \
+		for (k = 0; k < BATCH_CHUNK; k++) { \
+			uint32_t a = va[k], b = vb[k], r = 0; \
+			uint64_t hilo = 0; \
+			(void)a; (void)b; (void)sa; (void)simm; (void)pc; \
+			exec; \
+			vr[k] = r; \
+			vh[k] = hilo; \
+		} \
+		if (BATCH_HILO_##dst) { \
+			memcpy(rowH + lane, vh, sizeof(vh)); \
+		} \
+		else { \
+			memcpy(rowR + lane, vr, sizeof(vr)); \
+		} \
+	} \
+	BATCH_STEP_##mem \
+	BATCH_WB_##dst \
+}
+MIPS_ISA(BATCH_OP)
+#undef BATCH_OP
+#undef BATCH_SRC_NONE
+#undef BATCH_SRC_RS
+#undef BATCH_SRC_RT
+#undef BATCH_SRC_RD
+#undef BATCH_SRC_HI
+#undef BATCH_SRC_LO
+#undef BATCH_SRC_V0
+#undef BATCH_STEP_NONE
+#undef BATCH_STEP_LB
+#undef BATCH_STEP_LH
+#undef BATCH_STEP_LW
+#undef BATCH_STEP_LL
+#undef BATCH_STEP_SB
+#undef BATCH_STEP_SH
+#undef BATCH_STEP_SW
+#undef BATCH_STEP_SC
+#undef BATCH_STEP_SYSCALL
+#undef BATCH_STEP_BRANCH
+#undef BATCH_STEP_JUMP
+#undef BATCH_STEP_JUMPR
+#undef BATCH_HILO_NONE
+#undef BATCH_HILO_RT
+#undef BATCH_HILO_RD
+#undef BATCH_HILO_RA
+#undef BATCH_HILO_HI
+#undef BATCH_HILO_LO
+#undef BATCH_HILO_HILO
+#undef BATCH_MERGE
+#undef BATCH_WB_NONE
+#undef BATCH_WB_RT
+#undef BATCH_WB_RD
+#undef BATCH_WB_RA
+#undef BATCH_WB_HI
+#undef BATCH_WB_LO
+#undef BATCH_WB_HILO
+
+/************************************************************/
+/* Free everything batch_run allocated                                                       */
+/************************************************************/
+void batch_free()
+{
+	uint32_t i;
+
+	if (BATCH.overlays != NULL) {
+		for (i = 0; i <= BATCH.lanes; i++) {
+			free(BATCH.overlays[i].words);
+		}
+	}
+	free(BATCH.overlays);
+	free(BATCH.regs[0]);
+	free(BATCH.hilo);
+	free(BATCH.status);
+	free(BATCH.start);
+	free(BATCH.final);
+	memset(&BATCH, 0, sizeof(BATCH));
 }
 
 /************************************************************/
-/* instruction decode (ID) pipeline stage:                                                         */ 
+/* A lane has stopped: keep its state as of the op just done              */
 /************************************************************/
-void ID()
+void batch_record_lane(uint32_t lane)
 {
-	/*IMPLEMENT THIS*/
-    if (ENABLE_FORWARDING == 1 && IF_EX.MemRead == 1 && ((IF_EX.RegisterRt == ID_IF.RegisterRs) || (IF_EX.RegisterRt == ID_IF.RegisterRt))){
-        IF_EX.IR = 0x00000001;
-        IF_EX.FLAG = FALSE;
-    }
-    
-    if (IF_EX.FLAG == TRUE && EX_MEM.FLAG == TRUE){
-    IF_EX.IR = ID_IF.IR;
-    //printf("IF_EX.IR: %u\n", IF_EX.IR);
-    }
-    
-    uint32_t opcode, function, rs, rt, sa, immediate;
-	
-	//printf("[0x%x]\t", CURRENT_STATE.PC);
-	
-	opcode = (IF_EX.IR & 0xFC000000) >> 26;
-	function = IF_EX.IR & 0x0000003F;
-	rs = (IF_EX.IR & 0x03E00000) >> 21;
-	rt = (IF_EX.IR & 0x001F0000) >> 16;
-	//rd = (IF_EX.IR & 0x0000F800) >> 11;
-	sa = (IF_EX.IR & 0x000007C0) >> 6;
-	immediate = IF_EX.IR & 0x0000FFFF;
-    
-    if(IF_EX.FLAG == TRUE){
-    if(opcode == 0x00 && IF_EX.IR != 0){
-		switch(function){
-			case 0x00: //SLL
-                if (ForwardB == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.imm = sa;
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x02: //SRL
-                if (ForwardB == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.imm = sa;
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = 0;
-                IF_EX.RegWrite = 1;
-               // print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x03: //SRA 
-                if (ForwardB == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.imm = sa;
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = 0;
-                IF_EX.RegWrite = 1;
-               // print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //SYSCALL
-				IF_EX.A = CURRENT_STATE.REGS[2];
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x10: //MFHI
-				IF_EX.A = CURRENT_STATE.HI;
-                IF_EX.RegWrite = 1;
-               // print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x11: //MTHI
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-               // print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x12: //MFLO
-				IF_EX.A = CURRENT_STATE.LO;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x13: //MTLO
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x18: //MULT
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-               // print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x19: //MULTU
-                if (ForwardA == 10){
-                    IF_EX.AA = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.AA = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.AA = (int64_t)CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.BB = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.BB = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.BB = (int64_t)CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1A: //DIV 
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = (int32_t)CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = (int32_t)CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x1B: //DIVU
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //ADD
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //ADDU 
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x22: //SUB
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //SUBU
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x24: //AND
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x25: //OR
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x26: //XOR
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x27: //NOR
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x2A: //SLT
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                    IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			default:
-				printf("ID at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-				break;
-		}
+	uint32_t i;
+
+	BATCH.final[lane].PC = BATCH.pc[lane];
+	for (i = 0; i < MIPS_REGS; i++) {
+		BATCH.final[lane].REGS[i] = BATCH.regs[i][lane];
 	}
-    else{
-		switch(opcode){
-			case 0x08: //ADDI
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x09: //ADDIU
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0A: //SLTI
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = (int32_t)CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0C: //ANDI
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0D: //ORI
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0E: //XORI
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x0F: //LUI
-                IF_EX.imm = immediate;
-                IF_EX.RegWrite = 1;
-                IF_EX.RegisterRs = 0;
-                IF_EX.RegisterRt = 0;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x20: //LB
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                IF_EX.MemRead = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x21: //LH
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                IF_EX.MemRead = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x23: //LW
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = 0;
-                IF_EX.RegWrite = 1;
-                IF_EX.MemRead = 1;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x28: //SB
-                if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.imm = immediate;	
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegWrite = 0;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x29: //SH
-				if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegWrite = 0;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			case 0x2B: //SW
-				if (ForwardA == 10){
-                    IF_EX.A = EX_MEM.ALUOutput;
-                }
-                else if (ForwardA == 01){
-                    IF_EX.A = MEM_WB.ALUOutput;
-                }
-                else{
-				IF_EX.A = CURRENT_STATE.REGS[rs];
-                }
-                if (ForwardB == 10){
-                    IF_EX.B = EX_MEM.ALUOutput;
-                }
-                else if (ForwardB == 01){
-                    IF_EX.B = MEM_WB.ALUOutput;
-                }
-                else{
-                IF_EX.B = CURRENT_STATE.REGS[rt];
-                }
-                IF_EX.imm = immediate;
-                IF_EX.RegisterRs = rs;
-                IF_EX.RegisterRt = rt;
-                IF_EX.RegWrite = 0;
-                //print_instruction(CURRENT_STATE.PC);
-				break;
-			default:
-				// put more things here
-				printf("ID at 0x%x is not implemented!\n", CURRENT_STATE.PC);
-				break;
-		  }
-        }
-    }
+	BATCH.final[lane].HI = BATCH.regs[REG_HI][lane];
+	BATCH.final[lane].LO = BATCH.regs[REG_LO][lane];
 }
 
 /************************************************************/
-/* instruction fetch (IF) pipeline stage:                                                              */ 
+/* Pick the next op after lanes went different ways: the lowest pc   */
+/* any running lane is at, with BATCH.mask set for the lanes there.    */
+/* A lane at an unaligned pc faults as its fetch would                        */
 /************************************************************/
-void IF()
+uint32_t batch_schedule()
 {
-	/*IMPLEMENT THIS*/
-    
-    if (IF_EX.FLAG == TRUE && EX_MEM.FLAG == TRUE){
-    ID_IF.IR = mem_read_32(CURRENT_STATE.PC);
-    ID_IF.PC = CURRENT_STATE.PC + 4;
-    NEXT_STATE.PC = ID_IF.PC;
-    }
- //   else{
-  //  print_instruction(CURRENT_STATE.PC);
-    //}
-    if (ID_IF.IR == 0){
-        printf("NO INSTRUCTIONS FOR IF.\n");
-    }
-    //else{
-    //print_instruction(CURRENT_STATE.PC);
-    //}
-    if (IF_EX.FLAG == TRUE && EX_MEM.FLAG == FALSE){
-        EX_MEM.FLAG = TRUE;
-        ForwardA = 00;
-        ForwardB = 00;
-    }
-    if (IF_EX.FLAG == FALSE && EX_MEM.FLAG == TRUE){
-        IF_EX.MemRead = 0;
-    }
-    //show_pipeline();
+	uint32_t lane, pc = 0xFFFFFFFF;
+
+	for (lane = 0; lane < BATCH.lanes; lane++) {
+		if (BATCH.status[lane] != BATCH_RUNNING) {
+			continue;
+		}
+		if (BATCH.pc[lane] & 0x3) {
+			batch_stop_lane(lane, BATCH_FAULTED, "address error: unaligned fetch", BATCH.pc[lane]);
+			BATCH.retired[lane]++;
+			BATCH.pc[lane] += 4;
+			batch_record_lane(lane);
+			continue;
+		}
+		if (BATCH.pc[lane] < pc) {
+			pc = BATCH.pc[lane];
+		}
+	}
+	BATCH.converged = TRUE;
+	for (lane = 0; lane < BATCH.width; lane++) {
+		BATCH.mask[lane] = (BATCH.status[lane] == BATCH_RUNNING && BATCH.pc[lane] == pc) ? 0xFFFFFFFF : 0;
+		if (BATCH.status[lane] == BATCH_RUNNING && !BATCH.mask[lane]) {
+			BATCH.converged = FALSE;
+		}
+	}
+	BATCH.stopping = 0;
+	return pc;
 }
 
+/************************************************************/
+/* Run the program from the current state on lanes copies of it,    */
+/* lane i starting with register reg = first + i * step, and report    */
+/* each lane's final state. The simulator's own state is untouched   */
+/************************************************************/
+void batch_run(uint32_t lanes, int reg, uint32_t first, uint32_t step)
+{
+	static void (*const ops[NUM_OPS])(const decoded_inst_t *, uint32_t) = {
+#define BATCH_OP_ENTRY(name, code, fmt, srcA, srcB, dst, exec, mem) [OP_##name] = batch_op_##name,
+		MIPS_ISA(BATCH_OP_ENTRY)
+#undef BATCH_OP_ENTRY
+	};
+	uint32_t pc = CURRENT_STATE.PC, lane, i, exited = 0;
+	uint32_t *rows;
+	uint64_t total = 0;
+	const decoded_inst_t *inst;
+	const CPU_State *s, *f;
+	double t0, elapsed;
+	char name[16];
+
+	if (lanes == 0) {
+		return;
+	}
+	if (RUN_FLAG == FALSE) {
+		printf("Simulation Stopped\n\n");
+		return;
+	}
+	BATCH.lanes = lanes;
+	BATCH.width = (lanes + BATCH_CHUNK - 1) / BATCH_CHUNK * BATCH_CHUNK;
+	/* the registers, then the zero, result, pc, mask and retired rows */
+	rows = calloc((size_t)(REG_LO + 6) * BATCH.width, sizeof(uint32_t));
+	BATCH.hilo = calloc(BATCH.width, sizeof(uint64_t));
+	BATCH.status = calloc(BATCH.width, sizeof(uint8_t));
+	BATCH.start = calloc(lanes, sizeof(CPU_State));
+	BATCH.final = calloc(lanes, sizeof(CPU_State));
+	BATCH.overlays = calloc(lanes + 1, sizeof(batch_overlay_t));
+	BATCH.regs[0] = rows;
+	if (rows == NULL || BATCH.hilo == NULL || BATCH.status == NULL ||
+		BATCH.start == NULL || BATCH.final == NULL || BATCH.overlays == NULL) {
+		printf("Error: out of memory for %u lanes\n", lanes);
+		batch_free();
+		return;
+	}
+	for (i = 0; i <= REG_LO; i++) {
+		BATCH.regs[i] = rows + i * BATCH.width;
+	}
+	BATCH.zero = rows + (REG_LO + 1) * BATCH.width;
+	BATCH.result = BATCH.zero + BATCH.width;
+	BATCH.pc = BATCH.result + BATCH.width;
+	BATCH.mask = BATCH.pc + BATCH.width;
+	BATCH.retired = BATCH.mask + BATCH.width;
+
+	for (lane = 0; lane < BATCH.width; lane++) {
+		for (i = 0; i < MIPS_REGS; i++) {
+			BATCH.regs[i][lane] = CURRENT_STATE.REGS[i];
+		}
+		BATCH.regs[REG_HI][lane] = CURRENT_STATE.HI;
+		BATCH.regs[REG_LO][lane] = CURRENT_STATE.LO;
+		BATCH.pc[lane] = pc;
+		if (lane < lanes) {
+			BATCH.regs[reg][lane] = first + lane * step;
+			BATCH.start[lane].PC = pc;
+			for (i = 0; i < MIPS_REGS; i++) {
+				BATCH.start[lane].REGS[i] = BATCH.regs[i][lane];
+			}
+			BATCH.start[lane].HI = BATCH.regs[REG_HI][lane];
+			BATCH.start[lane].LO = BATCH.regs[REG_LO][lane];
+		}
+		else {
+			/* padding: computed along, never looked at */
+			BATCH.status[lane] = BATCH_EXITED;
+		}
+	}
+	BATCH.running = lanes;
+
+	t0 = now_seconds();
+	pc = batch_schedule();
+	while (BATCH.running > 0) {
+		inst = fetch_decoded(pc);
+		if (ops[inst->op] != NULL) {
+			ops[inst->op](inst, pc);
+		}
+		else if (inst->op != OP_NOP) {
+			printf("Instruction at 0x%x is not implemented!\n", pc);
+		}
+		if (BATCH.converged && BATCH.stopping == 0 && !IS_CONTROL(inst->op)) {
+			/* everyone moves on together; BATCH.pc catches up when they part */
+			for (lane = 0; lane < BATCH.width; lane++) {
+				BATCH.retired[lane] += BATCH.mask[lane] & 1;
+			}
+			pc += 4;
+			continue;
+		}
+		for (lane = 0; lane < lanes; lane++) {
+			if (!BATCH.mask[lane]) {
+				continue;
+			}
+			BATCH.retired[lane]++;
+			if (!IS_CONTROL(inst->op)) {
+				BATCH.pc[lane] = pc + 4;
+			}
+			if (BATCH.status[lane] != BATCH_RUNNING) {
+				batch_record_lane(lane);
+			}
+		}
+		pc = batch_schedule();
+	}
+	elapsed = now_seconds() - t0;
+
+	printf("-------------------------------------\n");
+	if (reg < MIPS_REGS) {
+		snprintf(name, sizeof(name), "R%d", reg);
+	}
+	else {
+		snprintf(name, sizeof(name), "%s", reg == REG_HI ? "HI" : "LO");
+	}
+	printf("Batch run: %u lanes, %s = 0x%08x + lane * 0x%08x\n", lanes, name, first, step);
+	printf("-------------------------------------\n");
+	printf("[Lane]\t[Input]\t\t[Instructions]\t[Final PC]\t[Changed registers]\n");
+	for (lane = 0; lane < lanes; lane++) {
+		s = &BATCH.start[lane];
+		f = &BATCH.final[lane];
+		printf("%u\t0x%08x\t%u\t\t0x%08x%s\t", lane, first + lane * step, BATCH.retired[lane], f->PC,
+			   BATCH.status[lane] == BATCH_FAULTED ? " (fault)" : "");
+		for (i = 0; i < MIPS_REGS; i++) {
+			if (f->REGS[i] != s->REGS[i]) {
+				printf(" R%u=0x%08x", i, f->REGS[i]);
+			}
+		}
+		if (f->HI != s->HI) {
+			printf(" HI=0x%08x", f->HI);
+		}
+		if (f->LO != s->LO) {
+			printf(" LO=0x%08x", f->LO);
+		}
+		printf("\n");
+		exited += BATCH.status[lane] == BATCH_EXITED;
+		total += BATCH.retired[lane];
+	}
+	printf("-------------------------------------\n");
+	printf("lanes exited / faulted\t: %u / %u\n", exited, lanes - exited);
+	printf("lane instructions\t: %llu\n", (unsigned long long)total);
+	printf("memory ops\t\t: %llu for all lanes at once, %llu lane by lane\n",
+		   (unsigned long long)BATCH.uniform_ops, (unsigned long long)BATCH.scalar_ops);
+	printf("throughput\t\t: %8.2f lane-MIPS (%.3f s)\n", elapsed > 0 ? total / elapsed / 1e6 : 0.0, elapsed);
+	printf("-------------------------------------\n");
+	batch_free();
+}
 
 /************************************************************/
 /* Initialize Memory                                                                                                    */ 
@@ -1926,18 +6747,24 @@ void IF()
 void initialize() { 
 	init_memory();
 	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
+	pipeline_flush();
 	RUN_FLAG = TRUE;
-    EX_MEM.RegWrite = 1;
-    MEM_WB.RegWrite = 1;
-    IF_EX.MemRead = 0;
-    EX_MEM.FLAG = TRUE;
-    MEM_WB.FLAG = TRUE;
-    IF_EX.FLAG = TRUE;
     ENABLE_FORWARDING = 0;
+    pipeline_select();
+    bp_configure("static", 0);
+    PF_DEGREE = 2;
+    MD_MULT_LATENCY = MD_DIV_LATENCY = 1;
+    ISSUE_WIDTH = 1;
+    IF_DEPTH = EX_DEPTH = MEM_DEPTH = 1;
+    NUM_THREADS = 1;
+    FETCH_POLICY = FETCH_RR;
+    THREAD_RUNNING = 1;
+    ooo_configure(64, 4, 16, 16, 4, 32);
+    ICACHE.name = "I-cache";
+    DCACHE.name = "D-cache";
+    mc_init();
     ForwardA = 00;
     ForwardB = 00;
-    EX_MEM.forward = 0;
 }
 
 /************************************************************/
@@ -1955,175 +6782,244 @@ void print_program(){
 }
 
 /************************************************************/
-/* Print the instruction at given memory address (in MIPS assembly format)    */
+/* Decode one instruction word into its record                                                     */
 /************************************************************/
-void print_instruction(uint32_t addr){
-	uint32_t instruction, opcode, function, rs, rt, rd, sa, immediate, target;
+void decode_instruction(uint32_t word, decoded_inst_t *inst){
+	uint32_t opcode = (word & 0xFC000000) >> 26;
+	uint32_t function = word & 0x0000003F;
 	
-	instruction = mem_read_32(addr);
+	inst->raw = word;
+	inst->rs = (word & 0x03E00000) >> 21;
+	inst->rt = (word & 0x001F0000) >> 16;
+	inst->rd = (word & 0x0000F800) >> 11;
+	inst->sa = (word & 0x000007C0) >> 6;
+	inst->imm = word & 0x0000FFFF;
+	inst->target = word & 0x03FFFFFF;
+	inst->valid = TRUE;
 	
-	opcode = (instruction & 0xFC000000) >> 26;
-	function = instruction & 0x0000003F;
-	rs = (instruction & 0x03E00000) >> 21;
-	rt = (instruction & 0x001F0000) >> 16;
-	rd = (instruction & 0x0000F800) >> 11;
-	sa = (instruction & 0x000007C0) >> 6;
-	immediate = instruction & 0x0000FFFF;
-	target = instruction & 0x03FFFFFF;
+	if(word == 0x00000000){
+		inst->op = OP_NOP;
+	}
+	else if(opcode == 0x00){
+		inst->op = ISA_SPECIAL_OPS[function];
+	}
+	else if(opcode == 0x01){
+		inst->op = ISA_REGIMM_OPS[inst->rt];
+	}
+	else{
+		inst->op = ISA_OPCODE_OPS[opcode];
+	}
 	
-	if(opcode == 0x00){
-		/*R format instructions here*/
-		
-		switch(function){
-			case 0x00:
-				printf("SLL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x02:
-				printf("SRL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x03:
-				printf("SRA $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x08:
-				printf("JR $r%u\n", rs);
-				break;
-			case 0x09:
-				if(rd == 31){
-					printf("JALR $r%u\n", rs);
-				}
-				else{
-					printf("JALR $r%u, $r%u\n", rd, rs);
-				}
-				break;
-			case 0x0C:
-				printf("SYSCALL\n");
-				break;
-			case 0x10:
-				printf("MFHI $r%u\n", rd);
-				break;
-			case 0x11:
-				printf("MTHI $r%u\n", rs);
-				break;
-			case 0x12:
-				printf("MFLO $r%u\n", rd);
-				break;
-			case 0x13:
-				printf("MTLO $r%u\n", rs);
-				break;
-			case 0x18:
-				printf("MULT $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x19:
-				printf("MULTU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1A:
-				printf("DIV $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1B:
-				printf("DIVU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x20:
-				printf("ADD $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x21:
-				printf("ADDU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x22:
-				printf("SUB $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x23:
-				printf("SUBU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x24:
-				printf("AND $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x25:
-				printf("OR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x26:
-				printf("XOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x27:
-				printf("NOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x2A:
-				printf("SLT $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			default:
-				printf("Instruction is not implemented!\n");
-				break;
+	/* registers read into A/B and the one written back */
+	inst->srcA = isa_operand(ISA_INFO[inst->op].srcA, inst);
+	inst->srcB = isa_operand(ISA_INFO[inst->op].srcB, inst);
+	inst->dst = isa_operand(ISA_INFO[inst->op].dst, inst);
+	inst->handler = inst->op;
+}
+
+/************************************************************/
+/* Register number an ISA table operand column refers to               */
+/************************************************************/
+uint8_t isa_operand(uint8_t operand, const decoded_inst_t *inst){
+	switch(operand){
+		case OPND_RS: return inst->rs;
+		case OPND_RT: return inst->rt;
+		case OPND_RD: return inst->rd;
+		case OPND_RA: return 31;
+		case OPND_HI: return REG_HI;
+		case OPND_LO: return REG_LO;
+		case OPND_HILO: return REG_HILO;
+		case OPND_V0: return 2;
+		default: return 0;
+	}
+}
+
+/************************************************************/
+/* Handler for inst when next follows it: a fused pair from          */
+/* MIPS_FUSED_PAIRS, or just its own op                                                   */
+/************************************************************/
+uint8_t fuse_pair(const decoded_inst_t *inst, const decoded_inst_t *next){
+#define FUSE_MATCH(first, second) \
+	if(inst->op == OP_##first && next->op == OP_##second){ \
+		return OP_##first##_##second; \
+	}
+	MIPS_FUSED_PAIRS(FUSE_MATCH)
+#undef FUSE_MATCH
+	return inst->op;
+}
+
+/************************************************************/
+/* Decode every word of a page; the page turns into a code page        */
+/************************************************************/
+void predecode_page(mem_page_t *page){
+	uint32_t i, word;
+	tlb_entry_t *entry;
+	
+	if(page->decoded == NULL){
+		page->decoded = malloc((MEM_PAGE_SIZE / 4) * sizeof(decoded_inst_t));
+		if(page->decoded == NULL){
+			printf("Error: out of memory decoding page 0x%08x\n", page->vpn << MEM_PAGE_SHIFT);
+			exit(-1);
 		}
+		/* stores to code pages must go through mem_lookup to invalidate */
+		entry = &TLB_WRITE[page->vpn & (TLB_SIZE - 1)];
+		if(entry->vpn == page->vpn){
+			entry->vpn = TLB_INVALID;
+			entry->page = NULL;
+		}
+		MC_CODE_EPOCH++;	/* the other cores drop theirs at their next quantum */
 	}
-	else{
-		switch(opcode){
-			case 0x01:
-				if(rt == 0){
-					printf("BLTZ $r%u, 0x%x\n", rs, immediate<<2);
-				}
-				else if(rt == 1){
-					printf("BGEZ $r%u, 0x%x\n", rs, immediate<<2);
-				}
-				break;
-			case 0x02:
-				printf("J 0x%x\n", (addr & 0xF0000000) | (target<<2));
-				break;
-			case 0x03:
-				printf("JAL 0x%x\n", (addr & 0xF0000000) | (target<<2));
-				break;
-			case 0x04:
-				printf("BEQ $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x05:
-				printf("BNE $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x06:
-				printf("BLEZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x07:
-				printf("BGTZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x08:
-				printf("ADDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x09:
-				printf("ADDIU $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0A:
-				printf("SLTI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0C:
-				printf("ANDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0D:
-				printf("ORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0E:
-				printf("XORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0F:
-				printf("LUI $r%u, 0x%x\n", rt, immediate);
-				break;
-			case 0x20:
-				printf("LB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x21:
-				printf("LH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x23:
-				printf("LW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x28:
-				printf("SB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x29:
-				printf("SH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x2B:
-				printf("SW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			default:
-				printf("Instruction is not implemented!\n");
-				break;
+	for(i = 0; i < MEM_PAGE_SIZE / 4; i++){
+		memcpy(&word, page->data + 4 * i, sizeof(word));
+		decode_instruction(GUEST_TO_HOST_32(word), &page->decoded[i]);
+	}
+	/* pairs never straddle a page, so a write only ever breaks the one it lands in */
+	for(i = 0; i + 1 < MEM_PAGE_SIZE / 4; i++){
+		page->decoded[i].handler = fuse_pair(&page->decoded[i], &page->decoded[i + 1]);
+	}
+}
+
+/************************************************************/
+/* Decode the text segment of the loaded program once                    */
+/************************************************************/
+void predecode_program(){
+	uint32_t addr;
+	mem_page_t *page;
+	
+	for(addr = MEM_TEXT_BEGIN; addr < MEM_TEXT_BEGIN + PROGRAM_SIZE * 4; addr += MEM_PAGE_SIZE){
+		if((page = PAGE_TABLE[addr >> MEM_PAGE_SHIFT]) != NULL){
+			predecode_page(page);
+		}
+	}
+}
+
+/************************************************************/
+/* Decoded record of the instruction at pc                                              */
+/************************************************************/
+const decoded_inst_t *fetch_decoded(uint32_t pc){
+	mem_page_t *page;
+	decoded_inst_t *inst;
+	
+	if(pc & 0x3){
+		mem_unaligned("fetch", 32, pc);
+		return &NOP_INST;
+	}
+	if((page = PAGE_TABLE[pc >> MEM_PAGE_SHIFT]) == NULL){
+		return &NOP_INST;
+	}
+	if(page->decoded != NULL && page->decoded[(pc & MEM_PAGE_MASK) >> 2].valid){
+		return &page->decoded[(pc & MEM_PAGE_MASK) >> 2];
+	}
+	if(NUM_CORES > 1){
+		/* another core may be decoding the same page */
+		pthread_mutex_lock(&MC_MEMORY_LOCK);
+	}
+	if(page->decoded == NULL){
+		predecode_page(page);
+	}
+	inst = &page->decoded[(pc & MEM_PAGE_MASK) >> 2];
+	if(!inst->valid){
+		decode_instruction(mem_read_32(pc), inst);
+	}
+	if(NUM_CORES > 1){
+		pthread_mutex_unlock(&MC_MEMORY_LOCK);
+	}
+	return inst;
+}
+
+/************************************************************/
+/* Print the instruction at given memory address (in MIPS assembly format)    */
+/************************************************************/
+void print_instruction(uint32_t addr){
+	disassemble(fetch_decoded(addr), addr);
+}
+
+/************************************************************/
+/* Print a decoded instruction (in MIPS assembly format)                */
+/************************************************************/
+void disassemble(const decoded_inst_t *inst, uint32_t addr){
+	uint32_t rs = inst->rs, rt = inst->rt, rd = inst->rd, sa = inst->sa;
+	uint32_t immediate = inst->imm, target = inst->target;
+	const char *name = ISA_INFO[inst->op].name;
+	
+	if(inst->op == OP_INVALID){
+		printf("Instruction is not implemented!\n");
+		return;
+	}
+	switch(ISA_INFO[inst->op].fmt){
+		case DIS_RD_RT_SA:
+			printf("%s $r%u, $r%u, 0x%x\n", name, rd, rt, sa);
+			break;
+		case DIS_RD_RS_RT:
+			printf("%s $r%u, $r%u, $r%u\n", name, rd, rs, rt);
+			break;
+		case DIS_RS_RT:
+			printf("%s $r%u, $r%u\n", name, rs, rt);
+			break;
+		case DIS_RS:
+			printf("%s $r%u\n", name, rs);
+			break;
+		case DIS_RD:
+			printf("%s $r%u\n", name, rd);
+			break;
+		case DIS_JALR:
+			if(rd == 31){
+				printf("%s $r%u\n", name, rs);
+			}
+			else{
+				printf("%s $r%u, $r%u\n", name, rd, rs);
+			}
+			break;
+		case DIS_RT_RS_IMM:
+			printf("%s $r%u, $r%u, 0x%x\n", name, rt, rs, immediate);
+			break;
+		case DIS_RT_IMM:
+			printf("%s $r%u, 0x%x\n", name, rt, immediate);
+			break;
+		case DIS_RT_OFF_RS:
+			printf("%s $r%u, 0x%x($r%u)\n", name, rt, immediate, rs);
+			break;
+		case DIS_RS_OFF:
+			printf("%s $r%u, 0x%x\n", name, rs, immediate<<2);
+			break;
+		case DIS_RS_RT_OFF:
+			printf("%s $r%u, $r%u, 0x%x\n", name, rs, rt, immediate<<2);
+			break;
+		case DIS_TARGET:
+			printf("%s 0x%x\n", name, (addr & 0xF0000000) | (target<<2));
+			break;
+		default:
+			printf("%s\n", name);
+			break;
+	}
+}
+
+/************************************************************/
+/* Print lanes 1 and up of a pipeline register                                   */ 
+/************************************************************/
+void show_lanes(const char *name, const CPU_Pipeline_Reg *lanes)
+{
+	uint32_t i;
+	
+	for (i = 0; i + 1 < ISSUE_WIDTH; i++) {
+		printf("%s[%u].IR:%u\t[0x%x]\t", name, i + 1, lanes[i].inst->raw, lanes[i].PC);
+		disassemble(lanes[i].inst, lanes[i].PC);
+	}
+}
+
+/************************************************************/
+/* Print the groups in stages 1 .. depth - 1 of a split stage               */
+/************************************************************/
+void show_stages(const char *name, const pipeline_group_t *stages, uint32_t depth)
+{
+	const CPU_Pipeline_Reg *latch;
+	uint32_t k, i;
+	
+	for (k = 0; k + 1 < depth; k++) {
+		for (i = 0; i < ISSUE_WIDTH; i++) {
+			latch = &stages[k].lane[i];
+			printf("%s%u[%u].IR:%u\t[0x%x]\t", name, k + 1, i, latch->inst->raw, latch->PC);
+			disassemble(latch->inst, latch->PC);
 		}
 	}
 }
@@ -2132,29 +7028,42 @@ void print_instruction(uint32_t addr){
 /* Print the current pipeline                                                                                    */ 
 /************************************************************/
 void show_pipeline(){
-	/*IMPLEMENT THIS*/
+    uint32_t t;
+    
+    if (SIM_MODE == SIM_OOO) {
+        ooo_show();
+        return;
+    }
     printf("\nCurrent PC:[0x%x]\n", CURRENT_STATE.PC);
-    printf("ID_IF.IR:%u\n", ID_IF.IR);
-    print_instruction(ID_IF.PC - 4);
-    printf("ID_IF.PC:%u\n\n", ID_IF.PC);
-    printf("IF_EX.IR:%u\n", IF_EX.IR);
-    print_instruction(ID_IF.PC - 8);
+    show_stages("IF", IF_STAGES, IF_DEPTH);
+    printf("ID_IF.IR:%u\t[0x%x]\t", ID_IF.inst->raw, ID_IF.PC);
+    disassemble(ID_IF.inst, ID_IF.PC);
+    show_lanes("ID_IF", ID_IF_LANES);
+    for (t = 1; t < NUM_THREADS; t++) {
+        printf("ID_IF[%u].IR:%u\t[0x%x]\t", t, ID_IF_THREADS[t - 1].inst->raw, ID_IF_THREADS[t - 1].PC);
+        disassemble(ID_IF_THREADS[t - 1].inst, ID_IF_THREADS[t - 1].PC);
+    }
+    printf("\nIF_EX.IR:%u\t[0x%x]\t", IF_EX.inst->raw, IF_EX.PC);
+    disassemble(IF_EX.inst, IF_EX.PC);
     printf("IF_EX.A:%u\n", IF_EX.A);
     printf("IF_EX.B:%u\n", IF_EX.B);
-    //printf("IF_EX.RegisterRs:%d\n\n", IF_EX.RegisterRs);
-    //printf("IF_EX.RegisterRt:%d\n\n", IF_EX.RegisterRt);
-    printf("IF_EX.imm:%u\n\n", IF_EX.imm);
-    printf("EX_MEM.IR:%u\n", EX_MEM.IR);
-    print_instruction(ID_IF.PC - 12);
+    printf("IF_EX.imm:%u\n", IF_EX.imm);
+    show_lanes("IF_EX", IF_EX_LANES);
+    printf("\n");
+    show_stages("EX", EX_STAGES, EX_DEPTH);
+    printf("EX_MEM.IR:%u\t[0x%x]\t", EX_MEM.inst->raw, EX_MEM.PC);
+    disassemble(EX_MEM.inst, EX_MEM.PC);
     printf("EX_MEM.A:%u\n", EX_MEM.A);
     printf("EX_MEM.B:%u\n", EX_MEM.B);
-    printf("EX_MEM.ALUOutput:%u\n\n", EX_MEM.ALUOutput);
-    //printf("EX_MEM.RegisterRd:%d\n\n", EX_MEM.RegisterRd);
-    printf("MEM_WB.IR:%u\n", MEM_WB.IR);
-    print_instruction(ID_IF.PC - 16);
+    printf("EX_MEM.ALUOutput:%u\n", EX_MEM.ALUOutput);
+    show_lanes("EX_MEM", EX_MEM_LANES);
+    printf("\n");
+    show_stages("MEM", MEM_STAGES, MEM_DEPTH);
+    printf("MEM_WB.IR:%u\t[0x%x]\t", MEM_WB.inst->raw, MEM_WB.PC);
+    disassemble(MEM_WB.inst, MEM_WB.PC);
     printf("MEM_WB.ALUOutput:%u\n", MEM_WB.ALUOutput);
     printf("MEM_WB.LMD:%u\n", MEM_WB.LMD);
-    //printf("MEM_WB.RegisterRd:%d\n\n", MEM_WB.RegisterRd);
+    show_lanes("MEM_WB", MEM_WB_LANES);
     printf("CYCLE %u\n", CYCLE_COUNT);
 }
 
@@ -2166,14 +7075,36 @@ int main(int argc, char *argv[]) {
 	printf("Welcome to MU-MIPS SIM...\n");
 	printf("**************************\n\n");
 	
-	if (argc < 2) {
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
+	int i;
+	int mode = SIM_PIPELINE;
+	
+	prog_file[0] = '\0';
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--functional") == 0) {
+			mode = SIM_FUNCTIONAL;
+		}
+		else if (strcmp(argv[i], "--translate") == 0) {
+			mode = SIM_TRANSLATED;
+		}
+		else if (strcmp(argv[i], "--pipeline") == 0) {
+			mode = SIM_PIPELINE;
+		}
+		else if (strcmp(argv[i], "--ooo") == 0) {
+			mode = SIM_OOO;
+		}
+		else {
+			strncpy(prog_file, argv[i], sizeof(prog_file) - 1);
+		}
+	}
+	if (prog_file[0] == '\0') {
+		printf("Error: You should provide input file.\nUsage: %s [--functional | --translate] <input program> \n\n",  argv[0]);
 		exit(1);
 	}
 
-	strcpy(prog_file, argv[1]);
 	initialize();
+	set_sim_mode(mode);
 	load_program();
+	mem_snapshot();
 	help();
 	while (1){
 		handle_command();
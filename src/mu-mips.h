@@ -3,6 +3,10 @@
 #define FALSE 0
 #define TRUE  1
 
+/* state every simulated core keeps its own copy of (one host thread per */
+/* core, see NUM_CORES); the rest, guest memory first, is shared          */
+#define CORE_LOCAL __thread
+
 /******************************************************************************/
 /* MIPS memory layout                                                                                                                                      */
 /******************************************************************************/
@@ -22,20 +26,247 @@
 #define MEM_STACK_BEGIN 0x7FFFFFFF
 #define MEM_STACK_END  0x10010000
 
+/* guest memory is backed page by page; a page is only allocated when it is first written */
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE  (1 << MEM_PAGE_SHIFT)
+#define MEM_PAGE_MASK  (MEM_PAGE_SIZE - 1)
+#define MEM_NUM_PAGES  (1 << (32 - MEM_PAGE_SHIFT))
+
 typedef struct {
 	uint32_t begin, end;
-	uint8_t *mem;
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
 mem_region_t MEM_REGIONS[] = {
-	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
-	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
-	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
-	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
+	{ MEM_TEXT_BEGIN, MEM_TEXT_END },
+	{ MEM_DATA_BEGIN, MEM_DATA_END },
+	{ MEM_KDATA_BEGIN, MEM_KDATA_END },
+	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END }
 };
 
 #define NUM_MEM_REGION 4
+
+/******************************************************************************/
+/* The instruction set, described once. The OP_ enum, the decoder tables, operand    */
+/* routing, the execute and memory steps of every engine and the disassembler are  */
+/* all generated from these lists, so a new opcode is one more X() line.                      */
+/*                                                                                                                                                                      */
+/* X(name, code, fmt, srcA, srcB, dst, exec, mem)                                                                                 */
+/*   code         funct for SPECIAL, rt for REGIMM, otherwise the opcode                                   */
+/*   fmt          disassembly layout, DIS_*                                                                                               */
+/*   srcA, srcB   what feeds the A and B operands: RS RT RD HI LO V0 or NONE                         */
+/*   dst          what is written back: RT RD RA HI LO HILO or NONE                                             */
+/*   exec         execute step: statements over a, b, sa, imm, simm and pc (the instruction's */
+/*                address) setting r and/or hilo                                                                               */
+/*   mem          memory/system/control step: NONE LB LH LW SB SH SW SYSCALL, LL (LW that       */
+/*                links its line) or SC (SW only while the link holds, r = 1, else r = 0), or   */
+/*                BRANCH (to BRANCH_TARGET when r is nonzero), JUMP (to JUMP_TARGET)            */
+/*                or JUMPR (to a)                                                                                                      */
+/*                                                                                                                                                                      */
+/* There is no branch delay slot: the instruction after a branch or jump runs only         */
+/* when it falls through, and JAL/JALR link the address right after themselves.           */
+/******************************************************************************/
+#define MIPS_ISA_SPECIAL(X) \
+	X(SLL,     0x00, RD_RT_SA,  RT,   NONE, RD,   r = a << sa,                                        NONE) \
+	X(SRL,     0x02, RD_RT_SA,  RT,   NONE, RD,   r = a >> sa,                                        NONE) \
+	X(SRA,     0x03, RD_RT_SA,  RT,   NONE, RD,   r = (uint32_t)((int32_t)a >> sa),                   NONE) \
+	X(JR,      0x08, RS,        RS,   NONE, NONE, r = a,                                              JUMPR) \
+	X(JALR,    0x09, JALR,      RS,   NONE, RD,   r = pc + 4,                                         JUMPR) \
+	X(SYSCALL, 0x0C, NONE,      V0,   NONE, NONE, r = a,                                              SYSCALL) \
+	X(MFHI,    0x10, RD,        HI,   NONE, RD,   r = a,                                              NONE) \
+	X(MTHI,    0x11, RS,        RS,   NONE, HI,   hilo = (uint64_t)a << 32,                           NONE) \
+	X(MFLO,    0x12, RD,        LO,   NONE, RD,   r = a,                                              NONE) \
+	X(MTLO,    0x13, RS,        RS,   NONE, LO,   hilo = a,                                           NONE) \
+	X(MULT,    0x18, RS_RT,     RS,   RT,   HILO, hilo = (uint64_t)((int64_t)(int32_t)a * (int32_t)b), NONE) \
+	X(MULTU,   0x19, RS_RT,     RS,   RT,   HILO, hilo = (uint64_t)a * b,                             NONE) \
+	X(DIV,     0x1A, RS_RT,     RS,   RT,   HILO, hilo = div_signed(a, b),                            NONE) \
+	X(DIVU,    0x1B, RS_RT,     RS,   RT,   HILO, hilo = div_unsigned(a, b),                          NONE) \
+	X(ADD,     0x20, RD_RS_RT,  RS,   RT,   RD,   r = a + b,                                          NONE) \
+	X(ADDU,    0x21, RD_RS_RT,  RS,   RT,   RD,   r = a + b,                                          NONE) \
+	X(SUB,     0x22, RD_RS_RT,  RS,   RT,   RD,   r = a - b,                                          NONE) \
+	X(SUBU,    0x23, RD_RS_RT,  RS,   RT,   RD,   r = a - b,                                          NONE) \
+	X(AND,     0x24, RD_RS_RT,  RS,   RT,   RD,   r = a & b,                                          NONE) \
+	X(OR,      0x25, RD_RS_RT,  RS,   RT,   RD,   r = a | b,                                          NONE) \
+	X(XOR,     0x26, RD_RS_RT,  RS,   RT,   RD,   r = a ^ b,                                          NONE) \
+	X(NOR,     0x27, RD_RS_RT,  RS,   RT,   RD,   r = ~(a | b),                                       NONE) \
+	X(SLT,     0x2A, RD_RS_RT,  RS,   RT,   RD,   r = (int32_t)a < (int32_t)b,                        NONE)
+
+#define MIPS_ISA_REGIMM(X) \
+	X(BLTZ,    0x00, RS_OFF,    RS,   NONE, NONE, r = (int32_t)a < 0,                                 BRANCH) \
+	X(BGEZ,    0x01, RS_OFF,    RS,   NONE, NONE, r = (int32_t)a >= 0,                                BRANCH)
+
+#define MIPS_ISA_OPCODE(X) \
+	X(J,       0x02, TARGET,    NONE, NONE, NONE, r = 0,                                              JUMP) \
+	X(JAL,     0x03, TARGET,    NONE, NONE, RA,   r = pc + 4,                                         JUMP) \
+	X(BEQ,     0x04, RS_RT_OFF, RS,   RT,   NONE, r = a == b,                                         BRANCH) \
+	X(BNE,     0x05, RS_RT_OFF, RS,   RT,   NONE, r = a != b,                                         BRANCH) \
+	X(BLEZ,    0x06, RS_OFF,    RS,   NONE, NONE, r = (int32_t)a <= 0,                                BRANCH) \
+	X(BGTZ,    0x07, RS_OFF,    RS,   NONE, NONE, r = (int32_t)a > 0,                                 BRANCH) \
+	X(ADDI,    0x08, RT_RS_IMM, RS,   NONE, RT,   r = a + simm,                                       NONE) \
+	X(ADDIU,   0x09, RT_RS_IMM, RS,   NONE, RT,   r = a + simm,                                       NONE) \
+	X(SLTI,    0x0A, RT_RS_IMM, RS,   NONE, RT,   r = (int32_t)a < (int32_t)simm,                     NONE) \
+	X(ANDI,    0x0C, RT_RS_IMM, RS,   NONE, RT,   r = a & imm,                                        NONE) \
+	X(ORI,     0x0D, RT_RS_IMM, RS,   NONE, RT,   r = a | imm,                                        NONE) \
+	X(XORI,    0x0E, RT_RS_IMM, RS,   NONE, RT,   r = a ^ imm,                                        NONE) \
+	X(LUI,     0x0F, RT_IMM,    NONE, NONE, RT,   r = imm << 16,                                      NONE) \
+	X(LB,      0x20, RT_OFF_RS, RS,   NONE, RT,   r = a + simm,                                       LB) \
+	X(LH,      0x21, RT_OFF_RS, RS,   NONE, RT,   r = a + simm,                                       LH) \
+	X(LW,      0x23, RT_OFF_RS, RS,   NONE, RT,   r = a + simm,                                       LW) \
+	X(SB,      0x28, RT_OFF_RS, RS,   RT,   NONE, r = a + simm,                                       SB) \
+	X(SH,      0x29, RT_OFF_RS, RS,   RT,   NONE, r = a + simm,                                       SH) \
+	X(SW,      0x2B, RT_OFF_RS, RS,   RT,   NONE, r = a + simm,                                       SW) \
+	X(LL,      0x30, RT_OFF_RS, RS,   NONE, RT,   r = a + simm,                                       LL) \
+	X(SC,      0x38, RT_OFF_RS, RS,   RT,   RT,   r = a + simm,                                       SC)
+
+#define MIPS_ISA(X) MIPS_ISA_SPECIAL(X) MIPS_ISA_REGIMM(X) MIPS_ISA_OPCODE(X)
+
+/* where BRANCH and JUMP go */
+#define BRANCH_TARGET(pc, imm) ((pc) + 4 + ((uint32_t)(int32_t)(int16_t)(imm) << 2))
+#define JUMP_TARGET(pc, target) ((((pc) + 4) & 0xF0000000) | ((target) << 2))
+
+/* OP_INVALID is 0 so the decoder tables can leave unused slots empty */
+#define ISA_ENUM(name, code, fmt, srcA, srcB, dst, exec, mem) OP_##name,
+enum {
+	OP_INVALID, OP_NOP, OP_BUBBLE,
+	MIPS_ISA(ISA_ENUM)
+	NUM_OPS
+};
+
+/* operand routing (srcA/srcB/dst columns) */
+enum { OPND_NONE, OPND_RS, OPND_RT, OPND_RD, OPND_RA, OPND_HI, OPND_LO, OPND_HILO, OPND_V0 };
+
+/* memory/system/control step (mem column) */
+enum { MEM_NONE, MEM_LB, MEM_LH, MEM_LW, MEM_LL, MEM_SB, MEM_SH, MEM_SW, MEM_SC, MEM_SYSCALL, MEM_BRANCH, MEM_JUMP, MEM_JUMPR };
+
+/* disassembly layouts (fmt column) */
+enum {
+	DIS_NONE, DIS_RD_RT_SA, DIS_RD_RS_RT, DIS_RS_RT, DIS_RS, DIS_RD, DIS_JALR,
+	DIS_RT_RS_IMM, DIS_RT_IMM, DIS_RT_OFF_RS, DIS_RS_OFF, DIS_RS_RT_OFF, DIS_TARGET
+};
+
+typedef struct {
+	const char *name;	/* mnemonic */
+	const char *exec;	/* the exec column as text, for export-c */
+	uint8_t fmt;		/* DIS_* */
+	uint8_t srcA, srcB, dst;	/* OPND_* */
+	uint8_t mem;		/* MEM_* */
+} isa_info_t;
+
+#define ISA_INFO_ENTRY(name, code, fmt, srcA, srcB, dst, exec, mem) \
+	[OP_##name] = { #name, #exec, DIS_##fmt, OPND_##srcA, OPND_##srcB, OPND_##dst, MEM_##mem },
+isa_info_t ISA_INFO[NUM_OPS] = {
+	[OP_INVALID] = { "INVALID", "", DIS_NONE, OPND_NONE, OPND_NONE, OPND_NONE, MEM_NONE },
+	[OP_NOP] = { "SLL", "", DIS_RD_RT_SA, OPND_NONE, OPND_NONE, OPND_NONE, MEM_NONE },
+	[OP_BUBBLE] = { "(bubble)", "", DIS_NONE, OPND_NONE, OPND_NONE, OPND_NONE, MEM_NONE },
+	MIPS_ISA(ISA_INFO_ENTRY)
+};
+
+/* decoder tables: SPECIAL by funct, REGIMM by rt, the rest by opcode */
+#define ISA_CODE_ENTRY(name, code, fmt, srcA, srcB, dst, exec, mem) [code] = OP_##name,
+uint8_t ISA_SPECIAL_OPS[64] = {
+	[0x01] = OP_BUBBLE,
+	MIPS_ISA_SPECIAL(ISA_CODE_ENTRY)
+};
+uint8_t ISA_REGIMM_OPS[32] = {
+	MIPS_ISA_REGIMM(ISA_CODE_ENTRY)
+};
+uint8_t ISA_OPCODE_OPS[64] = {
+	MIPS_ISA_OPCODE(ISA_CODE_ENTRY)
+};
+
+#define IS_LOAD(op)        (ISA_INFO[op].mem >= MEM_LB && ISA_INFO[op].mem <= MEM_LL)
+#define IS_STORE(op)       (ISA_INFO[op].mem >= MEM_SB && ISA_INFO[op].mem <= MEM_SC)
+/* bytes a load or store moves */
+#define MEM_BYTES(op)      (ISA_INFO[op].mem == MEM_LB || ISA_INFO[op].mem == MEM_SB ? 1 : \
+							ISA_INFO[op].mem == MEM_LH || ISA_INFO[op].mem == MEM_SH ? 2 : 4)
+#define IS_CONTROL(op)     (ISA_INFO[op].mem >= MEM_BRANCH)
+#define IS_IMPLEMENTED(op) ((op) == OP_NOP || (op) > OP_BUBBLE)
+
+/* pairs functional_run executes as one handler, X(first, second). A pair is  */
+/* found at predecode and does exactly what the two ops would in turn, so     */
+/* the first must not be able to stop the run (no memory or SYSCALL step)     */
+#define MIPS_FUSED_PAIRS(X) \
+	X(LUI,   ORI) \
+	X(ADDIU, SW) \
+	X(MULT,  MFLO) \
+	X(MULT,  MFHI)
+
+/* fused handlers are numbered on from NUM_OPS */
+#define FUSED_ENUM(first, second) OP_##first##_##second,
+enum {
+	OP_FUSED_BASE = NUM_OPS - 1,
+	MIPS_FUSED_PAIRS(FUSED_ENUM)
+	NUM_HANDLERS
+};
+
+/******************************************************************************/
+/* Decoded instructions                                                                                                                                      */
+/******************************************************************************/
+/* register numbers beyond the GPRs, used in srcA/srcB/dst */
+#define REG_HI   32
+#define REG_LO   33
+#define REG_HILO 34	/* MULT/DIV write both */
+
+typedef struct {
+	uint32_t raw;		/* instruction word as it sits in memory */
+	uint32_t imm;		/* 16-bit immediate, zero-extended */
+	uint32_t target;	/* 26-bit jump target */
+	uint8_t op;			/* OP_* */
+	uint8_t rs, rt, rd, sa;
+	uint8_t srcA, srcB;	/* registers read into the A and B operands, 0 if none */
+	uint8_t dst;		/* register written back, 0 if none */
+	uint8_t valid;		/* FALSE once the word has been overwritten */
+	uint8_t handler;	/* what functional_run dispatches on: op, or a fused pair starting here */
+} decoded_inst_t;
+
+decoded_inst_t NOP_INST = { 0x00000000, 0, 0, OP_NOP, 0, 0, 0, 0, 0, 0, 0, TRUE, OP_NOP };
+decoded_inst_t BUBBLE_INST = { 0x00000001, 0, 0, OP_BUBBLE, 0, 0, 0, 0, 0, 0, 0, TRUE, OP_BUBBLE };
+/* what the pipeline fetches from an unaligned PC: a NOP that faults in WB */
+decoded_inst_t FETCH_ERROR_INST = { 0x00000000, 0, 0, OP_NOP, 0, 0, 0, 0, 0, 0, 0, TRUE, OP_NOP };
+
+typedef struct {
+	uint32_t vpn;		/* guest page number */
+	int dirty;			/* written since the last snapshot */
+	uint8_t *snapshot;	/* contents right after the program was loaded, NULL if it was blank */
+	decoded_inst_t *decoded;	/* one record per word once the page has been fetched from */
+	int translated;		/* host code in the translation cache was made from this page */
+	uint8_t data[MEM_PAGE_SIZE];
+} mem_page_t;
+
+/* direct-indexed page table covering the whole 32-bit space, indexed by address >> MEM_PAGE_SHIFT */
+mem_page_t *PAGE_TABLE[MEM_NUM_PAGES];
+
+/* last translations, direct mapped on the low bits of the page number */
+#define TLB_SIZE 64
+#define TLB_INVALID 0xFFFFFFFF
+
+typedef struct {
+	uint32_t vpn;		/* guest page number, TLB_INVALID if empty */
+	uint8_t *page;		/* host backing of that page */
+} tlb_entry_t;
+
+/* reads may use any page; the write side only holds pages already marked dirty that hold no decoded code */
+CORE_LOCAL tlb_entry_t TLB_READ[TLB_SIZE];
+CORE_LOCAL tlb_entry_t TLB_WRITE[TLB_SIZE];
+
+/* guest memory is little-endian; words are swapped only on big-endian hosts */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define GUEST_TO_HOST_16(x) __builtin_bswap16(x)
+#define GUEST_TO_HOST_32(x) __builtin_bswap32(x)
+#else
+#define GUEST_TO_HOST_16(x) (x)
+#define GUEST_TO_HOST_32(x) (x)
+#endif
+
+/* every page that has been allocated */
+mem_page_t **TOUCHED_PAGES;
+uint32_t NUM_TOUCHED_PAGES;
+uint32_t MAX_TOUCHED_PAGES;
+
+/* pages written since the snapshot, so reset only has to visit those */
+mem_page_t **DIRTY_PAGES;
+uint32_t NUM_DIRTY_PAGES;
+uint32_t MAX_DIRTY_PAGES;
+int SNAPSHOT_TAKEN;
 #define MIPS_REGS 32
 
 typedef struct CPU_State_Struct {
@@ -46,22 +277,24 @@ typedef struct CPU_State_Struct {
 } CPU_State;
 
 typedef struct CPU_Pipeline_Reg_Struct{
-	uint32_t PC;
-	uint32_t IR;
+	uint32_t PC;		/* address of the instruction held */
+	const decoded_inst_t *inst;
 	uint32_t A;
 	uint32_t B;
 	uint32_t imm;
 	uint32_t ALUOutput;
 	uint32_t LMD;
-    uint64_t AA;
-    uint64_t BB;
+	uint32_t predicted;	/* the PC fetch went on with after this instruction */
+    uint64_t AA;		/* HI:LO result of MULT/DIV/MTHI/MTLO */
     int RegWrite;
     int MemRead;
-    int FLAG;
-    uint32_t RegisterRd;
-    uint32_t RegisterRs;
-    uint32_t RegisterRt;
-    int forward;
+    uint32_t RegisterRd;	/* inst->dst */
+    uint32_t RegisterRs;	/* inst->srcA */
+    uint32_t RegisterRt;	/* inst->srcB */
+    int deferred;		/* the result comes later, from an MSHR or the multiply/divide unit */
+    uint32_t md_seq;	/* which multiply/divide unit result, if deferred there */
+    int fault;		/* its load or store address is misaligned; WB raises the error */
+    uint32_t thread;	/* hardware context it belongs to */
 	
 } CPU_Pipeline_Reg;
 
@@ -69,32 +302,575 @@ typedef struct CPU_Pipeline_Reg_Struct{
 /* CPU State info.                                                                                                               */
 /***************************************************************/
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_FLAG;	/* run flag*/
-uint32_t INSTRUCTION_COUNT;
-uint32_t CYCLE_COUNT;
+CORE_LOCAL CPU_State CURRENT_STATE, NEXT_STATE;
+CORE_LOCAL int RUN_FLAG;	/* run flag*/
+CORE_LOCAL uint32_t INSTRUCTION_COUNT;
+CORE_LOCAL uint32_t CYCLE_COUNT;
 uint32_t PROGRAM_SIZE; /*in words*/
-int ENABLE_FORWARDING;
-int ForwardA;
-int ForwardB;
+CORE_LOCAL int ENABLE_FORWARDING;
+
+/* pipeline variants, X(function, forwarding): each is handle_pipeline */
+/* specialized for one policy; add a column here for new policies         */
+#define PIPELINE_VARIANTS(X) \
+	X(pipeline_no_forwarding, FALSE) \
+	X(pipeline_forwarding, TRUE)
+CORE_LOCAL void (*HANDLE_PIPELINE)();	/* active variant, set by pipeline_select() */
+CORE_LOCAL int ForwardA;
+CORE_LOCAL int ForwardB;
+CORE_LOCAL int STALL;	/* ID found a hazard this cycle; IF holds */
+/* id_wait: can the instruction in ID issue this cycle? */
+#define ID_GO        0
+#define ID_WAIT_REG  1	/* an operand (or, without forwarding, its producer) is in flight */
+#define ID_WAIT_LOAD 2	/* an outstanding load writes a register it uses */
+#define ID_WAIT_HILO 3	/* the multiply/divide unit is still computing HI/LO */
+#define ID_WAIT_MD   4	/* the multiply/divide unit cannot take another operation yet */
+CORE_LOCAL int FLUSH;	/* EX found a misprediction this cycle: ID and IF are squashed */
+CORE_LOCAL uint32_t FLUSH_PC;	/* where fetch continues after FLUSH */
+CORE_LOCAL int REDIRECT;	/* ID corrected where IF was fetching this cycle */
+CORE_LOCAL uint32_t REDIRECT_PC;	/* where fetch continues after REDIRECT */
+
+/* branch prediction. IF looks up the BTB and, on a hit, the direction      */
+/* predictor; ID sends fetch to direct branches/jumps the BTB missed; EX    */
+/* resolves every branch and jump and flushes what came after a wrong guess */
+#define BP_STATIC  0	/* not taken */
+#define BP_BIMODAL 1	/* 2-bit counters indexed by pc */
+#define BP_GSHARE  2	/* 2-bit counters indexed by pc xor global history */
+#define BP_TABLE_BITS 12
+#define BP_MISPREDICT_PENALTY (IF_DEPTH + 1)	/* fetch slots lost when EX corrects a prediction */
+#define BP_REDIRECT_PENALTY IF_DEPTH	/* fetch slots lost when ID corrects one */
+CORE_LOCAL int BP_KIND;
+CORE_LOCAL uint8_t BP_COUNTERS[1 << BP_TABLE_BITS];
+CORE_LOCAL uint32_t BP_HISTORY;
+
+typedef struct {
+	uint32_t pc;		/* branch or jump, 0 if the entry is empty */
+	uint32_t target;	/* where it went last time it was taken */
+} btb_entry_t;
+
+CORE_LOCAL btb_entry_t *BTB;		/* direct mapped on the pc */
+CORE_LOCAL uint32_t BTB_ENTRIES;	/* a power of two, 0 for no BTB */
+
+/* what each branch and jump did in the pipeline, open addressed on its pc */
+typedef struct {
+	uint32_t pc;		/* 0 if the slot is free */
+	uint8_t op;
+	uint32_t executed, taken, mispredicted, redirected;
+	uint32_t wasted;	/* fetch slots squashed because of it */
+} branch_stat_t;
+
+CORE_LOCAL branch_stat_t *BRANCH_STATS;
+CORE_LOCAL uint32_t BRANCH_STATS_SIZE;	/* a power of two, 0 until the first branch */
+CORE_LOCAL uint32_t BRANCH_STATS_USED;
+
+/* L1 caches: tags only, timing for the pipeline. Data always comes from */
+/* guest memory, so a cache never changes what a program computes            */
+#define CACHE_LRU    0
+#define CACHE_FIFO   1
+#define CACHE_RANDOM 2
+
+/* cache_probe */
+#define CACHE_MISS       0
+#define CACHE_HIT        1
+#define CACHE_PREFETCHED 2	/* hit on a prefetched line not used yet */
+
+typedef struct {
+	uint32_t block;		/* address >> line shift */
+	uint32_t stamp;		/* last use (LRU) or fill (FIFO) */
+	uint32_t ready;		/* cycle a prefetch fill arrives */
+	uint8_t valid, dirty;
+	uint8_t prefetched;	/* brought in by a prefetch, no demand access yet */
+	uint8_t shared;		/* MESI with several cores: S; dirty is M, neither is E */
+} cache_line_t;
+
+typedef struct {
+	const char *name;
+	cache_line_t *lines;	/* sets * assoc, NULL while the cache is off */
+	uint32_t size, assoc, line_size;	/* bytes, ways, bytes; all powers of two */
+	uint32_t sets, line_shift;
+	int policy;				/* CACHE_* */
+	int write_back;			/* write-back + write-allocate, else write-through, no allocate */
+	uint32_t miss_latency;	/* cycles a trip to memory adds */
+	uint32_t clock, random;
+	uint64_t reads, writes, read_misses, write_misses, writebacks, stall_cycles;
+} cache_t;
+
+CORE_LOCAL cache_t ICACHE, DCACHE;
+CORE_LOCAL uint32_t FETCH_READY, MEM_READY;	/* cycle IF's/MEM's cache access completes */
+CORE_LOCAL int FETCH_STARTED, MEM_STARTED;	/* the access for what IF/MEM holds has been made */
+CORE_LOCAL int MEM_STALL;	/* MEM is waiting this cycle; EX, ID and IF hold */
+
+/* Non-blocking loads: a D-cache read miss takes an MSHR and the load moves */
+/* on; its register is written when the line arrives, and only readers      */
+/* (or writers) of that register wait for it in ID                                  */
+#define MSHR_MAX 32
+
+typedef struct {
+	uint32_t block;		/* line being fetched, address >> line shift */
+	uint32_t ready;		/* cycle it arrives */
+	uint32_t issued;
+	int busy;
+} mshr_t;
+
+CORE_LOCAL mshr_t MSHRS[MSHR_MAX];
+CORE_LOCAL uint32_t NUM_MSHRS;		/* 0: a D-cache miss blocks MEM */
+CORE_LOCAL int MEM_MSHR;		/* MSHR the load in MEM waits on, -1 if none */
+CORE_LOCAL uint32_t LOADS_PENDING;	/* bit r: an outstanding load will write GPR r */
+CORE_LOCAL uint32_t PENDING_VALUE[MIPS_REGS];
+CORE_LOCAL int PENDING_MSHR[MIPS_REGS];
+CORE_LOCAL uint64_t MSHR_MISSES, MSHR_MERGED, MSHR_FULL;	/* primary misses, secondary misses, misses that found no free MSHR */
+CORE_LOCAL uint64_t MSHR_HIDDEN;		/* miss cycles MEM did not stall for */
+CORE_LOCAL uint64_t MSHR_DEP_STALLS;	/* cycles ID waited on an outstanding load */
+CORE_LOCAL uint64_t MSHR_OUTSTANDING;	/* sum over cycles of the busy MSHRs */
+
+/* Store buffer between MEM and the D-cache: stores retire into it and */
+/* drain one entry at a time. Like the caches it tracks addresses only;   */
+/* the data is in guest memory from MEM on                                             */
+#define SB_MAX 32
+#define SB_MISS 0	/* sb_access: go on to the D-cache */
+#define SB_DONE 1	/* store buffered, or load forwarded from the buffer */
+#define SB_WAIT 2	/* buffer full, or a load only partly covered: retry next cycle */
+
+typedef struct {
+	uint32_t word;	/* address >> 2 */
+	uint8_t mask;	/* bytes of the word written */
+} sb_entry_t;
+
+CORE_LOCAL sb_entry_t STORE_BUFFER[SB_MAX];
+CORE_LOCAL uint32_t SB_DEPTH;	/* 0: stores go straight to the D-cache */
+CORE_LOCAL uint32_t SB_HEAD, SB_COUNT;
+CORE_LOCAL int SB_DRAINING;	/* the head's write has started */
+CORE_LOCAL uint32_t SB_READY, SB_ISSUED;	/* when it completes / started */
+CORE_LOCAL uint64_t SB_STORES, SB_COALESCED, SB_FORWARDED;
+CORE_LOCAL uint64_t SB_FULL_STALLS, SB_CONFLICT_STALLS;	/* MEM cycles lost to a full buffer / partial overlap */
+CORE_LOCAL uint64_t SB_HIDDEN;		/* store miss cycles MEM did not stall for */
+
+/* DRAM behind the caches: banks with an open row each, and a request  */
+/* queue the controller serves FCFS or FR-FCFS (row hits first). A        */
+/* requester hands in a ready slot that reads DRAM_PENDING until its      */
+/* request is scheduled and the completion cycle after                            */
+#define DRAM_FCFS 0
+#define DRAM_FRFCFS 1
+#define DRAM_BANKS_MAX 64
+#define DRAM_QUEUE_MAX 128
+#define DRAM_BUS_BYTES 8		/* bytes the data bus moves per cycle */
+#define DRAM_PENDING 0xFFFFFFFF
+
+typedef struct {
+	uint32_t row;
+	int open;
+	uint32_t busy_until;
+} dram_bank_t;
+
+typedef struct {
+	uint32_t address, bytes, arrival;
+	int write;
+	uint32_t *ready;	/* NULL for posted writes and abandoned requests */
+} dram_request_t;
+
+typedef struct {
+	uint32_t banks;		/* 0: off, a cache miss costs the cache's flat latency */
+	uint32_t row_size;	/* bytes per row in a bank */
+	uint32_t tCAS, tRCD, tRP;
+	int policy;			/* DRAM_FCFS or DRAM_FRFCFS */
+	dram_bank_t bank[DRAM_BANKS_MAX];
+	dram_request_t queue[DRAM_QUEUE_MAX];	/* oldest first */
+	uint32_t queued;
+	uint64_t reads, writes, row_hits, row_empty, row_conflicts, bytes, latency;
+} dram_t;
+
+CORE_LOCAL dram_t DRAM;
+
+/* Multiply/divide unit: with a latency above one cycle, MULT/MULTU and */
+/* DIV/DIVU hand their HI:LO to the unit in EX and go on; it writes HI  */
+/* and LO when done, in issue order. Anything else reading or writing   */
+/* HI/LO waits in ID until the unit is empty (the HI/LO interlock)        */
+#define MD_QUEUE_MAX 8
+
+typedef struct {
+	uint64_t hilo;
+	uint32_t ready;		/* cycle HI and LO are written */
+	uint32_t seq;
+} md_result_t;
+
+CORE_LOCAL uint32_t MD_MULT_LATENCY, MD_DIV_LATENCY;	/* cycles from EX to a dependent EX; 1: no unit */
+CORE_LOCAL int MD_PIPELINED;		/* a multiply can start every cycle; divides never overlap */
+CORE_LOCAL md_result_t MD_QUEUE[MD_QUEUE_MAX];
+CORE_LOCAL uint32_t MD_HEAD, MD_COUNT, MD_SEQ;
+CORE_LOCAL uint32_t MD_FREE;		/* first cycle the unit takes a new operation in EX */
+CORE_LOCAL uint64_t MD_OPS;
+CORE_LOCAL uint64_t MD_HILO_STALLS;	/* ID cycles waiting for HI/LO */
+CORE_LOCAL uint64_t MD_BUSY_STALLS;	/* ID cycles waiting for the unit itself */
+/* cycles a MULT/MULTU or DIV/DIVU takes in the unit */
+#define md_latency(op) ((op) == OP_MULT || (op) == OP_MULTU ? MD_MULT_LATENCY : MD_DIV_LATENCY)
+
+/* In-order superscalar issue: up to ISSUE_WIDTH instructions a cycle, in  */
+/* program order. Lane 0 is the full pipeline (ID_IF, IF_EX, EX_MEM,       */
+/* MEM_WB); each other lane carries one simple integer op alongside it,  */
+/* so loads/stores, branches/jumps, HI/LO ops and SYSCALL go one a cycle */
+#define ISSUE_MAX 4
+#define LANE(latch, i) ((i) == 0 ? &(latch) : &latch##_LANES[(i) - 1])
+#define IS_MEMORY(op) (IS_LOAD(op) || IS_STORE(op))
+/* nothing younger issues with it */
+#define ENDS_GROUP(inst) (IS_CONTROL((inst)->op) || ISA_INFO[(inst)->op].mem == MEM_SYSCALL || (inst) == &FETCH_ERROR_INST)
+
+/* why ID issued fewer than ISSUE_WIDTH instructions */
+#define ISSUE_FETCH      0	/* nothing more was fetched */
+#define ISSUE_DEPENDENCE 1	/* reads or writes a register written earlier in the group */
+#define ISSUE_MEMORY     2	/* a second load/store */
+#define ISSUE_COMPLEX    3	/* a second branch, jump, HI/LO op or SYSCALL */
+#define ISSUE_HAZARD     4	/* waits on an older instruction in flight */
+#define ISSUE_CONTROL    5	/* comes after a branch, jump or SYSCALL */
+#define ISSUE_REASONS    6
+
+CORE_LOCAL uint32_t ISSUE_WIDTH;	/* 1: scalar */
+CORE_LOCAL uint64_t ISSUE_GROUPS[ISSUE_MAX + 1];	/* cycles ID issued n instructions */
+CORE_LOCAL uint64_t ISSUE_LIMITS[ISSUE_REASONS];	/* cycles ID issued some, but not ISSUE_WIDTH, and why */
+CORE_LOCAL uint32_t WB_LANE_WRITES;	/* bit r: a lane other than 0 wrote GPR r in WB this cycle */
+
+/* Pipeline depth: IF, EX and MEM may each take 1 to DEPTH_MAX cycles, as */
+/* that many back-to-back stages. Stage 1 does the work (fetch, ALU and    */
+/* branch resolution, D-cache access); results leave the last one, so ALU */
+/* results forward from the end of EX and loads from the end of MEM. The   */
+/* named latch still sits after the last stage; the ones in between are     */
+/* IF_STAGES, EX_STAGES and MEM_STAGES, whole groups of lanes each          */
+#define DEPTH_MAX 4
+typedef struct {
+	CPU_Pipeline_Reg lane[ISSUE_MAX];
+} pipeline_group_t;
+CORE_LOCAL uint32_t IF_DEPTH, EX_DEPTH, MEM_DEPTH;
+
+/* Fine-grained multithreading: NUM_THREADS hardware contexts share the    */
+/* pipeline, one instruction a cycle. Every latch carries its context; IF  */
+/* fetches for the context FETCH_POLICY picks into that context's slot      */
+/* (ID_IF for context 0, ID_IF_THREADS for the rest), and ID issues from   */
+/* the first slot, round robin, with no hazard, so the cycles one context  */
+/* would stall are filled by another. Context 0 is CURRENT_STATE and       */
+/* NEXT_STATE; context t runs its own program in memory THREAD_BASE(t)    */
+/* bytes up, so contexts do not see each other's text or data                 */
+#define THREADS_MAX 8
+#define THREAD_BASE(t) ((uint32_t)(t) << 24)
+#define THREAD_SLOT(t) ((t) == 0 ? &ID_IF : &ID_IF_THREADS[(t) - 1])
+/* registers (and, outside IF, the PC) of context t as ID and WB see them */
+#define THREAD_REGS(t) ((t) == 0 ? &NEXT_STATE : &THREAD_STATE[t])
+/* where IF fetches next for context t */
+#define THREAD_FETCH_PC(t) ((t) == 0 ? CURRENT_STATE.PC : THREAD_STATE[t].PC)
+#define FETCH_RR     0	/* round robin over the contexts with room */
+#define FETCH_ICOUNT 1	/* the context with the fewest instructions in flight */
+#define FETCH_SWITCH 2	/* stay with one context until it waits in ID */
+CORE_LOCAL uint32_t NUM_THREADS;	/* 1: no multithreading */
+CORE_LOCAL int FETCH_POLICY;
+CORE_LOCAL CPU_State THREAD_STATE[THREADS_MAX];	/* contexts 1 and up */
+/* set and loaded from the command loop only: contexts need a single core */
+char THREAD_PROGRAM[THREADS_MAX][256];	/* program of context t; empty: the one given on the command line */
+uint32_t THREADS_LOADED;	/* bit t: context t's program is in the memory snapshot */
+int THREADS_STALE;	/* a loaded context was given another program: reset loads everything again */
+CORE_LOCAL uint32_t THREAD_RUNNING;	/* bit t: context t has not exited */
+CORE_LOCAL uint32_t THREAD_STALLED;	/* bit t: context t waited in ID since it was last switched to */
+CORE_LOCAL uint32_t ACTIVE_THREAD;	/* context of what ID or EX is checking: only its own producers count */
+CORE_LOCAL uint32_t WB_THREAD;	/* context of WB_INST */
+CORE_LOCAL uint32_t FETCH_THREAD;	/* context IF fetched for last */
+CORE_LOCAL uint32_t ISSUE_THREAD;	/* context ID issued for last */
+CORE_LOCAL uint32_t FLUSH_THREAD, REDIRECT_THREAD;	/* context FLUSH, REDIRECT is for */
+CORE_LOCAL uint64_t THREAD_RETIRED[THREADS_MAX];
+CORE_LOCAL uint64_t THREAD_WAITS[THREADS_MAX];	/* cycles its instruction waited in ID */
+CORE_LOCAL uint32_t THREAD_DONE[THREADS_MAX];	/* cycle it exited */
+CORE_LOCAL uint64_t THREAD_FILLED;	/* cycles ID issued for one context while another waited */
+
+/* Out-of-order engine (sim --ooo): Tomasulo with a reorder buffer. Up to  */
+/* OOO_WIDTH instructions a cycle are fetched, renamed into the ROB and a   */
+/* reservation station, executed once their operands are on the common     */
+/* data bus, and committed in order to CURRENT_STATE. The ROB entry is the */
+/* rename tag; loads and stores also hold a load/store queue slot, stores  */
+/* write memory when they commit, and a load goes ahead of an older store */
+/* only once that store's address is known not to overlap                          */
+#define OOO_ROB_MAX   256
+#define OOO_WIDTH_MAX 8
+#define OOO_FETCH_MAX (2 * OOO_WIDTH_MAX)	/* fetch queue */
+#define OOO_MEM_PORTS 1	/* loads/stores starting a cycle */
+#define OOO_HIST      8	/* occupancy histogram buckets */
+
+/* reservation station classes */
+#define RS_ALU    0	/* integer ops, branches/jumps, SYSCALL */
+#define RS_MEM    1	/* load/store address generation */
+#define RS_MULDIV 2	/* MULT/DIV, taking MD_MULT_LATENCY/MD_DIV_LATENCY */
+#define RS_CLASSES 3
+
+/* rob_entry_t state */
+#define OOO_WAITING   0	/* in its reservation station */
+#define OOO_EXECUTING 1
+#define OOO_DONE      2	/* result on the CDB */
+
+/* why dispatch stopped short */
+#define OOO_STALL_ROB 0
+#define OOO_STALL_RS  1
+#define OOO_STALL_LSQ 2
+
+typedef struct {
+	const decoded_inst_t *inst;
+	uint32_t pc;
+	uint32_t predicted;	/* where fetch went on after it */
+	uint32_t actual;	/* where it really goes, once executed */
+	uint32_t src[2];	/* srcA and srcB values */
+	int tag[2];			/* ROB entry still computing them, -1 once in src */
+	uint32_t result;	/* GPR result (the value, for a load) */
+	uint64_t hilo;
+	uint32_t address, store_value;	/* loads and stores */
+	uint32_t ready;		/* cycle the result goes on the CDB */
+	uint8_t state, rs;
+	uint8_t fault;		/* unaligned load/store, reported at commit */
+} rob_entry_t;
+
+typedef struct {
+	const decoded_inst_t *inst;
+	uint32_t pc, predicted;
+} fetch_entry_t;
+
+CORE_LOCAL uint32_t OOO_ROB_SIZE, OOO_WIDTH, OOO_LSQ_SIZE;
+CORE_LOCAL uint32_t OOO_RS_SIZE[RS_CLASSES];
+CORE_LOCAL rob_entry_t OOO_ROB[OOO_ROB_MAX];
+CORE_LOCAL uint32_t OOO_HEAD, OOO_COUNT;
+CORE_LOCAL int OOO_RAT[REG_LO + 1];	/* ROB entry that will write each GPR, HI and LO, -1 if none */
+CORE_LOCAL uint32_t OOO_RS_USED[RS_CLASSES], OOO_LSQ_USED;
+CORE_LOCAL fetch_entry_t OOO_FETCH_QUEUE[OOO_FETCH_MAX];
+CORE_LOCAL uint32_t OOO_FETCH_HEAD, OOO_FETCH_COUNT;
+CORE_LOCAL uint32_t OOO_FETCH_PC;
+CORE_LOCAL uint32_t OOO_FETCH_READY;	/* cycle the I-cache access for OOO_FETCH_PC completes */
+CORE_LOCAL int OOO_FETCH_STARTED;
+CORE_LOCAL uint32_t OOO_MD_FREE;		/* first cycle the multiply/divide unit takes a new operation */
+CORE_LOCAL uint32_t OOO_STORE_READY;	/* where committed stores' cache accesses land */
+CORE_LOCAL uint64_t OOO_ROB_HIST[OOO_HIST + 1], OOO_RS_HIST[RS_CLASSES][OOO_HIST + 1], OOO_LSQ_HIST[OOO_HIST + 1];
+CORE_LOCAL uint64_t OOO_STALLS[3];		/* dispatch cycles cut short, per OOO_STALL_* */
+CORE_LOCAL uint64_t OOO_SQUASHED;		/* instructions thrown away after a misprediction */
+CORE_LOCAL uint64_t OOO_FORWARDED;		/* loads that took an older store's value */
+CORE_LOCAL uint64_t OOO_LOAD_WAITS;	/* cycles a ready load waited on an older store */
+
+/* D-side prefetchers, trained on the load/store address stream in MEM */
+/* and filling the D-cache ahead of demand                                               */
+#define PF_NONE     0
+#define PF_NEXTLINE 1	/* tagged: a miss or first use of a prefetched line fetches the next lines */
+#define PF_STRIDE   2	/* per-PC stride, once seen twice in a row */
+#define PF_STREAM   3	/* streams of consecutive misses, kept degree lines ahead */
+#define PF_STRIDE_ENTRIES 64
+#define PF_STREAMS 8
+
+typedef struct {
+	uint32_t pc, last;
+	int32_t stride;
+	uint8_t confidence;	/* times in a row the stride repeated, up to 3 */
+} pf_stride_t;
+
+typedef struct {
+	uint32_t last;		/* last block demanded */
+	uint32_t ahead;		/* last block prefetched */
+	int32_t direction;	/* +1 or -1 once confirmed, 0 while a single miss */
+	uint32_t stamp;		/* for LRU replacement */
+	int valid;
+} pf_stream_t;
+
+CORE_LOCAL int PF_KIND;
+CORE_LOCAL uint32_t PF_DEGREE;		/* lines fetched ahead per trigger */
+CORE_LOCAL pf_stride_t PF_STRIDE_TABLE[PF_STRIDE_ENTRIES];
+CORE_LOCAL pf_stream_t PF_STREAM_TABLE[PF_STREAMS];
+CORE_LOCAL uint32_t PF_CLOCK;
+CORE_LOCAL uint64_t PF_ISSUED;		/* fills sent to memory */
+CORE_LOCAL uint64_t PF_USEFUL;		/* prefetched lines a demand access then used */
+CORE_LOCAL uint64_t PF_LATE;		/* ... of which the demand arrived before the data */
+
+/* execution engines */
+#define SIM_PIPELINE   0
+#define SIM_FUNCTIONAL 1
+#define SIM_TRANSLATED 2	/* functional, with basic blocks translated to host code */
+#define SIM_OOO        3	/* cycle-level, out of order */
+#define SIM_CYCLE_LEVEL(mode) ((mode) == SIM_PIPELINE || (mode) == SIM_OOO)
+int SIM_MODE;
+
+/* dynamic binary translation */
+#define DBT_CODE_SIZE (16 << 20)
+#define DBT_HASH_BITS 16
+#define DBT_HASH_SIZE (1 << DBT_HASH_BITS)
+/* blocks often start at fixed strides, so mix the bits before indexing */
+#define DBT_HASH_INDEX(pc) ((uint32_t)(((pc) >> 2) * 2654435761u) >> (32 - DBT_HASH_BITS))
+#define DBT_MAX_BLOCK 64					/* guest instructions per block */
+#define DBT_MAX_BLOCK_BYTES (DBT_MAX_BLOCK * 128)	/* worst-case host code per block */
+
+typedef struct {
+	uint64_t budget;		/* instructions translated code may still retire */
+	uint8_t *chain_site;	/* rel32 of the jump the last block left through, NULL if not chainable */
+	uint32_t stop;			/* cache flushed or address error: leave translated code */
+	uint32_t fault;			/* address error: the access was not made */
+} dbt_context_t;
+
+typedef struct {
+	uint32_t pc;
+	uint8_t *code;
+} dbt_entry_t;
+
+dbt_context_t DBT_CTX;
+dbt_entry_t DBT_HASH[DBT_HASH_SIZE];	/* guest pc -> block, direct mapped */
+uint8_t *DBT_CODE;			/* code cache, NULL until first used */
+uint8_t *DBT_CODE_START;	/* first byte after the entry/exit glue */
+uint8_t *DBT_CODE_PTR;
+uint8_t *DBT_CODE_END;
+uint8_t *DBT_EXIT;
+uint32_t (*DBT_ENTER)(CPU_State *state, dbt_context_t *ctx, uint8_t *code);
+uint32_t DBT_BLOCKS;		/* blocks translated so far */
+
+/* batch mode: one program run on many register inputs in lockstep, one lane */
+/* per input, registers kept lane-major so each op is a loop over the lanes.  */
+/* Lanes that branch apart wait: each step runs the lowest pc any lane is at, */
+/* for the lanes at that pc, so they meet again where the paths join           */
+#define BATCH_CHUNK 8		/* lanes per vector step; the lane count is padded to it */
+#define BATCH_RUNNING 0
+#define BATCH_EXITED  1		/* SYSCALL with $v0 = 10 */
+#define BATCH_FAULTED 2		/* address error or a store into the program text */
+
+typedef struct {
+	uint32_t key;		/* word address | 1, 0 if the slot is free */
+	uint32_t value;
+} batch_word_t;
+
+/* words written during the batch, open addressed on the word address */
+typedef struct {
+	batch_word_t *words;
+	uint32_t size;		/* a power of two, 0 until the first write */
+	uint32_t used;
+} batch_overlay_t;
+
+typedef struct {
+	uint32_t lanes;
+	uint32_t width;				/* lanes rounded up to BATCH_CHUNK */
+	uint32_t *regs[REG_LO + 1];	/* regs[r][lane] */
+	uint32_t *zero;				/* an all-zero row for NONE operands */
+	uint32_t *result;			/* r of the op being executed, per lane */
+	uint64_t *hilo;				/* hilo of the op being executed, per lane */
+	uint32_t *pc;				/* next instruction, per lane */
+	uint32_t *mask;				/* ~0 for the lanes executing the current op, else 0 */
+	uint8_t *status;			/* BATCH_* */
+	uint32_t *retired;			/* instructions, per lane */
+	CPU_State *start, *final;	/* per lane */
+	batch_overlay_t *overlays;	/* one per lane, then the one all lanes share */
+	uint32_t private_words;		/* words held in some lane's own overlay */
+	uint32_t running;
+	uint32_t stopping;			/* lanes that stopped during the current op */
+	int converged;				/* every running lane is at the current op */
+	uint64_t uniform_ops, scalar_ops;	/* memory ops done once for all lanes vs lane by lane */
+} batch_t;
+
+batch_t BATCH;
+
+/* Shared-memory multicore (cores <n>): NUM_CORES pipelines, each on a host */
+/* thread of its own with its own CORE_LOCAL state, run the one program    */
+/* against the one guest memory; core k starts with $a0 = k. Cores run     */
+/* MC_QUANTUM cycles and then wait for each other, so none gets more than  */
+/* a quantum ahead; deterministic mode runs the quanta one core after       */
+/* another, in core order, instead of all at once. The D-caches are kept  */
+/* coherent with MESI by snooping on a bus: a read miss (BusRd) turns the */
+/* other copies S, a write miss (BusRdX) or a write to an S line (BusUpgr) */
+/* invalidates them, an M copy is written back on the way and any copy    */
+/* supplies the line instead of memory. LL links the core to its line and  */
+/* a store to the line by anyone breaks every link to it; SC stores only  */
+/* while its link holds. Core 0 is the main thread's state and pipeline    */
+#define CORES_MAX 8
+#define MC_LOCKS 64		/* stripes, by D-cache set: a line's snoops and its words' LL/SC */
+#define MC_NO_LINK 0
+#define MC_LINK(address) (((address) >> DCACHE.line_shift) + 1)
+#define MC_COHERENT(cache) (NUM_CORES > 1 && (cache) == &DCACHE)
+
+/* bus transactions */
+#define MC_BUS_RD   0	/* read miss */
+#define MC_BUS_RDX  1	/* write miss */
+#define MC_BUS_UPGR 2	/* write hit on an S line */
+
+/* what mc_dispatch has every core but core 0 do */
+#define MC_RESET 0	/* take MC_CONFIG and start over */
+#define MC_RUN   1	/* run MC_RUN_CYCLES cycles */
+#define MC_EXIT  2
+
+typedef struct {
+	uint64_t bus[3];		/* transactions put on the bus, per MC_BUS_* */
+	uint64_t transfers;		/* misses another D-cache supplied */
+	uint64_t flushes;		/* M copies elsewhere its transactions wrote back */
+	uint64_t invalidations;	/* copies elsewhere its transactions invalidated */
+	uint64_t invalidated;	/* copies of its own others invalidated */
+	uint64_t linked, sc_stored, sc_failed;
+} mc_stats_t;
+
+typedef struct {
+	/* the core's CORE_LOCAL state, for the other cores and for reports */
+	CPU_State *state;
+	cache_t *dcache;
+	int *run_flag;
+	uint32_t *cycles, *instructions;
+	uint32_t link;		/* MC_LINK of what LL read last, MC_NO_LINK once broken */
+	mc_stats_t stats;
+	uint32_t seen;		/* last job it took */
+	pthread_t thread;
+} mc_core_t;
+
+/* core 0's configuration, which the other cores take at reset */
+typedef struct {
+	int forwarding, bp_kind, pf_kind, md_pipelined, dram_policy;
+	uint32_t btb_entries, pf_degree, sb_depth, mshrs, width, depth[3], md_latency[2];
+	uint32_t cache[2][6];	/* I, D: size, assoc, line, policy, write-back, miss latency */
+	uint32_t dram[5];		/* banks, row size, tCAS, tRCD, tRP */
+} mc_config_t;
+
+uint32_t NUM_CORES;		/* 1: no multicore */
+CORE_LOCAL uint32_t CORE_ID;
+int MC_DETERMINISTIC;
+uint32_t MC_QUANTUM;		/* cycles between barriers */
+uint32_t MC_BUS_LATENCY;	/* cycles a bus transaction adds to the access */
+mc_core_t MC_CORES[CORES_MAX];
+mc_config_t MC_CONFIG;
+pthread_mutex_t MC_LOCK[MC_LOCKS];
+pthread_mutex_t MC_MEMORY_LOCK;	/* page table and decoded code; recursive */
+pthread_mutex_t MC_MUTEX;	/* the job hand-off below */
+pthread_cond_t MC_WAKE, MC_DONE;
+int MC_JOB;
+uint32_t MC_JOB_SEQ;		/* bumped for every job */
+uint32_t MC_RUN_CYCLES;
+uint32_t MC_PENDING;		/* cores not done with the job */
+uint32_t MC_TURN;			/* deterministic: core whose quantum it is */
+uint32_t MC_CODE_EPOCH;		/* bumped whenever a page is first decoded */
+CORE_LOCAL uint32_t CORE_CODE_EPOCH;	/* MC_CODE_EPOCH when this core's TLB was last flushed */
 
 
 /***************************************************************/
 /* Pipeline Registers.                                                                                                        */
 /***************************************************************/
-CPU_Pipeline_Reg ID_IF;
-CPU_Pipeline_Reg IF_EX;
-CPU_Pipeline_Reg EX_MEM;
-CPU_Pipeline_Reg MEM_WB;
+CORE_LOCAL CPU_Pipeline_Reg ID_IF;
+CORE_LOCAL CPU_Pipeline_Reg IF_EX;
+CORE_LOCAL CPU_Pipeline_Reg EX_MEM;
+CORE_LOCAL CPU_Pipeline_Reg MEM_WB;
+CORE_LOCAL const decoded_inst_t *WB_INST;	/* instruction WB retired this cycle */
+/* lanes 1 .. ISSUE_WIDTH - 1; ID_IF_LANES queue up behind ID_IF in program order */
+CORE_LOCAL CPU_Pipeline_Reg ID_IF_LANES[ISSUE_MAX - 1];
+CORE_LOCAL CPU_Pipeline_Reg IF_EX_LANES[ISSUE_MAX - 1];
+CORE_LOCAL CPU_Pipeline_Reg EX_MEM_LANES[ISSUE_MAX - 1];
+CORE_LOCAL CPU_Pipeline_Reg MEM_WB_LANES[ISSUE_MAX - 1];
+/* [k]: stage k + 1 of a stage split over *_DEPTH cycles; see DEPTH_MAX */
+CORE_LOCAL pipeline_group_t IF_STAGES[DEPTH_MAX - 1];
+CORE_LOCAL pipeline_group_t EX_STAGES[DEPTH_MAX - 1];
+CORE_LOCAL pipeline_group_t MEM_STAGES[DEPTH_MAX - 1];
+/* fetch slots of contexts 1 and up; see THREAD_SLOT */
+CORE_LOCAL CPU_Pipeline_Reg ID_IF_THREADS[THREADS_MAX - 1];
 
-char prog_file[32];
+char prog_file[256];
 
 
 /***************************************************************/
 /* Function Declerations.                                                                                                */
 /***************************************************************/
 void help();
+int mem_region(uint32_t address);
+uint8_t *mem_lookup(uint32_t address, int alloc);
+void tlb_flush();
+void mem_unaligned(const char *access, int width, uint32_t address);
+uint8_t mem_read_8(uint32_t address);
+uint16_t mem_read_16(uint32_t address);
 uint32_t mem_read_32(uint32_t address);
+void mem_write_8(uint32_t address, uint8_t value);
+void mem_write_16(uint32_t address, uint16_t value);
 void mem_write_32(uint32_t address, uint32_t value);
 void cycle();
 void run(int num_cycles);
@@ -103,16 +879,194 @@ void mdump(uint32_t start, uint32_t stop) ;
 void rdump();
 void handle_command();
 void reset();
+void core_reset();
 void init_memory();
+void free_touched_pages();
+void mem_snapshot();
+void mem_restore_snapshot();
 void load_program();
 void handle_pipeline(); /*IMPLEMENT THIS*/
 void WB();/*IMPLEMENT THIS*/
+void WB_lanes();
+void EX_hold();
+void group_bubble(pipeline_group_t *group);
+void stages_advance(pipeline_group_t *stages, uint32_t depth, CPU_Pipeline_Reg *latch, CPU_Pipeline_Reg *lanes);
+int stages_oldest(const pipeline_group_t *stages, uint32_t depth, uint32_t *pc);
+int md_in_flight(uint32_t seq);
+void IF_stages();
+int depth_configure(uint32_t if_depth, uint32_t ex_depth, uint32_t mem_depth);
+int exit_ahead(uint32_t thread);
+void thread_squash(uint32_t thread, int front_only);
+void thread_exit(uint32_t thread, uint32_t pc);
+void thread_census(uint32_t *front, uint32_t *flight);
+int thread_select(uint32_t skip, uint32_t *thread);
+int thread_load(uint32_t thread);
+void threads_load();
+void threads_reset();
+int threads_configure(uint32_t n, const char *policy);
+void threads_report();
+void threads_rdump();
 void MEM();/*IMPLEMENT THIS*/
-void EX();/*IMPLEMENT THIS*/
-void ID();/*IMPLEMENT THIS*/
 void IF();/*IMPLEMENT THIS*/
+#define PIPELINE_VARIANT_PROTO(name, forwarding) void name();
+PIPELINE_VARIANTS(PIPELINE_VARIANT_PROTO)
+#undef PIPELINE_VARIANT_PROTO
+void pipeline_select();
+int bp_predict(uint32_t pc);
+void bp_update(uint32_t pc, int taken);
+void bp_reset();
+int bp_configure(const char *kind, uint32_t btb_entries);
+branch_stat_t *branch_stat(uint32_t pc);
+void branch_resolve(CPU_Pipeline_Reg *latch);
+int branch_stat_compare(const void *a, const void *b);
+void branch_report();
+void cache_reset(cache_t *cache);
+int cache_configure(cache_t *cache, uint32_t size, uint32_t assoc, uint32_t line_size, int policy, int write_back, uint32_t miss_latency);
+void cache_memory(cache_t *cache, uint32_t address, uint32_t bytes, int write, uint32_t *ready);
+cache_line_t *cache_victim(cache_t *cache, cache_line_t *set, uint32_t *ready);
+void cache_access(cache_t *cache, uint32_t address, int write, uint32_t *ready);
+void cache_lookup(cache_t *cache, uint32_t address, int write, uint32_t *ready);
+cache_line_t *cache_find(cache_t *cache, uint32_t block);
+int cache_probe(const cache_t *cache, uint32_t address);
+void cache_prefetch(cache_t *cache, uint32_t address);
+void cache_report(const cache_t *cache);
+void cache_command();
+void print_stats();
+void mshr_reset();
+int mshr_read(uint32_t address);
+void mshr_tick();
+void sb_reset();
+int sb_access(const decoded_inst_t *inst, uint32_t address);
+void sb_tick();
+void dram_reset();
+int dram_configure(uint32_t banks, uint32_t row_size, uint32_t tCAS, uint32_t tRCD, uint32_t tRP, int policy);
+void dram_request(uint32_t address, uint32_t bytes, int write, uint32_t *ready);
+void dram_issue(uint32_t index);
+void dram_tick();
+void dram_detach(const uint32_t *ready);
+void dram_redirect(const uint32_t *from, uint32_t *to);
+void dram_report();
+void dram_command();
+void md_reset();
+int md_interlock(const decoded_inst_t *inst);
+void md_tick();
+void md_retire(CPU_State *state);
+int issue_lane(const decoded_inst_t *inst);
+void issue_report();
+int ooo_rs_class(const decoded_inst_t *inst);
+uint32_t ooo_value(const rob_entry_t *entry, uint32_t reg);
+void ooo_claim(uint32_t index);
+void ooo_reset();
+void ooo_flush();
+int ooo_configure(uint32_t rob, uint32_t width, uint32_t alu_rs, uint32_t mem_rs, uint32_t md_rs, uint32_t lsq);
+void ooo_squash(uint32_t keep);
+void ooo_commit();
+void ooo_complete();
+void ooo_execute();
+void ooo_dispatch();
+void ooo_fetch();
+void ooo_cycle();
+void ooo_histogram(const char *name, const uint64_t *hist, uint32_t size);
+void ooo_report();
+void ooo_show();
+void pf_reset();
+int pf_configure(const char *kind, uint32_t degree);
+void pf_train(uint32_t pc, uint32_t address, int trigger);
+void pf_report();
+void mc_init();
+pthread_mutex_t *mc_lock(uint32_t address);
+uint8_t *mc_lookup(uint32_t address, int write);
+uint32_t mc_load_linked(uint32_t address);
+int mc_link_store(uint32_t address, int conditional);
+int mc_snoop(uint32_t block, int request, uint32_t *ready);
+void mc_publish();
+void mc_config_capture(mc_config_t *config);
+void mc_config_apply(const mc_config_t *config);
+void mc_core_run();
+void *mc_core_main(void *arg);
+void mc_dispatch(int job);
+void mc_stop();
+int mc_supported();
+int mc_configure(uint32_t n, const char *mode, uint32_t quantum, uint32_t bus_latency);
+int mc_running();
+int mc_ready();
+void mc_run(uint32_t cycles);
+void mc_report();
+void mc_rdump();
+void show_lanes(const char *name, const CPU_Pipeline_Reg *lanes);
+void show_stages(const char *name, const pipeline_group_t *stages, uint32_t depth);
 void show_pipeline();/*IMPLEMENT THIS*/
 void initialize();
+uint32_t read_reg(const CPU_State *state, uint32_t reg);
+void write_result(CPU_State *state, const decoded_inst_t *inst, uint32_t value, uint64_t hilo);
+uint64_t div_signed(uint32_t a, uint32_t b);
+uint64_t div_unsigned(uint32_t a, uint32_t b);
+uint32_t alu_execute(const decoded_inst_t *inst, uint32_t pc, uint32_t a, uint32_t b, uint64_t *hilo);
+uint32_t next_pc(const decoded_inst_t *inst, uint32_t pc, uint32_t a, uint32_t r);
+uint32_t mem_load(const decoded_inst_t *inst, uint32_t address);
+uint32_t mem_store(const decoded_inst_t *inst, uint32_t address, uint32_t value);
+void pipeline_bubble(CPU_Pipeline_Reg *latch);
+void lanes_bubble(CPU_Pipeline_Reg *lanes);
+int group_oldest(const CPU_Pipeline_Reg *latch, const CPU_Pipeline_Reg *lanes, uint32_t *pc);
+void pipeline_flush();
+void set_sim_mode(int mode);
+uint32_t latch_result(const CPU_Pipeline_Reg *latch, uint32_t reg);
+int writes_reg(const CPU_Pipeline_Reg *latch, uint32_t reg);
+int group_writes_reg(const CPU_Pipeline_Reg *latch, const CPU_Pipeline_Reg *lanes, uint32_t reg);
+int stages_write_reg(const pipeline_group_t *stages, uint32_t depth, uint32_t reg, int loads_only);
+int stages_hazard(const decoded_inst_t *inst, int forwarding);
+uint32_t forward_operand(uint32_t reg, uint32_t value, int *forward);
+void functional_step();
+uint32_t functional_run(uint32_t max);
+uint64_t bench_one_run(const CPU_State *start, int engine, uint32_t limit, double *elapsed);
+void bench_dispatch(uint32_t reps);
+uint32_t *batch_overlay_find(const batch_overlay_t *overlay, uint32_t address);
+int batch_overlay_put(batch_overlay_t *overlay, uint32_t address, uint32_t value);
+uint32_t batch_read_word(uint32_t lane, uint32_t address);
+uint32_t batch_read(uint32_t lane, uint32_t address, int bytes);
+int batch_write(uint32_t lane, uint32_t address, uint32_t value, int bytes);
+void batch_stop_lane(uint32_t lane, int status, const char *why, uint32_t address);
+void batch_fault_lane(uint32_t lane, uint32_t pc, const char *why, uint32_t address);
+uint32_t batch_uniform(const uint32_t *row, const uint32_t *row2);
+void batch_load(uint32_t pc, int bytes);
+void batch_store(uint32_t pc, const uint32_t *values, int bytes);
+void batch_syscall(const uint32_t *v0);
+void batch_branch(const uint32_t *cond, uint32_t taken, uint32_t fall);
+void batch_jump_register(const uint32_t *targets);
+void batch_record_lane(uint32_t lane);
+uint32_t batch_schedule();
+void batch_free();
+void batch_run(uint32_t lanes, int reg, uint32_t first, uint32_t step);
+void dbt_emit_guest(uint8_t opcode, int host, uint32_t reg);
+void dbt_emit_jmp(uint8_t *target);
+void dbt_emit_exit(uint32_t pc, uint32_t refund);
+void dbt_emit_chain_exit(uint32_t next);
+void dbt_emit_control(const decoded_inst_t *inst, uint32_t pc);
+void dbt_emit_call(void *fn);
+void dbt_emit_exit_if(uint8_t offset, uint32_t pc, uint32_t refund);
+void dbt_emit_fault_check(uint32_t pc, uint32_t refund);
+void dbt_emit_stop_check(uint32_t next_pc, uint32_t refund);
+void dbt_helper_exec(const decoded_inst_t *inst);
+int dbt_translate_inst(const decoded_inst_t *inst, uint32_t pc, uint32_t refund);
+uint8_t *dbt_translate(uint32_t pc);
+int dbt_init();
+void dbt_flush();
+uint32_t dbt_run(uint32_t max);
+const char *export_c_operand(uint8_t operand, const decoded_inst_t *inst, char *buf);
+void export_c_ops(FILE *fp);
+int export_c_local(uint32_t target, uint32_t chunk, uint32_t end);
+void export_c_goto(FILE *fp, uint32_t target, uint32_t chunk, uint32_t end);
+void export_c_inst(FILE *fp, const decoded_inst_t *inst, uint32_t pc, uint32_t chunk, uint32_t end);
+void export_c(const char *path);
 void print_program(); /*IMPLEMENT THIS*/
 void print_instruction(uint32_t addr);
+void disassemble(const decoded_inst_t *inst, uint32_t addr);
+void decode_instruction(uint32_t word, decoded_inst_t *inst);
+uint8_t isa_operand(uint8_t operand, const decoded_inst_t *inst);
+uint8_t fuse_pair(const decoded_inst_t *inst, const decoded_inst_t *next);
+void predecode_page(mem_page_t *page);
+void predecode_program();
+const decoded_inst_t *fetch_decoded(uint32_t pc);
+double now_seconds();
+void bench_memory(uint32_t accesses);
 
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Pin the scalar pipeline's cycle counts, with forwarding off and on, so a
+# change to its timing shows up here rather than going by unnoticed. The
+# counts date from the pipeline's hazard logic being rebuilt alongside the
+# functional engine: testPipeline1 went from 37 cycles to 31 with
+# forwarding on, as the old ID stage stalled where it had nothing to wait
+# for. Update a count only when a change means to move it.
+# usage: tests/cycles.sh [simulator]   (default: src/mu-mips)
+
+cd "$(dirname "$0")/.." || exit 1
+SIM=${1:-src/mu-mips}
+
+# program forwarding cycles
+EXPECTED='testPipeline1.in 0 31
+testPipeline1.in 1 31
+divu_exit.in 0 16
+divu_exit.in 1 12
+exit_mult.in 0 10
+exit_mult.in 1 8
+ll_sc.in 0 13
+ll_sc.in 1 10
+ll_sc_loop.in 0 8017
+ll_sc_loop.in 1 5010
+lw_fault_dest.in 0 8
+lw_fault_dest.in 1 7
+mem_depth_fault.in 0 11
+mem_depth_fault.in 1 9
+mult_exit.in 0 13
+mult_exit.in 1 9
+sc_unaligned.in 0 10
+sc_unaligned.in 1 9
+store_unmapped.in 0 9
+store_unmapped.in 1 7
+unaligned_load.in 0 14
+unaligned_load.in 1 10
+unaligned_store.in 0 11
+unaligned_store.in 1 9'
+
+echo "$EXPECTED" | while read -r program forwarding cycles; do
+	got=$(printf "f %s\nsim\nrdump\nquit\n" "$forwarding" | "$SIM" "inputs/$program" |
+		sed -n 's/^# Cycles Executed\t: //p')
+	if [ "$got" != "$cycles" ]; then
+		echo "FAIL inputs/$program [f $forwarding]: $got cycles, expected $cycles"
+		exit 1
+	fi
+done || exit 1
+echo "pipeline cycle counts unchanged"